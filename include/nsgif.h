@@ -99,6 +99,11 @@ typedef enum {
 	 * called to restart the animation from the beginning.
 	 */
 	NSGIF_ERR_ANIMATION_END,
+
+	/**
+	 * The GIF can't be decoded in the requested output format.
+	 */
+	NSGIF_ERR_FORMAT,
 } nsgif_error;
 
 /**
@@ -284,7 +289,9 @@ void nsgif_destroy(nsgif_t *gif);
  * fetch another 10 bytes, you would need to call \ref nsgif_data_scan with a
  * size of 35 bytes, and the whole 35 bytes must be contiguous memory. It is
  * safe to `realloc` the source buffer between calls to \ref nsgif_data_scan.
- * (The actual data pointer is allowed to be different.)
+ * (The actual data pointer is allowed to be different.) The exception is
+ * when frames are decoded on another thread while scanning, as described
+ * for \ref nsgif_set_frame_ready.
  *
  * If an error occurs, all previously scanned frames are retained.
  *
@@ -302,6 +309,100 @@ nsgif_error nsgif_data_scan(
 		size_t size,
 		const uint8_t *data);
 
+/**
+ * Limit the number of frames found by \ref nsgif_data_scan.
+ *
+ * By default, \ref nsgif_data_scan scans every frame it has data for. When
+ * only the first frame(s) will be shown, such as for a preview or thumbnail,
+ * setting a limit stops the scan early, so that the time taken to get the
+ * first frame doesn't depend on the size of the file.
+ *
+ * Scanning may be resumed later with \ref nsgif_data_scan_continue.
+ *
+ * Until the frames beyond the limit have been scanned, animations driven via
+ * \ref nsgif_frame_prepare will not loop back to the start. Instead it will
+ * return \ref NSGIF_ERR_END_OF_DATA.
+ *
+ * \param[in]  gif          The \ref nsgif_t object to configure.
+ * \param[in]  frame_limit  Maximum number of frames to scan, or
+ *                          \ref NSGIF_INFINITE for no limit (the default).
+ */
+void nsgif_set_scan_limit(
+		nsgif_t *gif,
+		uint32_t frame_limit);
+
+/**
+ * Client frame ready callback.
+ *
+ * \param[in] pw     The client private word given to
+ *                   \ref nsgif_set_frame_ready.
+ * \param[in] frame  The frame number that is ready to decode.
+ */
+typedef void (*nsgif_frame_ready_cb)(
+		void *pw,
+		uint32_t frame);
+
+/**
+ * Set a callback to be told as each frame is found by scanning.
+ *
+ * The callback is called during \ref nsgif_data_scan, as soon as all of
+ * a frame's data has been scanned and before any later frames are scanned.
+ * It is also called for a truncated final frame that becomes displayable
+ * when \ref nsgif_data_complete is called.
+ *
+ * This lets frames be decoded in step with the data arriving. The callback
+ * may decode the frame with \ref nsgif_frame_decode, or prepare it with
+ * \ref nsgif_frame_prepare, so that early frames are shown without
+ * waiting for the rest of the data given to the scan. It must not call
+ * \ref nsgif_data_scan, \ref nsgif_data_scan_continue,
+ * \ref nsgif_data_complete or \ref nsgif_destroy.
+ *
+ * Alternatively, the callback may pass the frame to another thread, which
+ * decodes it while scanning carries on. Frames are not changed by scanning
+ * once they are ready, so while \ref nsgif_data_scan,
+ * \ref nsgif_data_scan_continue or \ref nsgif_data_complete run on one
+ * thread, one other thread may call \ref nsgif_frame_decode or
+ * \ref nsgif_frame_decode_packed for frames it has been given, provided:
+ *
+ * - the frame numbers are passed between the threads with the client's own
+ *   synchronisation, such as a queue guarded by a mutex,
+ * - the source data is not moved or freed, so each scan is given the same
+ *   data pointer, with more data following the data already given,
+ * - no other functions are called on the \ref nsgif_t object until both
+ *   threads are done with it, and
+ * - the library was built with C11 atomics or the GCC atomic builtins,
+ *   which are used to publish the frames. GCC and Clang have both. Built
+ *   without either, frames must only be decoded on the scanning thread.
+ *
+ * \param[in]  gif    The \ref nsgif_t object to configure.
+ * \param[in]  ready  The frame ready callback, or NULL to remove.
+ * \param[in]  pw     Client private word passed to `ready`.
+ */
+void nsgif_set_frame_ready(
+		nsgif_t *gif,
+		nsgif_frame_ready_cb ready,
+		void *pw);
+
+/**
+ * Continue scanning the source data with a new frame limit.
+ *
+ * This scans any frames in the data already given to \ref nsgif_data_scan,
+ * which were not scanned due to the limit set with \ref nsgif_set_scan_limit.
+ * The new limit replaces the old one for any subsequent scans.
+ *
+ * Unlike \ref nsgif_data_scan, this may be called after calling
+ * \ref nsgif_data_complete.
+ *
+ * \param[in]  gif          The \ref nsgif_t object.
+ * \param[in]  frame_limit  Maximum number of frames to scan, or
+ *                          \ref NSGIF_INFINITE to scan all remaining frames.
+ *
+ * \return NSGIF_OK on success, or appropriate error otherwise.
+ */
+nsgif_error nsgif_data_scan_continue(
+		nsgif_t *gif,
+		uint32_t frame_limit);
+
 /**
  * Tell libnsgif that all the gif data has been provided.
  *
@@ -320,6 +421,53 @@ nsgif_error nsgif_data_scan(
 void nsgif_data_complete(
 		nsgif_t *gif);
 
+/**
+ * Result of checking a frame's image data.
+ */
+typedef struct nsgif_frame_check {
+	/**
+	 * Error decoding the frame would give, or NSGIF_OK. Frames with no
+	 * image to display have NSGIF_ERR_FRAME_DISPLAY.
+	 */
+	nsgif_error status;
+	/**
+	 * Number of pixels of image data decoding the frame needs. Rows
+	 * below the bottom of the GIF aren't decoded, and nor are frames
+	 * that start outside it.
+	 */
+	uint32_t expected;
+	/** Number of pixels the image data decodes to, up to `expected`. */
+	uint32_t pixels;
+	/** Offset of the frame's image data in the source data. */
+	size_t start;
+	/** Offset in the source data where decoding the image data stopped. */
+	size_t end;
+} nsgif_frame_check_t;
+
+/**
+ * Check that the image data of each scanned frame decodes.
+ *
+ * Scanning only checks that the image data's sub-blocks are intact, so
+ * corrupt image data is otherwise only found when the frame is decoded.
+ * This decodes the LZW image data of every frame found by scanning, without
+ * writing any output, to find frames that would fail to decode or are
+ * short of pixels. For example, GIFs could be checked when they are
+ * uploaded, rather than failing when they are shown.
+ *
+ * Frames are checked in parallel if a callback was given to
+ * \ref nsgif_set_parallel.
+ *
+ * \param[in]  gif     The \ref nsgif_t object.
+ * \param[out] checks  Client array of \ref nsgif_info_t.frame_count entries,
+ *                     filled with the result for each frame.
+ * \return NSGIF_OK if every frame decodes to all of its pixels,
+ *         NSGIF_ERR_DATA_FRAME if any frame doesn't, or
+ *         NSGIF_ERR_OOM on allocation failure.
+ */
+nsgif_error nsgif_data_check(
+		nsgif_t *gif,
+		nsgif_frame_check_t *checks);
+
 /**
  * Prepare to show a frame.
  *
@@ -359,6 +507,346 @@ nsgif_error nsgif_frame_decode(
 		uint32_t frame,
 		nsgif_bitmap_t **bitmap);
 
+/**
+ * Configure merging of duplicate frames.
+ *
+ * When enabled, \ref nsgif_frame_prepare skips over any run of frames that
+ * are known to look the same as the frame before them. The last frame of the
+ * run is returned, with the delays of the whole run added together. Runs are
+ * not merged across the end of the animation loop.
+ *
+ * Frames are only known to be duplicates once they have been detected, see
+ * \ref nsgif_set_frame_hashing and \ref nsgif_set_damage_tracking. With
+ * only damage tracking, duplicates are merged from the second loop on.
+ *
+ * By default it is disabled.
+ *
+ * \param[in]  gif     The \ref nsgif_t object to configure.
+ * \param[in]  enable  Whether to merge duplicate frames.
+ */
+void nsgif_set_duplicate_merging(
+		nsgif_t *gif,
+		bool enable);
+
+/**
+ * Configure coalescing of zero delay frames.
+ *
+ * Some encoders build up a single image from a run of frames with zero
+ * delay, for example to use more than 256 colours. By default, each of
+ * these frames is shown, with the default frame delay.
+ *
+ * When enabled, \ref nsgif_frame_prepare treats a run of zero delay frames,
+ * along with the frame that follows it, as one frame. The last frame of the
+ * run is returned, and the area covers the whole run. Decoding it composites
+ * the whole run in one call to \ref nsgif_frame_decode. Runs are not
+ * coalesced across the end of the animation loop.
+ *
+ * By default it is disabled.
+ *
+ * \param[in]  gif     The \ref nsgif_t object to configure.
+ * \param[in]  enable  Whether to coalesce zero delay frames.
+ */
+void nsgif_set_zero_delay_coalescing(
+		nsgif_t *gif,
+		bool enable);
+
+/**
+ * Configure frame decimation, to cap the frame rate.
+ *
+ * When enabled, \ref nsgif_frame_prepare skips over frames until the
+ * delays of the frames skipped, and the frame returned, add up to at least
+ * `interval`. The returned delay is the total. Frames are not skipped
+ * across the end of the animation loop.
+ *
+ * When \ref nsgif_frame_decode composites the skipped frames, any frame
+ * that can't be seen in the frame being decoded is only disposed of, not
+ * decoded. For example, this applies when the next frame covers it. So the
+ * decode cost follows the frame rate shown, rather than the GIF's.
+ *
+ * This can be used for thumbnails, or to save power. By default it is
+ * disabled.
+ *
+ * \param[in]  gif       The \ref nsgif_t object to configure.
+ * \param[in]  interval  Shortest time to show a frame for in cs, or zero to
+ *                       disable.
+ */
+void nsgif_set_frame_decimation(
+		nsgif_t *gif,
+		uint32_t interval);
+
+/**
+ * Order to play an animation's frames in.
+ */
+typedef enum nsgif_playback {
+	/** Play frames from first to last. */
+	NSGIF_PLAYBACK_FORWARD,
+	/** Play frames from last to first. */
+	NSGIF_PLAYBACK_REVERSE,
+	/** Play frames forwards and then backwards. */
+	NSGIF_PLAYBACK_PING_PONG,
+} nsgif_playback;
+
+/**
+ * Set the order \ref nsgif_frame_prepare plays frames in.
+ *
+ * Playing backwards needs every frame, so until \ref nsgif_data_complete
+ * is called, \ref nsgif_frame_prepare returns NSGIF_ERR_END_OF_DATA
+ * where it would step backwards.
+ *
+ * In ping-pong playback, the first and last frames are shown once per
+ * turn, and a loop is counted each time playback turns around at the
+ * first frame. Frames are only merged or decimated while playing forwards.
+ *
+ * Each step backwards in \ref nsgif_frame_decode has to composite the
+ * frames from the start of the animation again, unless checkpoints are
+ * enabled with \ref nsgif_set_checkpoint_budget.
+ *
+ * By default, frames are played forwards.
+ *
+ * \param[in]  gif       The \ref nsgif_t object to configure.
+ * \param[in]  playback  The playback order.
+ */
+void nsgif_set_playback(
+		nsgif_t *gif,
+		nsgif_playback playback);
+
+/**
+ * Set a memory budget for checkpoints of composited frames.
+ *
+ * Every frame depends on the frames before it, so decoding an earlier
+ * frame than the one last decoded normally composites the frames from the
+ * start of the animation again. This makes stepping backwards, for
+ * example in reverse playback, slow for long animations.
+ *
+ * With a budget, \ref nsgif_frame_decode keeps copies of composited frames
+ * and composites from the nearest one instead. Half of the copies are
+ * keyframes spread through the animation. The rest hold the frames before
+ * a frame that was decoded backwards, so that the following steps
+ * backwards are just copies. With room for about twice the square root of
+ * the number of frames, stepping backwards costs the compositing of about
+ * one frame per step.
+ *
+ * Each copy is the size of the image in pixels, times four bytes, or one
+ * byte for GIFs composited on a colour index canvas. Checkpoints are only
+ * kept once \ref nsgif_data_complete has been called.
+ *
+ * By default the budget is zero, and no checkpoints are kept.
+ *
+ * \param[in]  gif     The \ref nsgif_t object to configure.
+ * \param[in]  budget  Memory budget for checkpoints in bytes.
+ */
+void nsgif_set_checkpoint_budget(
+		nsgif_t *gif,
+		size_t budget);
+
+/**
+ * Decodes a GIF frame to a packed colour index buffer.
+ *
+ * This is an alternative to \ref nsgif_frame_decode for displays with
+ * few colours, that avoids 32 bits per pixel output. Each pixel is given
+ * as its index in the global colour palette, see
+ * \ref nsgif_global_palette, packed `bpp` bits per pixel. Within each byte,
+ * the leftmost pixel is in the most significant bits. Pixels that are
+ * transparent are given the GIF's background colour index.
+ *
+ * This is only supported for GIFs with a global colour palette of no more
+ * than `1 << bpp` entries, and no local colour palettes. Otherwise it
+ * returns \ref NSGIF_ERR_FORMAT.
+ *
+ * Frames are composited internally at one byte per pixel, and the client
+ * bitmap is not used. The internal canvas keeps one index free for
+ * transparent pixels, so this needs a global palette of fewer than 256
+ * entries (in practice at most 128, as GIF palette sizes are powers of two).
+ * With a full 256 entry palette, frames are instead decoded to the client
+ * bitmap, as by \ref nsgif_frame_decode, and each pixel is mapped back to
+ * its palette index. This is slower, and where the palette has the same
+ * colour more than once, pixels of that colour are given its first index.
+ *
+ * If the frame's image data is truncated or corrupt, the buffer is still
+ * filled with the partially decoded frame, and the error is returned.
+ *
+ * \param[in]  gif     The \ref nsgif_t object.
+ * \param[in]  frame   The frame number to decode.
+ * \param[in]  bpp     Bits per pixel: 1, 2, 4 or 8.
+ * \param[out] buffer  Client buffer of `height` rows to fill.
+ * \param[in]  stride  Row stride of `buffer` in bytes.
+ *
+ * \return NSGIF_OK on success, or appropriate error otherwise.
+ */
+nsgif_error nsgif_frame_decode_packed(
+		nsgif_t *gif,
+		uint32_t frame,
+		uint8_t bpp,
+		uint8_t *buffer,
+		size_t stride);
+
+/**
+ * Configure tracking of the bitmap area changed by frame decodes.
+ *
+ * The `area` given by \ref nsgif_frame_prepare covers both the previous and
+ * the new frame, which is often much larger than what actually changes.
+ * When damage tracking is enabled, \ref nsgif_frame_decode notes which
+ * pixels of each bitmap row it changes, as it writes them. The bounding box
+ * of the changed pixels can be got with \ref nsgif_frame_damage, and the
+ * changed span of each row with \ref nsgif_frame_damage_span.
+ *
+ * Pixels which a frame's disposal changes, and which the frame's image then
+ * changes back, may be included.
+ *
+ * This costs a comparison of each pixel written, but no extra copies of the
+ * bitmap. By default it is disabled.
+ *
+ * \param[in]  gif     The \ref nsgif_t object to configure.
+ * \param[in]  enable  Whether to track changed bitmap area.
+ */
+void nsgif_set_damage_tracking(
+		nsgif_t *gif,
+		bool enable);
+
+/**
+ * Get the bitmap area changed by the last call to \ref nsgif_frame_decode.
+ *
+ * If no pixels changed, `damage` is returned as an empty rectangle, with all
+ * of its members zero. The whole bitmap is covered for the first decode to a
+ * newly created bitmap.
+ *
+ * \param[in]  gif     The \ref nsgif_t object.
+ * \param[out] damage  Returns the bounding box of the changed pixels.
+ * \return true on success, or false if damage tracking is not enabled.
+ */
+bool nsgif_frame_damage(
+		const nsgif_t *gif,
+		nsgif_rect_t *damage);
+
+/**
+ * Get the span of a bitmap row changed by the last \ref nsgif_frame_decode.
+ *
+ * Pixels from `x0` up to, but not including, `x1` changed. If no pixels in
+ * the row changed, `x0` and `x1` are equal.
+ *
+ * If there wasn't memory to track each row, the span covers the whole
+ * width of the area given by \ref nsgif_frame_damage.
+ *
+ * \param[in]  gif  The \ref nsgif_t object.
+ * \param[in]  row  The bitmap row to get the changed span of.
+ * \param[out] x0   Returns the first changed pixel in the row.
+ * \param[out] x1   Returns the pixel after the last changed one.
+ * \return true on success, or false if damage tracking is not enabled or
+ *         the row is outside the bitmap.
+ */
+bool nsgif_frame_damage_span(
+		const nsgif_t *gif,
+		uint32_t row,
+		uint32_t *x0,
+		uint32_t *x1);
+
+/**
+ * Decode a small placeholder image of the first frame.
+ *
+ * The first frame is point-sampled directly into the client's buffer as it
+ * is decompressed, without decoding to the full size bitmap. Decoding stops
+ * as soon as the last sampled row is reached. This is intended for tiny
+ * previews, around 16 to 32 pixels wide, and is much cheaper than a normal
+ * decode followed by scaling.
+ *
+ * The buffer is not scaled to keep the image's aspect ratio; the client
+ * should choose `width` and `height` to suit. Pixels are in the same format
+ * as \ref nsgif_bitmap_t, with a row span of `width` pixels.
+ *
+ * This doesn't affect the state of the animation, or the frame decoded to
+ * the client bitmap.
+ *
+ * \param[in]  gif     The \ref nsgif_t object.
+ * \param[out] buffer  Client buffer of `width * height` pixels to fill.
+ * \param[in]  width   Placeholder width in pixels.
+ * \param[in]  height  Placeholder height in pixels.
+ * \return NSGIF_OK on success, or appropriate error otherwise.
+ */
+nsgif_error nsgif_placeholder(
+		nsgif_t *gif,
+		uint32_t *buffer,
+		uint32_t width,
+		uint32_t height);
+
+/**
+ * Parameters for texture atlas creation.
+ */
+typedef struct nsgif_atlas_params {
+	/**
+	 * Maximum atlas width in pixels.
+	 *
+	 * Frame images are placed in rows, left to right, and a new row is
+	 * started when a row would get wider than this. The atlas is made
+	 * wider if a single frame image needs it.
+	 */
+	uint32_t max_width;
+	/** Number of transparent pixels around each frame image. */
+	uint32_t padding;
+	/** Whether to trim transparent edges from frame images. */
+	bool trim;
+	/**
+	 * Whether frames that look the same share one atlas image.
+	 *
+	 * Frame images are matched by area and a hash of their pixels, and
+	 * only shared once their pixels are found to be the same.
+	 */
+	bool dedupe;
+} nsgif_atlas_params_t;
+
+/**
+ * Placement of a frame in a texture atlas.
+ */
+typedef struct nsgif_atlas_frame {
+	/** Area of the atlas holding the frame's image. */
+	nsgif_rect_t atlas;
+	/** Area of the GIF's image to draw the atlas area at. */
+	nsgif_rect_t rect;
+	/** Index of the frame's image; frames sharing an image match. */
+	uint32_t image;
+	/** Time to show the frame for, in cs. */
+	uint32_t delay;
+} nsgif_atlas_frame_t;
+
+/**
+ * Create a texture atlas holding every frame of an animation.
+ *
+ * Each frame is composited and its image copied into a new client bitmap,
+ * created with the `create` bitmap callback. The client owns the atlas
+ * bitmap, and must destroy it.
+ *
+ * The frames are decoded twice: first to lay out the atlas, and then to
+ * copy each frame image straight into it. This doubles the decode work,
+ * but keeping the frame images from the first decode would need up to as
+ * much memory again as the atlas, which is the larger cost for the big
+ * sprite sheets this is meant for. Frames are decoded again if frames
+ * matched for sharing turn out to differ.
+ *
+ * If every frame image is trimmed away and there is no padding, the atlas
+ * is a single transparent pixel.
+ *
+ * Each frame image is complete, so a frame is shown by clearing the display
+ * and drawing the `atlas` area of the atlas at the `rect` area. If trimming
+ * is enabled, `rect` only covers the frame's non-transparent pixels.
+ *
+ * This decodes every frame, so the client bitmap is left holding the last
+ * frame. Frames with truncated or corrupt image data are given as far as
+ * they could be decoded, as \ref nsgif_frame_decode leaves them in the
+ * client bitmap.
+ *
+ * \param[in]  gif     The \ref nsgif_t object.
+ * \param[in]  params  Atlas layout parameters.
+ * \param[out] table   Client array of `frame_count` entries to fill with
+ *                     each frame's placement in the atlas.
+ * \param[out] atlas   On success, returns the atlas bitmap.
+ * \return NSGIF_OK on success, NSGIF_ERR_BAD_FRAME if there are no frames,
+ *         or NSGIF_ERR_OOM on allocation failure.
+ */
+nsgif_error nsgif_atlas_create(
+		nsgif_t *gif,
+		const nsgif_atlas_params_t *params,
+		nsgif_atlas_frame_t *table,
+		nsgif_bitmap_t **atlas);
+
 /**
  * Reset a GIF animation.
  *
@@ -390,6 +878,10 @@ typedef struct nsgif_info {
 	uint32_t background;
 	/** whether the GIF has a global colour table */
 	bool global_palette;
+	/** whether the GIF has an ICC colour profile */
+	bool icc_profile;
+	/** number of extension blocks indexed */
+	uint32_t extension_count;
 } nsgif_info_t;
 
 /**
@@ -433,6 +925,30 @@ typedef struct nsgif_frame_info {
 
 	/** Frame's redraw rectangle. */
 	nsgif_rect_t rect;
+
+	/**
+	 * Hash of the frame's image data, or zero if not computed.
+	 *
+	 * See \ref nsgif_set_frame_hashing.
+	 */
+	uint64_t hash;
+
+	/**
+	 * Whether the frame is known to look the same as the previous frame.
+	 *
+	 * Detected when scanning if frame hashing is enabled, or when the
+	 * frame is decoded if damage tracking is enabled.
+	 */
+	bool duplicate;
+
+	/** Byte length of the frame's compressed image data. */
+	uint32_t data_length;
+	/** Number of pixels in the frame's redraw rectangle. */
+	uint32_t area;
+	/** Number of pixels in the frame's redraw rectangle within the image. */
+	uint32_t clipped_area;
+	/** Whether the whole image is cleared or restored before drawing it. */
+	bool full_restore;
 } nsgif_frame_info_t;
 
 /**
@@ -456,6 +972,166 @@ const nsgif_frame_info_t *nsgif_get_frame_info(
 		const nsgif_t *gif,
 		uint32_t frame);
 
+/**
+ * Estimated cost of decoding a frame.
+ */
+typedef struct nsgif_frame_cost {
+	/** Number of frames that would be drawn. */
+	uint32_t frames;
+	/** Byte length of compressed image data that would be decoded. */
+	size_t data_length;
+	/** Number of pixels that would be decoded. */
+	size_t pixels;
+	/** Number of pixels that would be cleared, restored, or recorded. */
+	size_t disposal;
+} nsgif_frame_cost_t;
+
+/**
+ * Estimate the cost of decoding a frame, from the current decoded state.
+ *
+ * Getting a frame may require the frames before it to be drawn first, for
+ * example if the animation has to restart, or frames were skipped. This
+ * adds up the work \ref nsgif_frame_decode would do to get to the given
+ * frame from the frame that was last decoded, using the per-frame figures
+ * in \ref nsgif_frame_info_t. It is a prediction for scheduling decodes;
+ * it does no decoding.
+ *
+ * \param[in]  gif    The \ref nsgif_t object.
+ * \param[in]  frame  The frame to estimate the cost of getting to.
+ * \param[out] cost   Returns the estimated cost on success.
+ * \return NSGIF_OK on success, or NSGIF_ERR_BAD_FRAME if the frame doesn't
+ *         exist.
+ */
+nsgif_error nsgif_frame_cost(
+		const nsgif_t *gif,
+		uint32_t frame,
+		nsgif_frame_cost_t *cost);
+
+/**
+ * GIF extension block labels.
+ */
+enum nsgif_extension {
+	NSGIF_EXT_PLAIN_TEXT      = 0x01, /**< Plain Text Extension. */
+	NSGIF_EXT_GRAPHIC_CONTROL = 0xf9, /**< Graphic Control Extension. */
+	NSGIF_EXT_COMMENT         = 0xfe, /**< Comment Extension. */
+	NSGIF_EXT_APPLICATION     = 0xff, /**< Application Extension. */
+};
+
+/**
+ * A span of bytes within the GIF source data.
+ */
+typedef struct nsgif_span {
+	/** Start of the span. */
+	const uint8_t *data;
+	/** Byte length of the span. */
+	size_t len;
+} nsgif_span_t;
+
+/**
+ * Information about an extension block in the GIF source data.
+ *
+ * Offsets are relative to the start of the GIF source data, so they remain
+ * valid if the client moves the source data.
+ */
+typedef struct nsgif_extension_info {
+	/** Extension label, e.g. \ref NSGIF_EXT_COMMENT. */
+	uint8_t label;
+	/** Index of the frame the extension comes before. */
+	uint32_t frame;
+	/** Offset to the extension introducer byte. */
+	size_t offset;
+	/**
+	 * Offset to the extension's header block data.
+	 *
+	 * For application extensions, this is the application identifier
+	 * followed by the authentication code.
+	 */
+	size_t header_offset;
+	/** Byte length of the header block; zero for comment extensions. */
+	uint8_t header_len;
+	/** Number of data sub-blocks following the header block. */
+	uint32_t sub_blocks;
+	/** Total byte length of the data in the sub-blocks. */
+	size_t data_len;
+} nsgif_extension_info_t;
+
+/**
+ * Configure indexing of extension blocks.
+ *
+ * When enabled, \ref nsgif_data_scan records the type and position of every
+ * extension block it scans, including comment, plain text and application
+ * extensions (e.g. XMP data), which LibNSGIF otherwise ignores. Indexed
+ * extensions can be accessed with \ref nsgif_get_extension_info and
+ * \ref nsgif_extension_data.
+ *
+ * This must be enabled before scanning. By default it is disabled.
+ *
+ * \param[in]  gif     The \ref nsgif_t object to configure.
+ * \param[in]  enable  Whether to index extension blocks.
+ */
+void nsgif_set_extension_index(
+		nsgif_t *gif,
+		bool enable);
+
+/**
+ * Get information about an indexed extension block.
+ *
+ * \param[in]  gif  The \ref nsgif_t object to get extension info for.
+ * \param[in]  ext  The extension number, less than the `extension_count`
+ *                  in \ref nsgif_info_t.
+ *
+ * \return The extension info, or NULL on error.
+ */
+const nsgif_extension_info_t *nsgif_get_extension_info(
+		const nsgif_t *gif,
+		uint32_t ext);
+
+/**
+ * Get the data sub-blocks of an indexed extension block.
+ *
+ * The sub-block data is not copied or concatenated. Instead, the returned
+ * spans point into the GIF source data most recently given to
+ * \ref nsgif_data_scan, so they are only valid for as long as that is.
+ *
+ * If `count` is less than the number of sub-blocks, only the first `count`
+ * spans are filled in. The number of sub-blocks is also available as
+ * `sub_blocks` in \ref nsgif_extension_info_t.
+ *
+ * \param[in]  gif    The \ref nsgif_t object.
+ * \param[in]  ext    The extension number.
+ * \param[out] spans  Client array to fill with sub-block data spans.
+ * \param[in]  count  Number of entries in `spans`.
+ * \return The number of sub-blocks in the extension.
+ */
+size_t nsgif_extension_data(
+		const nsgif_t *gif,
+		uint32_t ext,
+		nsgif_span_t *spans,
+		size_t count);
+
+/**
+ * Configure hashing of frame image data.
+ *
+ * When enabled, \ref nsgif_data_scan computes a fast, non-cryptographic
+ * 64-bit hash of each frame, which is given as `hash` in the frame's
+ * \ref nsgif_frame_info_t. The hash covers the frame's image descriptor,
+ * any local colour table, the transparent colour index, and the compressed
+ * image data, so frames with the same hash are drawn identically, given the
+ * same starting bitmap. Hashes can be compared between different GIFs, for
+ * example to deduplicate frames in a content-addressed cache.
+ *
+ * LibNSGIF uses the hashes to skip decoding any frame which is identical to
+ * the previous frame, where the previous frame is left in place.
+ *
+ * This must be enabled before scanning. By default it is disabled.
+ *
+ * \param[in]  gif     The \ref nsgif_t object to configure.
+ * \param[in]  enable  Whether to hash frame image data.
+ */
+void nsgif_set_frame_hashing(
+		nsgif_t *gif,
+		bool enable);
+
 /**
  * Get the global colour palette.
  *
@@ -493,6 +1169,174 @@ bool nsgif_local_palette(
 		uint32_t table[NSGIF_MAX_COLOURS],
 		size_t *entries);
 
+/**
+ * Colour statistics for a frame.
+ *
+ * Colours are in the same pixel format as \ref nsgif_bitmap_t.
+ */
+typedef struct nsgif_colour_stats {
+	/** Number of the frame's pixels with each colour index. */
+	uint32_t histogram[NSGIF_MAX_COLOURS];
+	/** Number of the frame's pixels that aren't transparent. */
+	uint32_t pixels;
+	/** Most common colour of the frame's non-transparent pixels. */
+	uint32_t dominant;
+	/** Average colour of the frame's non-transparent pixels. */
+	uint32_t average;
+} nsgif_colour_stats_t;
+
+/**
+ * Configure collection of frame colour statistics.
+ *
+ * When enabled, the colour index of every pixel is counted as each frame is
+ * first decoded. This is cheaper than examining the decoded bitmap, for
+ * example to get a dominant or average colour for a placeholder.
+ *
+ * The statistics cover the frame's own pixels, clipped to the image, and
+ * not the composited bitmap. They can be got with
+ * \ref nsgif_get_frame_colour_stats.
+ *
+ * By default it is disabled.
+ *
+ * \param[in]  gif     The \ref nsgif_t object to configure.
+ * \param[in]  enable  Whether to collect colour statistics.
+ */
+void nsgif_set_colour_stats(
+		nsgif_t *gif,
+		bool enable);
+
+/**
+ * Get the colour statistics for a frame.
+ *
+ * \param[in]  gif    The \ref nsgif_t object.
+ * \param[in]  frame  The frame to get colour statistics for.
+ * \return The frame's colour statistics, or NULL if the frame has not been
+ *         decoded with colour statistics enabled.
+ */
+const nsgif_colour_stats_t *nsgif_get_frame_colour_stats(
+		const nsgif_t *gif,
+		uint32_t frame);
+
+/**
+ * Get the GIF's ICC colour profile.
+ *
+ * GIFs may contain an ICC colour profile in an `ICCRGBG1012` application
+ * extension. The `icc_profile` member of \ref nsgif_info_t indicates whether
+ * one was found by \ref nsgif_data_scan.
+ *
+ * The profile is split over many data sub-blocks in the GIF source data, so
+ * it is copied into a contiguous client buffer. To find the required buffer
+ * size, call with a NULL buffer.
+ *
+ * \param[in]  gif     The \ref nsgif_t object.
+ * \param[out] buffer  Client buffer to copy the profile into, or NULL.
+ * \param[in]  len     Byte length of `buffer`.
+ * \return The size of the profile in bytes, or zero if there is no complete
+ *         profile. If this is greater than `len`, nothing is copied.
+ */
+size_t nsgif_icc_profile(
+		const nsgif_t *gif,
+		uint8_t *buffer,
+		size_t len);
+
+/**
+ * Client colour transform callback.
+ *
+ * This is given each colour table as it is decoded, so that colour
+ * management can be done for at most 256 colours per colour table, rather
+ * than per pixel. The transform must be done in place.
+ *
+ * Colours are in same pixel format as \ref nsgif_bitmap_t. The alpha
+ * component must not be changed.
+ *
+ * \param[in]  pw       The client private word given to
+ *                      \ref nsgif_set_colour_transform.
+ * \param[in]  table    The colour table to transform.
+ * \param[in]  entries  The number of entries in the colour table.
+ */
+typedef void (*nsgif_colour_transform_cb)(
+		void *pw,
+		uint32_t *table,
+		size_t entries);
+
+/**
+ * Set a colour transform to apply to the GIF's colour tables.
+ *
+ * The transform is applied to the global colour table, any frame local
+ * colour tables, the background colour, and the palettes returned by
+ * \ref nsgif_global_palette and \ref nsgif_local_palette. It is not applied
+ * to the default colour table used for GIFs without a global colour table.
+ *
+ * This may be called after \ref nsgif_data_scan, for example once the client
+ * has created a transform from the GIF's ICC profile (see
+ * \ref nsgif_icc_profile). In that case, the global colour table is decoded
+ * again, and any subsequent frame decode will start again from the first
+ * frame.
+ *
+ * \param[in]  gif        The \ref nsgif_t object to configure.
+ * \param[in]  transform  The colour transform callback, or NULL to remove.
+ * \param[in]  pw         Client private word passed to `transform`.
+ */
+void nsgif_set_colour_transform(
+		nsgif_t *gif,
+		nsgif_colour_transform_cb transform,
+		void *pw);
+
+/**
+ * Job to run over part of a range of work items.
+ *
+ * \param[in] ctx    Job context given to the \ref nsgif_parallel_cb.
+ * \param[in] start  First item to process.
+ * \param[in] end    Item after the last to process.
+ */
+typedef void (*nsgif_job_cb)(
+		void *ctx,
+		uint32_t start,
+		uint32_t end);
+
+/**
+ * Client parallel-for callback.
+ *
+ * This must call `job` for ranges of items that together cover items 0 to
+ * `count` without overlapping, and return once all the calls have returned.
+ * The calls may be made concurrently, from any threads. A single call for
+ * the whole range is valid.
+ *
+ * \param[in] pw     The client private word given to
+ *                   \ref nsgif_set_parallel.
+ * \param[in] count  Number of work items.
+ * \param[in] job    Job to run for each range of items.
+ * \param[in] ctx    Job context to pass to `job`.
+ */
+typedef void (*nsgif_parallel_cb)(
+		void *pw,
+		uint32_t count,
+		nsgif_job_cb job,
+		void *ctx);
+
+/**
+ * Set a parallel-for callback for splitting up large canvas operations.
+ *
+ * Background fills, restore previous copies, and expansion of colour
+ * indices to the bitmap are memory bound on large canvases. With this set,
+ * those covering at least `threshold` pixels are split into bands of rows,
+ * which the client can run on its own worker threads.
+ *
+ * The library creates no threads itself. Without a callback, everything is
+ * done on the calling thread.
+ *
+ * \param[in]  gif        The \ref nsgif_t object to configure.
+ * \param[in]  parallel   The parallel-for callback, or NULL to remove.
+ * \param[in]  pw         Client private word passed to `parallel`.
+ * \param[in]  threshold  Minimum number of pixels for an operation to be
+ *                        split up.
+ */
+void nsgif_set_parallel(
+		nsgif_t *gif,
+		nsgif_parallel_cb parallel,
+		void *pw,
+		size_t threshold);
+
 /**
  * Configure handling of small frame delays.
  *
@@ -524,4 +1368,183 @@ void nsgif_set_frame_delay_behaviour(
 		uint16_t delay_min,
 		uint16_t delay_default);
 
+/**
+ * Opaque type for a scheduler of many animations.
+ *
+ * A scheduler drives the animation of many \ref nsgif_t objects, for
+ * example all the animated GIFs on a page, keeping the total decode work
+ * per tick within a budget.
+ */
+typedef struct nsgif_sched nsgif_sched_t;
+
+/**
+ * Priority of an animation registered with a \ref nsgif_sched_t.
+ */
+typedef enum nsgif_priority {
+	/** Animation is shown. Its frames are decoded first. */
+	NSGIF_PRIORITY_VISIBLE,
+	/**
+	 * Animation is near to being shown. It keeps time, but its frames
+	 * are only decoded with any budget left over by visible animations.
+	 */
+	NSGIF_PRIORITY_NEAR,
+	/** Animation is hidden. It is paused. */
+	NSGIF_PRIORITY_HIDDEN,
+} nsgif_priority;
+
+/**
+ * Client callback for a scheduled animation's new frame.
+ *
+ * \param[in] pw      The client private word given to \ref nsgif_sched_add.
+ * \param[in] gif     The animation's \ref nsgif_t object.
+ * \param[in] bitmap  The decoded frame.
+ * \param[in] area    The area in pixels that must be redrawn.
+ */
+typedef void (*nsgif_sched_frame_cb)(
+		void *pw,
+		nsgif_t *gif,
+		nsgif_bitmap_t *bitmap,
+		const nsgif_rect_t *area);
+
+/**
+ * Create a scheduler for many animations.
+ *
+ * On each \ref nsgif_sched_tick, the scheduler advances every animation
+ * that isn't hidden with \ref nsgif_frame_prepare, as its frames fall due.
+ * The due frames are then decoded with \ref nsgif_frame_decode in priority
+ * order, skipping any whose estimated cost (see \ref nsgif_frame_cost)
+ * would exceed what is left of the budget, so that cheaper frames after
+ * them can still use it. Animations that miss out keep time, and skip
+ * ahead to their current frame when they are next decoded. Among
+ * animations of the same priority, those waiting longest come first, so
+ * a frame that missed out isn't passed over for ever.
+ *
+ * The first due frame is always decoded, so that every tick makes progress.
+ *
+ * \param[in]  budget     Pixels to decode, clear or restore per tick.
+ * \param[out] sched_out  Returns the created scheduler on success.
+ * \return NSGIF_OK on success, or NSGIF_ERR_OOM on allocation failure.
+ */
+nsgif_error nsgif_sched_create(
+		size_t budget,
+		nsgif_sched_t **sched_out);
+
+/**
+ * Free a scheduler.
+ *
+ * The registered \ref nsgif_t objects are not destroyed.
+ *
+ * \param[in]  sched  The scheduler to destroy.
+ */
+void nsgif_sched_destroy(
+		nsgif_sched_t *sched);
+
+/**
+ * Register an animation with a scheduler.
+ *
+ * The animation starts from its next frame on the next tick. While it is
+ * registered, the client must not call \ref nsgif_frame_prepare or
+ * \ref nsgif_frame_decode for it, and must remove it from the scheduler
+ * before destroying it.
+ *
+ * If the animation is already registered, its priority and callback are
+ * updated.
+ *
+ * \param[in]  sched     The scheduler.
+ * \param[in]  gif       The animation to register.
+ * \param[in]  priority  The animation's priority.
+ * \param[in]  frame     Callback for each new frame to show.
+ * \param[in]  pw        Client private word passed to `frame`.
+ * \return NSGIF_OK on success, or NSGIF_ERR_OOM on allocation failure.
+ */
+nsgif_error nsgif_sched_add(
+		nsgif_sched_t *sched,
+		nsgif_t *gif,
+		nsgif_priority priority,
+		nsgif_sched_frame_cb frame,
+		void *pw);
+
+/**
+ * Remove an animation from a scheduler.
+ *
+ * \param[in]  sched  The scheduler.
+ * \param[in]  gif    The animation to remove.
+ */
+void nsgif_sched_remove(
+		nsgif_sched_t *sched,
+		nsgif_t *gif);
+
+/**
+ * Change the priority of an animation registered with a scheduler.
+ *
+ * Hiding an animation pauses it. When it is shown again, it carries on
+ * from where it was paused.
+ *
+ * \param[in]  sched     The scheduler.
+ * \param[in]  gif       The animation.
+ * \param[in]  priority  The animation's new priority.
+ */
+void nsgif_sched_set_priority(
+		nsgif_sched_t *sched,
+		nsgif_t *gif,
+		nsgif_priority priority);
+
+/**
+ * Set a tick grid for a scheduler's wakeups.
+ *
+ * By default, the wakeup time returned by \ref nsgif_sched_tick is the
+ * earliest time any animation's next frame falls due. With a grid set, it
+ * is rounded up to a multiple of `quantum`, so that animations with nearby
+ * deadlines are advanced together, on fewer wakeups.
+ *
+ * Animations still keep their own time; a frame shown late by rounding
+ * doesn't delay the frames after it.
+ *
+ * \param[in]  sched    The scheduler.
+ * \param[in]  quantum  Tick grid interval in centiseconds, or zero for none.
+ */
+void nsgif_sched_set_quantum(
+		nsgif_sched_t *sched,
+		uint32_t quantum);
+
+/**
+ * Get the time a scheduler next needs to be ticked.
+ *
+ * This is the earliest deadline of all the animations which aren't hidden,
+ * rounded up to the tick grid, if one is set. Adding or resuming an
+ * animation makes it due immediately.
+ *
+ * An animation whose frame missed out on the budget is retried when its
+ * next frame falls due, or after 10cs or the tick grid interval, whichever
+ * is longer, if that is sooner. So a scheduler that can't keep up with its
+ * animations doesn't wake on every centisecond.
+ *
+ * An animation waiting for more source data has no deadline. The client
+ * should tick the scheduler when it gives the animation more data.
+ *
+ * \param[in]  sched  The scheduler.
+ * \return The time of the next wakeup in centiseconds, or UINT64_MAX if
+ *         there is nothing to wake for.
+ */
+uint64_t nsgif_sched_wakeup(
+		const nsgif_sched_t *sched);
+
+/**
+ * Advance the animations registered with a scheduler.
+ *
+ * Every animation which has a frame due is advanced, so a single timer can
+ * drive all of a scheduler's animations, rather than one per animation.
+ *
+ * Frame callbacks are called from within this function. They must not
+ * add or remove animations.
+ *
+ * \param[in]  sched  The scheduler.
+ * \param[in]  now    The current time in centiseconds, from a clock that
+ *                    doesn't go backwards.
+ * \return The time of the next wakeup, as given by \ref nsgif_sched_wakeup.
+ */
+uint64_t nsgif_sched_tick(
+		nsgif_sched_t *sched,
+		uint64_t now);
+
 #endif
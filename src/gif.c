@@ -14,6 +14,36 @@
 #include <string.h>
 #include <stdbool.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Publish a value to other threads, along with everything written before
+ * it, or read a published value.
+ *
+ * Values published must be declared with \ref nsgif__atomic. This uses the
+ * GCC atomic builtins, or else C11 atomics. Without either, these are plain
+ * accesses, and frames can't be decoded on another thread while scanning.
+ */
+#if defined(__GNUC__)
+#define nsgif__atomic
+#define nsgif__publish(_p, _v) __atomic_store_n(_p, _v, __ATOMIC_RELEASE)
+#define nsgif__published(_p) __atomic_load_n(_p, __ATOMIC_ACQUIRE)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+		!defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define nsgif__atomic _Atomic
+#define nsgif__publish(_p, _v) \
+		atomic_store_explicit(_p, _v, memory_order_release)
+#define nsgif__published(_p) \
+		atomic_load_explicit(_p, memory_order_acquire)
+#else
+#define nsgif__atomic
+#define nsgif__publish(_p, _v) (*(_p) = (_v))
+#define nsgif__published(_p) (*(_p))
+#endif
+
 #include "lzw.h"
 #include "nsgif.h"
 
@@ -27,18 +57,39 @@
  */
 #define NSGIF_FRAME_DELAY_DEFAULT 10
 
+/** Number of frames in the first block of the frame table. */
+#define NSGIF_FRAME_BLOCK 16
+
+/**
+ * Number of blocks in the frame table.
+ *
+ * Each block holds twice as many frames as the one before, so this is
+ * enough for any frame count.
+ */
+#define NSGIF_FRAME_BLOCKS 28
+
+/** Frame compositing plan flags, compiled at scan time. */
+enum nsgif_plan {
+	/** The frame covers the previous frame, which needn't be disposed. */
+	NSGIF_PLAN_SKIP_DISPOSE = (1 << 0),
+};
+
 /** GIF frame data */
 typedef struct nsgif_frame {
 	struct nsgif_frame_info info;
 
 	/** offset (in bytes) to the GIF frame data */
 	size_t frame_offset;
+	/** length of GIF data when the frame was scanned, or 0 if unscanned */
+	size_t data_len;
 	/** whether the frame has previously been decoded. */
 	bool decoded;
 	/** whether the frame is totally opaque */
 	bool opaque;
 	/** whether a full image redraw is required */
 	bool redraw_required;
+	/** Compositing plan; \ref nsgif_plan flags. */
+	uint8_t plan;
 
 	/** Amount of LZW data found in scan */
 	uint32_t lzw_data_length;
@@ -48,11 +99,57 @@ typedef struct nsgif_frame {
 
 	/** offset to frame colour table */
 	uint32_t colour_table_offset;
+	/** decoded frame colour table, or NULL if not cached */
+	uint32_t *colour_table;
+	/** colour statistics, or NULL if not collected */
+	nsgif_colour_stats_t *colour_stats;
 
 	/* Frame flags */
 	uint32_t flags;
 } nsgif_frame;
 
+/** Decoded local colour table, shared by frames with identical tables. */
+struct nsgif_palette {
+	/** Next palette in the cache. */
+	struct nsgif_palette *next;
+	/** Hash of the raw colour table data. */
+	uint64_t hash;
+	/** Offset to the raw colour table data. */
+	uint32_t offset;
+	/** Number of colour table entries. */
+	uint32_t entries;
+	/** The decoded colour table. */
+	uint32_t table[NSGIF_MAX_COLOURS];
+};
+
+/** Composited frame, saved for decoding frames before it quickly. */
+struct nsgif_checkpoint {
+	/** Frame composited on the canvas, or NSGIF_FRAME_INVALID if unused. */
+	uint32_t frame;
+	/** Value of the use counter when last used. */
+	uint32_t used;
+	/** Copy of the canvas, or NULL if not allocated. */
+	uint8_t *canvas;
+};
+
+/** Trimmed frame image, for texture atlas creation. */
+struct nsgif_atlas_image {
+	/** Area of the GIF's image covered. */
+	nsgif_rect_t rect;
+	/** Hash of the image's pixels. */
+	uint64_t hash;
+	/** The first frame with the image. */
+	uint32_t frame;
+	/** Position of the image in the atlas. */
+	uint32_t x, y;
+};
+
+/** Span of pixels changed in a bitmap row, for damage tracking. */
+struct nsgif_damage_span {
+	uint32_t x0; /**< First pixel changed. */
+	uint32_t x1; /**< Pixel after the last changed; `x0` if none. */
+};
+
 /** Pixel format: colour component order. */
 struct nsgif_colour_layout {
 	uint8_t r; /**< Byte offset within pixel to red component. */
@@ -69,12 +166,16 @@ struct nsgif {
 	void *lzw_ctx;
 	/** callbacks for bitmap functions */
 	nsgif_bitmap_cb_vt bitmap;
-	/** decoded frames */
-	nsgif_frame *frames;
+	/** decoded frames, in blocks that never move once allocated */
+	nsgif_frame *frames[NSGIF_FRAME_BLOCKS];
 	/** current frame */
 	uint32_t frame;
 	/** current frame decoded to bitmap */
 	uint32_t decoded_frame;
+	/** whether the current frame decoded without error */
+	bool decoded_ok;
+	/** Whether the last image decode wrote all of the frame's pixels. */
+	bool image_complete;
 
 	/** currently decoded image; stored as bitmap from bitmap_create callback */
 	nsgif_bitmap_t *frame_image;
@@ -92,12 +193,26 @@ struct nsgif {
 
 	/** number of frames partially decoded */
 	uint32_t frame_count_partial;
+	/** number of frames fully scanned and given to \ref frame_ready */
+	nsgif__atomic uint32_t frame_count_ready;
 
 	/**
 	 * Whether all the GIF data has been supplied, or if there may be
 	 * more to come.
 	 */
-	bool data_complete;
+	nsgif__atomic bool data_complete;
+
+	/** Maximum number of frames to scan, or \ref NSGIF_INFINITE. */
+	uint32_t scan_limit;
+	/** Whether scanning stopped at \ref scan_limit with frames remaining. */
+	bool scan_limited;
+	/** Whether every frame has been scanned, so the frame count is final. */
+	nsgif__atomic bool frames_final;
+
+	/** Client frame ready callback, or NULL. */
+	nsgif_frame_ready_cb frame_ready;
+	/** Client private word for \ref frame_ready. */
+	void *frame_ready_pw;
 
 	/** pointer to GIF data */
 	const uint8_t *buf;
@@ -114,6 +229,8 @@ struct nsgif {
 	uint32_t aspect_ratio;
 	/** size of global colour table (in entries) */
 	uint32_t colour_table_size;
+	/** offset to global colour table */
+	uint32_t colour_table_offset;
 
 	/** current colour table */
 	uint32_t *colour_table;
@@ -123,9 +240,93 @@ struct nsgif {
 	uint32_t global_colour_table[NSGIF_MAX_COLOURS];
 	/** local colour table */
 	uint32_t local_colour_table[NSGIF_MAX_COLOURS];
+	/** cache of decoded local colour tables */
+	struct nsgif_palette *palettes;
+	/** number of decoded local colour tables in the cache */
+	uint32_t palette_count;
+
+	/** Client colour transform, applied to colour tables, or NULL. */
+	nsgif_colour_transform_cb colour_transform;
+	/** Client private word for \ref colour_transform. */
+	void *colour_transform_pw;
+
+	/** Client parallel-for callback, or NULL. */
+	nsgif_parallel_cb parallel;
+	/** Client private word for \ref parallel. */
+	void *parallel_pw;
+	/** Minimum pixels in an operation for it to use \ref parallel. */
+	size_t parallel_threshold;
+
+	/** offset to ICC profile extension's first data sub-block */
+	size_t icc_offset;
+
+	/** Whether to hash frame image data while scanning. */
+	bool frame_hashing;
+
+	/** Whether \ref nsgif_frame_prepare skips duplicate frames. */
+	bool merge_duplicates;
+	/** Whether \ref nsgif_frame_prepare skips zero delay frames. */
+	bool coalesce_zero_delay;
+	/** Shortest interval between frames shown, in cs, or zero. */
+	uint32_t decimation;
+	/** Order \ref nsgif_frame_prepare plays frames in. */
+	nsgif_playback playback;
+	/** Whether ping-pong playback is currently going backwards. */
+	bool reverse;
+
+	/** Whether to collect colour statistics when decoding. */
+	bool colour_stats;
+
+	/** Whether to track the bitmap area changed by decoding. */
+	bool damage_tracking;
+	/** Bitmap area changed by the last call to \ref nsgif_frame_decode. */
+	nsgif_rect_t damage;
+	/** Changed span of each bitmap row, or NULL if not tracking rows. */
+	struct nsgif_damage_span *damage_rows;
+
+	/** Whether to index extension blocks while scanning. */
+	bool extension_index;
+	/** Indexed extension blocks. */
+	nsgif_extension_info_t *extensions;
+	/** Number of extension holders allocated. */
+	uint32_t extension_holders;
+
+	/** Whether any ready frame has a local colour table. */
+	bool local_palettes;
+	/** Number of ready frames checked for \ref local_palettes. */
+	uint32_t local_palettes_checked;
+	/** Whether frames are composited on \ref index_canvas. */
+	bool index_mode;
+	/** Colour index canvas, expanded to the client bitmap as it changes. */
+	uint8_t *index_canvas;
+	/** Whether only the index canvas is being updated, not the bitmap. */
+	bool canvas_only;
+	/** Whether the frame being composited is disposed of, but not drawn. */
+	bool skip_image;
+	/** Whether a later frame is composited by the same decode. */
+	bool expand_defer;
+	/** Area of \ref index_canvas changed, but not expanded to the bitmap. */
+	nsgif_rect_t expand_area;
+
+	/** Memory budget for \ref checkpoints, in bytes. */
+	size_t checkpoint_budget;
+	/** Composited frame checkpoints, or NULL if not set up. */
+	struct nsgif_checkpoint *checkpoints;
+	/** Number of entries in \ref checkpoints. */
+	uint32_t checkpoint_count;
+	/** Byte size of each checkpoint's canvas copy. */
+	size_t checkpoint_size;
+	/** Use counter, for evicting the least recently used checkpoint. */
+	uint32_t checkpoint_clock;
+	/** Whether the decoded frame was restored from a checkpoint. */
+	bool checkpoint_restored;
 
 	/** previous frame for NSGIF_FRAME_RESTORE */
 	void *prev_frame;
+	/** Allocated size of \ref prev_frame in bytes. */
+	size_t prev_frame_size;
+	/** Canvas area held in \ref prev_frame. */
+	nsgif_rect_t prev_rect;
 	/** previous frame index */
 	uint32_t prev_index;
 };
@@ -155,6 +356,79 @@ struct nsgif {
 /** Internal flag that a frame is invalid/unprocessed */
 #define NSGIF_FRAME_INVALID UINT32_MAX
 
+/** Maximum number of decoded local colour tables to cache */
+#define NSGIF_PALETTE_CACHE_MAX 512
+
+/** Force inlining, where the compiler supports it. */
+#if defined(__GNUC__)
+#define nsgif__always_inline inline __attribute__((always_inline))
+#else
+#define nsgif__always_inline inline
+#endif
+
+/**
+ * Get the frame table block that holds a frame.
+ *
+ * \param[in] frame_idx  The index of the frame.
+ * \return the block index.
+ */
+static inline uint32_t nsgif__frame_block(
+		uint32_t frame_idx)
+{
+	uint32_t blocks = frame_idx / NSGIF_FRAME_BLOCK + 1;
+	uint32_t block = 0;
+
+	while (blocks >> (block + 1)) {
+		block++;
+	}
+
+	return block;
+}
+
+/**
+ * Get a frame from the frame table.
+ *
+ * \param[in] gif        The gif object.
+ * \param[in] frame_idx  The index of the frame, which must be allocated.
+ * \return the frame.
+ */
+static inline struct nsgif_frame *nsgif__frame(
+		const struct nsgif *gif,
+		uint32_t frame_idx)
+{
+	uint32_t block = nsgif__frame_block(frame_idx);
+
+	return &gif->frames[block][frame_idx -
+			NSGIF_FRAME_BLOCK * ((1u << block) - 1)];
+}
+
+/**
+ * Get the length of the source data that a frame is read from.
+ *
+ * Scanned frames are only read from the data there was when they were
+ * scanned, so they can be decoded while more data is given to be scanned.
+ *
+ * \param[in] gif    The gif object.
+ * \param[in] frame  The frame.
+ * \return the number of bytes of data the frame may be read from.
+ */
+static inline size_t nsgif__frame_data_len(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame)
+{
+	return (frame->data_len != 0) ? frame->data_len : gif->buf_len;
+}
+
+/**
+ * Size in bytes from which canvas fills and copies bypass the cache.
+ *
+ * Only used with SSE2.  Canvases this big won't stay in cache anyway.
+ */
+#define NSGIF_STREAM_MIN (1u << 20)
+
+/** Initial value for \ref nsgif__hash */
+#define NSGIF_HASH_INIT 0xcbf29ce484222325u
+
 /** Transparent colour */
 #define NSGIF_TRANSPARENT_COLOUR 0x00
 
@@ -167,6 +441,277 @@ struct nsgif {
 #define NSGIF_BLOCK_TERMINATOR 0x00
 #define NSGIF_TRAILER 0x3b
 
+/**
+ * Fill pixels with a colour.
+ *
+ * \param[out] dst    Pixels to fill.
+ * \param[in]  value  Colour to fill with.
+ * \param[in]  count  Number of pixels to fill.
+ */
+static inline void nsgif__fill(
+		uint32_t *dst,
+		uint32_t value,
+		size_t count)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_set1_epi32((int)value);
+
+	if (count * sizeof(*dst) >= NSGIF_STREAM_MIN) {
+		while (((uintptr_t)dst & 15) != 0) {
+			*dst++ = value;
+			count--;
+		}
+		for (; count >= 4; count -= 4, dst += 4) {
+			_mm_stream_si128((__m128i *)dst, v);
+		}
+		_mm_sfence();
+	} else {
+		for (; count >= 4; count -= 4, dst += 4) {
+			_mm_storeu_si128((__m128i *)dst, v);
+		}
+	}
+#endif
+	while (count-- > 0) {
+		*dst++ = value;
+	}
+}
+
+/**
+ * Copy canvas data.
+ *
+ * \param[out] dst  Destination.
+ * \param[in]  src  Source.
+ * \param[in]  len  Number of bytes to copy.
+ */
+static inline void nsgif__copy(
+		void *restrict dst,
+		const void *restrict src,
+		size_t len)
+{
+#ifdef __SSE2__
+	if (len >= NSGIF_STREAM_MIN) {
+		const uint8_t *s = src;
+		uint8_t *d = dst;
+		size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+		memcpy(d, s, head);
+		d += head;
+		s += head;
+		len -= head;
+
+		for (; len >= 64; len -= 64, d += 64, s += 64) {
+			__m128i a = _mm_loadu_si128((const __m128i *)s);
+			__m128i b = _mm_loadu_si128((const __m128i *)s + 1);
+			__m128i c = _mm_loadu_si128((const __m128i *)s + 2);
+			__m128i e = _mm_loadu_si128((const __m128i *)s + 3);
+			_mm_stream_si128((__m128i *)d, a);
+			_mm_stream_si128((__m128i *)d + 1, b);
+			_mm_stream_si128((__m128i *)d + 2, c);
+			_mm_stream_si128((__m128i *)d + 3, e);
+		}
+		_mm_sfence();
+
+		memcpy(d, s, len);
+		return;
+	}
+#endif
+	memcpy(dst, src, len);
+}
+
+/**
+ * Run a job over work items, such as rows, split up if worthwhile.
+ *
+ * \param[in] gif     The gif object.
+ * \param[in] count   Number of work items.
+ * \param[in] pixels  Number of pixels covered by all the items.
+ * \param[in] job     Job to run for each range of items.
+ * \param[in] ctx     Job context.
+ */
+static void nsgif__parallel_run(
+		const struct nsgif *gif,
+		uint32_t count,
+		size_t pixels,
+		nsgif_job_cb job,
+		void *ctx)
+{
+	if (gif->parallel != NULL && count > 1 &&
+	    pixels >= gif->parallel_threshold) {
+		gif->parallel(gif->parallel_pw, count, job, ctx);
+	} else {
+		job(ctx, 0, count);
+	}
+}
+
+/** Fill or copy of a canvas area, for \ref nsgif__area_rows. */
+struct nsgif_area_job {
+	uint8_t *dst;        /**< First pixel of the area to write. */
+	const uint8_t *src;  /**< First pixel of the area to copy, or NULL. */
+	size_t dst_stride;   /**< Row stride of `dst` in bytes. */
+	size_t src_stride;   /**< Row stride of `src` in bytes. */
+	size_t row_bytes;    /**< Bytes per row of the area. */
+	uint32_t value;      /**< Pixel value to fill with. */
+	uint8_t pixel_bytes; /**< Bytes per pixel, 1 or 4. */
+
+	/** Damage spans from the area's first row, or NULL if not tracked. */
+	struct nsgif_damage_span *damage;
+	/** Bitmap column of the area's first pixel, for damage tracking. */
+	uint32_t damage_x;
+};
+
+/**
+ * Add pixels to a bitmap row's changed span.
+ *
+ * \param[in] span  The row's changed span, updated on exit.
+ * \param[in] x0    First pixel changed.
+ * \param[in] x1    Pixel after the last changed.
+ */
+static inline void nsgif__damage_mark(
+		struct nsgif_damage_span *span,
+		uint32_t x0,
+		uint32_t x1)
+{
+	if (span->x0 >= span->x1) {
+		span->x0 = x0;
+		span->x1 = x1;
+	} else {
+		if (span->x0 > x0) span->x0 = x0;
+		if (span->x1 < x1) span->x1 = x1;
+	}
+}
+
+/**
+ * Fill or copy a band of rows of a bitmap area, noting changed pixels.
+ *
+ * Pixels are compared as they are written, so the damage is found without
+ * reading the area again.
+ *
+ * \param[in] job    The \ref nsgif_area_job, with damage spans.
+ * \param[in] start  First row.
+ * \param[in] end    Row after the last.
+ */
+static void nsgif__area_rows_damage(
+		const struct nsgif_area_job *job,
+		uint32_t start,
+		uint32_t end)
+{
+	uint32_t count = job->row_bytes / sizeof(uint32_t);
+
+	for (uint32_t y = start; y < end; y++) {
+		uint32_t *dst = (uint32_t *)(void *)
+				(job->dst + y * job->dst_stride);
+		const uint32_t *src = NULL;
+		uint32_t x0 = count;
+		uint32_t x1 = 0;
+
+		if (job->src != NULL) {
+			src = (const uint32_t *)(const void *)
+					(job->src + y * job->src_stride);
+		}
+
+		for (uint32_t x = 0; x < count; x++) {
+			uint32_t value = (src != NULL) ? src[x] : job->value;
+
+			if (dst[x] != value) {
+				x0 = (x0 > x) ? x : x0;
+				x1 = x + 1;
+			}
+			dst[x] = value;
+		}
+
+		if (x0 < x1) {
+			nsgif__damage_mark(&job->damage[y],
+					job->damage_x + x0,
+					job->damage_x + x1);
+		}
+	}
+}
+
+/**
+ * Fill or copy a band of rows of a canvas area.
+ *
+ * \param[in] ctx    The \ref nsgif_area_job.
+ * \param[in] start  First row.
+ * \param[in] end    Row after the last.
+ */
+static void nsgif__area_rows(
+		void *ctx,
+		uint32_t start,
+		uint32_t end)
+{
+	const struct nsgif_area_job *job = ctx;
+	uint8_t *dst = job->dst + start * job->dst_stride;
+	const uint8_t *src = job->src;
+	size_t row_bytes = job->row_bytes;
+	uint32_t rows = end - start;
+
+	if (job->damage != NULL) {
+		nsgif__area_rows_damage(job, start, end);
+		return;
+	}
+
+	if (src != NULL) {
+		src += start * job->src_stride;
+	}
+
+	if (job->dst_stride == row_bytes &&
+	    (src == NULL || job->src_stride == row_bytes)) {
+		/* Rows are contiguous; do them in one go. */
+		row_bytes *= rows;
+		rows = 1;
+	}
+
+	for (uint32_t y = 0; y < rows; y++) {
+		if (src != NULL) {
+			nsgif__copy(dst, src, row_bytes);
+			src += job->src_stride;
+		} else if (job->pixel_bytes == sizeof(uint32_t)) {
+			nsgif__fill((uint32_t *)(void *)dst, job->value,
+					row_bytes / sizeof(uint32_t));
+		} else {
+			memset(dst, (int)job->value, row_bytes);
+		}
+		dst += job->dst_stride;
+	}
+}
+
+/**
+ * Track the changes an area job makes to the client bitmap.
+ *
+ * \param[in]     gif  The gif object.
+ * \param[in,out] job  The area job writing to the client bitmap.
+ * \param[in]     x    Bitmap column of the area's first pixel.
+ * \param[in]     y    Bitmap row of the area's first pixel.
+ */
+static inline void nsgif__area_damage(
+		const struct nsgif *gif,
+		struct nsgif_area_job *job,
+		uint32_t x,
+		uint32_t y)
+{
+	if (gif->damage_rows != NULL &&
+	    job->pixel_bytes == sizeof(uint32_t)) {
+		job->damage = gif->damage_rows + y;
+		job->damage_x = x;
+	}
+}
+
+/**
+ * Fill or copy a canvas area.
+ *
+ * \param[in] gif     The gif object.
+ * \param[in] job     The area and operation.
+ * \param[in] height  Number of rows in the area.
+ */
+static void nsgif__area_run(
+		const struct nsgif *gif,
+		struct nsgif_area_job *job,
+		uint32_t height)
+{
+	nsgif__parallel_run(gif, height,
+			job->row_bytes / job->pixel_bytes * height,
+			nsgif__area_rows, job);
+}
+
 /**
  * Convert an LZW result code to equivalent GIF result code.
  *
@@ -189,6 +734,29 @@ static nsgif_error nsgif__error_from_lzw(lzw_result l_res)
 	return g_res[l_res];
 }
 
+/**
+ * Add data to a hash.
+ *
+ * This is the 64-bit FNV-1a hash; fast and non-cryptographic.
+ *
+ * \param[in] hash  Current hash value, or \ref NSGIF_HASH_INIT to start.
+ * \param[in] data  The data to add to the hash.
+ * \param[in] len   Byte length of data.
+ * \return the updated hash value.
+ */
+static inline uint64_t nsgif__hash(
+		uint64_t hash,
+		const uint8_t *data,
+		size_t len)
+{
+	while (len--) {
+		hash ^= *data++;
+		hash *= 0x100000001b3u;
+	}
+
+	return hash;
+}
+
 /**
  * Updates the sprite memory size
  *
@@ -291,14 +859,30 @@ static inline bool nsgif__bitmap_get_opaque(
 	return false;
 }
 
+/**
+ * Record the canvas, for restoring after a frame with restore previous
+ * disposal.
+ *
+ * Only the area the frame is about to draw over is recorded, since that is
+ * all the frame can change before it is disposed of.
+ *
+ * \param[in] gif          The gif object we're decoding.
+ * \param[in] frame        The frame about to be decoded.
+ * \param[in] canvas       The canvas to record.
+ * \param[in] pixel_bytes  Bytes per canvas pixel.
+ * \param[in] stride       Canvas row stride in pixels.
+ */
 static void nsgif__record_frame(
 		struct nsgif *gif,
-		const uint32_t *bitmap)
+		const struct nsgif_frame *frame,
+		const void *canvas,
+		size_t pixel_bytes,
+		size_t stride)
 {
-	size_t pixel_bytes = sizeof(*bitmap);
-	size_t height = gif->info.height;
-	size_t width  = gif->info.width;
-	uint32_t *prev_frame;
+	nsgif_rect_t rect = frame->info.rect;
+	const uint8_t *src = canvas;
+	size_t row_bytes;
+	size_t size;
 
 	if (gif->decoded_frame == NSGIF_FRAME_INVALID ||
 	    gif->decoded_frame == gif->prev_index) {
@@ -306,37 +890,79 @@ static void nsgif__record_frame(
 		return;
 	}
 
-	bitmap = nsgif__bitmap_get(gif);
-	if (bitmap == NULL) {
-		return;
+	if (rect.x1 > gif->info.width)  rect.x1 = gif->info.width;
+	if (rect.y1 > gif->info.height) rect.y1 = gif->info.height;
+	if (rect.x0 > rect.x1) rect.x0 = rect.x1;
+	if (rect.y0 > rect.y1) rect.y0 = rect.y1;
+
+	row_bytes = (rect.x1 - rect.x0) * pixel_bytes;
+	if (row_bytes == 0) {
+		rect.y1 = rect.y0;
 	}
+	size = row_bytes * (rect.y1 - rect.y0);
 
-	if (gif->prev_frame == NULL) {
-		prev_frame = realloc(gif->prev_frame,
-				width * height * pixel_bytes);
+	if (size > gif->prev_frame_size) {
+		void *prev_frame = realloc(gif->prev_frame, size);
 		if (prev_frame == NULL) {
 			return;
 		}
-	} else {
-		prev_frame = gif->prev_frame;
+		gif->prev_frame = prev_frame;
+		gif->prev_frame_size = size;
 	}
 
-	memcpy(prev_frame, bitmap, width * height * pixel_bytes);
+	if (size > 0) {
+		struct nsgif_area_job job = {
+			.dst = gif->prev_frame,
+			.src = src + (rect.x0 + rect.y0 * stride) * pixel_bytes,
+			.dst_stride = row_bytes,
+			.src_stride = stride * pixel_bytes,
+			.row_bytes = row_bytes,
+			.pixel_bytes = pixel_bytes,
+		};
+		nsgif__area_run(gif, &job, rect.y1 - rect.y0);
+	}
 
-	gif->prev_frame  = prev_frame;
+	gif->prev_rect   = rect;
 	gif->prev_index  = gif->decoded_frame;
 }
 
+/**
+ * Restore the canvas recorded by \ref nsgif__record_frame.
+ *
+ * \param[in] gif          The gif object we're decoding.
+ * \param[in] canvas       The canvas to restore.
+ * \param[in] pixel_bytes  Bytes per canvas pixel.
+ * \param[in] stride       Canvas row stride in pixels.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
 static nsgif_error nsgif__recover_frame(
 		const struct nsgif *gif,
-		uint32_t *bitmap)
+		void *canvas,
+		size_t pixel_bytes,
+		size_t stride)
 {
-	const uint32_t *prev_frame = gif->prev_frame;
-	size_t pixel_bytes = sizeof(*bitmap);
-	size_t height = gif->info.height;
-	size_t width  = gif->info.width;
+	const nsgif_rect_t *rect = &gif->prev_rect;
+	size_t row_bytes = (rect->x1 - rect->x0) * pixel_bytes;
+	uint8_t *dst = canvas;
+
+	if (gif->prev_index == NSGIF_FRAME_INVALID) {
+		/* Nothing was recorded. */
+		return NSGIF_ERR_OOM;
+	}
 
-	memcpy(bitmap, prev_frame, height * width * pixel_bytes);
+	if (row_bytes > 0 && rect->y1 > rect->y0) {
+		struct nsgif_area_job job = {
+			.dst = dst + (rect->x0 + rect->y0 * stride) *
+					pixel_bytes,
+			.src = gif->prev_frame,
+			.dst_stride = stride * pixel_bytes,
+			.src_stride = row_bytes,
+			.row_bytes = row_bytes,
+			.pixel_bytes = pixel_bytes,
+		};
+		nsgif__area_damage(gif, &job, rect->x0, rect->y0);
+		nsgif__area_run(gif, &job, rect->y1 - rect->y0);
+	}
 
 	return NSGIF_OK;
 }
@@ -435,68 +1061,173 @@ static inline void gif__jump_data(
 	*pos += jump;
 }
 
-static nsgif_error nsgif__decode_complex(
-		struct nsgif *gif,
-		uint32_t width,
-		uint32_t height,
-		uint32_t offset_x,
-		uint32_t offset_y,
-		uint32_t interlace,
-		const uint8_t *data,
-		uint32_t transparency_index,
-		uint32_t *restrict frame_data,
-		uint32_t *restrict colour_table)
+/** Parameters for decoding a frame's rows. */
+struct nsgif_rows {
+	uint32_t width;  /**< Width of the frame to output, after clipping. */
+	uint32_t height; /**< Height of the frame to output, after clipping. */
+	uint32_t clip_x; /**< Width of the frame clipped off the right. */
+	uint32_t transparency_index; /**< Frame's transparent colour index. */
+
+	uint8_t *out;    /**< Output for the frame's top left pixel. */
+	size_t stride;   /**< Output row stride in bytes. */
+	uint32_t x0;     /**< Bitmap column of the frame's left pixel. */
+	uint32_t y0;     /**< Bitmap row of the frame's top pixel. */
+
+	/** Damage spans of the bitmap rows, or NULL if not tracked. */
+	struct nsgif_damage_span *damage;
+
+	const uint32_t *colour_table; /**< Colour table to output with. */
+	uint32_t *histogram; /**< Colour index counts to update, or NULL. */
+};
+
+/**
+ * Output a span of decoded pixels to the client bitmap.
+ *
+ * \param[out] out          Client bitmap pixels.
+ * \param[in]  in           Colour indices.
+ * \param[in]  count        Number of pixels.
+ * \param[in]  rows         Frame row parameters.
+ * \param[in]  transparent  Whether the frame has a transparent index.
+ */
+static nsgif__always_inline void nsgif__span_colour(
+		uint32_t *restrict out,
+		const uint8_t *restrict in,
+		uint32_t count,
+		const struct nsgif_rows *rows,
+		const bool transparent)
 {
-	lzw_result res;
-	nsgif_error ret = NSGIF_OK;
-	uint32_t clip_x = gif__clip(offset_x, width, gif->info.width);
-	uint32_t clip_y = gif__clip(offset_y, height, gif->info.height);
-	const uint8_t *uncompressed;
-	uint32_t available = 0;
-	uint8_t step = 24;
-	uint32_t skip = 0;
-	uint32_t y = 0;
+	const uint32_t *restrict colour_table = rows->colour_table;
 
-	if (offset_x >= gif->info.width ||
-	    offset_y >= gif->info.height) {
-		return NSGIF_OK;
+	if (transparent) {
+		uint32_t transparency_index = rows->transparency_index;
+
+		for (uint32_t i = 0; i < count; i++) {
+			if (in[i] != transparency_index) {
+				out[i] = colour_table[in[i]];
+			}
+		}
+	} else {
+		for (uint32_t i = 0; i < count; i++) {
+			out[i] = colour_table[in[i]];
+		}
 	}
+}
 
-	width -= clip_x;
-	height -= clip_y;
+/**
+ * Output a span of decoded pixels to the client bitmap, noting changes.
+ *
+ * \param[out] out     Client bitmap pixels.
+ * \param[in]  in      Colour indices.
+ * \param[in]  count   Number of pixels.
+ * \param[in]  rows    Frame row parameters.
+ * \param[in]  damage  The bitmap row's changed span, updated on exit.
+ * \param[in]  x       Bitmap column of the span's first pixel.
+ */
+static void nsgif__span_colour_damage(
+		uint32_t *restrict out,
+		const uint8_t *restrict in,
+		uint32_t count,
+		const struct nsgif_rows *rows,
+		struct nsgif_damage_span *damage,
+		uint32_t x)
+{
+	const uint32_t *restrict colour_table = rows->colour_table;
+	uint32_t transparency_index = rows->transparency_index;
+	uint32_t x0 = count;
+	uint32_t x1 = 0;
 
-	if (width == 0 || height == 0) {
-		return NSGIF_OK;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t colour;
+
+		if (in[i] == transparency_index) {
+			continue;
+		}
+
+		colour = colour_table[in[i]];
+		if (out[i] != colour) {
+			x0 = (x0 > i) ? i : x0;
+			x1 = i + 1;
+		}
+		out[i] = colour;
 	}
 
-	/* Initialise the LZW decoding */
-	res = lzw_decode_init(gif->lzw_ctx, data[0],
-			gif->buf, gif->buf_len,
-			data + 1 - gif->buf);
-	if (res != LZW_OK) {
-		return nsgif__error_from_lzw(res);
+	if (x0 < x1) {
+		nsgif__damage_mark(damage, x + x0, x + x1);
 	}
+}
 
-	do {
-		uint32_t x;
-		uint32_t *frame_scanline;
+/**
+ * Output a span of decoded pixels to the index canvas.
+ *
+ * \param[out] out          Index canvas pixels.
+ * \param[in]  in           Colour indices.
+ * \param[in]  count        Number of pixels.
+ * \param[in]  rows         Frame row parameters.
+ * \param[in]  transparent  Whether the frame has a transparent index.
+ */
+static nsgif__always_inline void nsgif__span_index(
+		uint8_t *restrict out,
+		const uint8_t *restrict in,
+		uint32_t count,
+		const struct nsgif_rows *rows,
+		const bool transparent)
+{
+	if (transparent) {
+		uint32_t transparency_index = rows->transparency_index;
 
-		frame_scanline = frame_data + offset_x +
-				(y + offset_y) * gif->rowspan;
+		for (uint32_t i = 0; i < count; i++) {
+			if (in[i] != transparency_index) {
+				out[i] = in[i];
+			}
+		}
+	} else {
+		memcpy(out, in, count);
+	}
+}
 
-		x = width;
-		while (x > 0) {
-			unsigned row_available;
-			while (available == 0) {
-				if (res != LZW_OK) {
-					/* Unexpected end of frame, try to recover */
-					if (res == LZW_OK_EOD ||
-					    res == LZW_EOI_CODE) {
-						ret = NSGIF_OK;
-					} else {
-						ret = nsgif__error_from_lzw(res);
-					}
-					return ret;
+/**
+ * Decode a frame's rows.
+ *
+ * This is instantiated for each combination of the constant parameters by
+ * \ref nsgif__decode_complex, so that they cost nothing per pixel or row.
+ *
+ * \param[in] gif          The gif object we're decoding.
+ * \param[in] rows         Frame row parameters.
+ * \param[in] transparent  Whether the frame has a transparent index.
+ * \param[in] interlaced   Whether the frame is interlaced.
+ * \param[in] clipped      Whether the frame is clipped on the right.
+ * \param[in] indexed      Whether to output to the index canvas.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif__always_inline nsgif_error nsgif__decode_rows(
+		struct nsgif *gif,
+		const struct nsgif_rows *rows,
+		const bool transparent,
+		const bool interlaced,
+		const bool clipped,
+		const bool indexed)
+{
+	lzw_result res = LZW_OK;
+	const uint8_t *uncompressed;
+	uint32_t available = 0;
+	uint8_t step = 24;
+	uint32_t skip = 0;
+	uint32_t y = 0;
+
+	do {
+		uint8_t *scanline = rows->out + y * rows->stride;
+		uint32_t x = rows->width;
+
+		while (x > 0) {
+			uint32_t row_available;
+			while (available == 0) {
+				if (res != LZW_OK) {
+					/* Unexpected end of frame, try to recover */
+					if (res == LZW_OK_EOD ||
+					    res == LZW_EOI_CODE) {
+						return NSGIF_OK;
+					}
+					return nsgif__error_from_lzw(res);
 				}
 				res = lzw_decode(gif->lzw_ctx,
 						&uncompressed, &available);
@@ -504,42 +1235,158 @@ static nsgif_error nsgif__decode_complex(
 				if (available == 0) {
 					return NSGIF_OK;
 				}
-				gif__jump_data(&skip, &available, &uncompressed);
+				if (clipped) {
+					gif__jump_data(&skip, &available,
+							&uncompressed);
+				}
 			}
 
 			row_available = x < available ? x : available;
 			x -= row_available;
 			available -= row_available;
-			if (transparency_index > 0xFF) {
-				while (row_available-- > 0) {
-					*frame_scanline++ =
-						colour_table[*uncompressed++];
+			if (rows->histogram != NULL) {
+				for (uint32_t i = 0; i < row_available; i++) {
+					rows->histogram[uncompressed[i]]++;
 				}
+			}
+			if (indexed) {
+				nsgif__span_index(scanline, uncompressed,
+						row_available, rows,
+						transparent);
+				scanline += row_available;
+			} else if (rows->damage != NULL) {
+				nsgif__span_colour_damage((uint32_t *)scanline,
+						uncompressed,
+						row_available, rows,
+						&rows->damage[rows->y0 + y],
+						rows->x0 + rows->width -
+						x - row_available);
+				scanline += row_available * sizeof(uint32_t);
 			} else {
-				while (row_available-- > 0) {
-					register uint32_t colour;
-					colour = *uncompressed++;
-					if (colour != transparency_index) {
-						*frame_scanline =
-							colour_table[colour];
-					}
-					frame_scanline++;
-				}
+				nsgif__span_colour((uint32_t *)scanline,
+						uncompressed,
+						row_available, rows,
+						transparent);
+				scanline += row_available * sizeof(uint32_t);
 			}
+			uncompressed += row_available;
+		}
+
+		if (clipped) {
+			skip = rows->clip_x;
+			gif__jump_data(&skip, &available, &uncompressed);
 		}
+	} while (interlaced ?
+			nsgif__deinterlace(rows->height, &y, &step) :
+			++y != rows->height);
 
-		skip = clip_x;
-		gif__jump_data(&skip, &available, &uncompressed);
-	} while (nsgif__next_row(interlace, height, &y, &step));
+	gif->image_complete = true;
+	return NSGIF_OK;
+}
 
-	return ret;
+/** Select a \ref nsgif__decode_rows variant. */
+#define NSGIF_ROWS_VARIANT(_t, _i, _c, _x) \
+	case ((_t) << 0 | (_i) << 1 | (_c) << 2 | (_x) << 3): \
+		return nsgif__decode_rows(gif, &rows, _t, _i, _c, _x)
+
+static nsgif_error nsgif__decode_complex(
+		struct nsgif *gif,
+		uint32_t width,
+		uint32_t height,
+		uint32_t offset_x,
+		uint32_t offset_y,
+		uint32_t interlace,
+		const uint8_t *data,
+		size_t data_len,
+		uint32_t transparency_index,
+		bool indexed,
+		uint32_t *restrict frame_data,
+		const uint32_t *restrict colour_table,
+		uint32_t *restrict histogram)
+{
+	lzw_result res;
+	uint32_t clip_x = gif__clip(offset_x, width, gif->info.width);
+	uint32_t clip_y = gif__clip(offset_y, height, gif->info.height);
+	struct nsgif_rows rows;
+	unsigned variant;
+
+	if (offset_x >= gif->info.width ||
+	    offset_y >= gif->info.height) {
+		gif->image_complete = true;
+		return NSGIF_OK;
+	}
+
+	width -= clip_x;
+	height -= clip_y;
+
+	if (width == 0 || height == 0) {
+		gif->image_complete = true;
+		return NSGIF_OK;
+	}
+
+	/* Initialise the LZW decoding */
+	res = lzw_decode_init(gif->lzw_ctx, data[0],
+			gif->buf, data_len,
+			data + 1 - gif->buf);
+	if (res != LZW_OK) {
+		return nsgif__error_from_lzw(res);
+	}
+
+	rows.width = width;
+	rows.height = height;
+	rows.clip_x = clip_x;
+	rows.transparency_index = transparency_index;
+	rows.colour_table = colour_table;
+	rows.histogram = histogram;
+	rows.x0 = offset_x;
+	rows.y0 = offset_y;
+	rows.damage = indexed ? NULL : gif->damage_rows;
+
+	if (indexed) {
+		rows.stride = gif->info.width;
+		rows.out = gif->index_canvas + offset_x +
+				offset_y * rows.stride;
+	} else {
+		rows.stride = gif->rowspan * sizeof(uint32_t);
+		rows.out = (uint8_t *)(frame_data + offset_x +
+				offset_y * gif->rowspan);
+	}
+
+	variant = (transparency_index <= 0xFF) << 0 |
+	          (interlace != 0) << 1 |
+	          (clip_x != 0) << 2 |
+	          (indexed) << 3;
+
+	switch (variant) {
+	NSGIF_ROWS_VARIANT(false, false, false, false);
+	NSGIF_ROWS_VARIANT(true,  false, false, false);
+	NSGIF_ROWS_VARIANT(false, true,  false, false);
+	NSGIF_ROWS_VARIANT(true,  true,  false, false);
+	NSGIF_ROWS_VARIANT(false, false, true,  false);
+	NSGIF_ROWS_VARIANT(true,  false, true,  false);
+	NSGIF_ROWS_VARIANT(false, true,  true,  false);
+	NSGIF_ROWS_VARIANT(true,  true,  true,  false);
+	NSGIF_ROWS_VARIANT(false, false, false, true);
+	NSGIF_ROWS_VARIANT(true,  false, false, true);
+	NSGIF_ROWS_VARIANT(false, true,  false, true);
+	NSGIF_ROWS_VARIANT(true,  true,  false, true);
+	NSGIF_ROWS_VARIANT(false, false, true,  true);
+	NSGIF_ROWS_VARIANT(true,  false, true,  true);
+	NSGIF_ROWS_VARIANT(false, true,  true,  true);
+	NSGIF_ROWS_VARIANT(true,  true,  true,  true);
+	}
+
+	return NSGIF_OK;
 }
 
+#undef NSGIF_ROWS_VARIANT
+
 static nsgif_error nsgif__decode_simple(
 		struct nsgif *gif,
 		uint32_t height,
 		uint32_t offset_y,
 		const uint8_t *data,
+		size_t data_len,
 		uint32_t transparency_index,
 		uint32_t *restrict frame_data,
 		uint32_t *restrict colour_table)
@@ -550,19 +1397,21 @@ static nsgif_error nsgif__decode_simple(
 	lzw_result res;
 
 	if (offset_y >= gif->info.height) {
+		gif->image_complete = true;
 		return NSGIF_OK;
 	}
 
 	height -= gif__clip(offset_y, height, gif->info.height);
 
 	if (height == 0) {
+		gif->image_complete = true;
 		return NSGIF_OK;
 	}
 
 	/* Initialise the LZW decoding */
 	res = lzw_decode_init_map(gif->lzw_ctx, data[0],
 			transparency_index, colour_table,
-			gif->buf, gif->buf_len,
+			gif->buf, data_len,
 			data + 1 - gif->buf);
 	if (res != LZW_OK) {
 		return nsgif__error_from_lzw(res);
@@ -588,6 +1437,7 @@ static nsgif_error nsgif__decode_simple(
 	}
 
 	if (pixels == 0) {
+		gif->image_complete = true;
 		ret = NSGIF_OK;
 	}
 
@@ -598,7 +1448,8 @@ static inline nsgif_error nsgif__decode(
 		struct nsgif *gif,
 		struct nsgif_frame *frame,
 		const uint8_t *data,
-		uint32_t *restrict frame_data)
+		uint32_t *restrict frame_data,
+		uint32_t *restrict histogram)
 {
 	nsgif_error ret;
 	uint32_t width  = frame->info.rect.x1 - frame->info.rect.x0;
@@ -607,21 +1458,29 @@ static inline nsgif_error nsgif__decode(
 	uint32_t offset_y = frame->info.rect.y0;
 	uint32_t transparency_index = frame->transparency_index;
 	uint32_t *restrict colour_table = gif->colour_table;
+	size_t data_len = nsgif__frame_data_len(gif, frame);
+
+	gif->image_complete = false;
 
 	if (frame->info.interlaced == false && offset_x == 0 &&
 			width == gif->info.width &&
-			width == gif->rowspan) {
+			width == gif->rowspan &&
+			histogram == NULL &&
+			gif->damage_rows == NULL &&
+			gif->index_mode == false) {
 		ret = nsgif__decode_simple(gif, height, offset_y,
-				data, transparency_index,
+				data, data_len, transparency_index,
 				frame_data, colour_table);
 	} else {
 		ret = nsgif__decode_complex(gif, width, height,
 				offset_x, offset_y, frame->info.interlaced,
-				data, transparency_index,
-				frame_data, colour_table);
+				data, data_len, transparency_index,
+				gif->index_mode, frame_data, colour_table,
+				histogram);
 	}
 
-	if (gif->data_complete && ret == NSGIF_ERR_END_OF_DATA) {
+	if (nsgif__published(&gif->data_complete) &&
+	    ret == NSGIF_ERR_END_OF_DATA) {
 		/* This is all the data there is, so make do. */
 		ret = NSGIF_OK;
 	}
@@ -629,6 +1488,172 @@ static inline nsgif_error nsgif__decode(
 	return ret;
 }
 
+static void nsgif__redraw_rect_extend(
+		const nsgif_rect_t *frame,
+		nsgif_rect_t *redraw)
+{
+	if (redraw->x1 == 0 || redraw->y1 == 0) {
+		*redraw = *frame;
+	} else {
+		if (redraw->x0 > frame->x0) {
+			redraw->x0 = frame->x0;
+		}
+		if (redraw->x1 < frame->x1) {
+			redraw->x1 = frame->x1;
+		}
+		if (redraw->y0 > frame->y0) {
+			redraw->y0 = frame->y0;
+		}
+		if (redraw->y1 < frame->y1) {
+			redraw->y1 = frame->y1;
+		}
+	}
+}
+
+/**
+ * Get the bitmap area that may be changed by a frame's decode.
+ *
+ * This covers the frame itself, and any disposal of the previous frame.
+ *
+ * \param[in]  gif        The gif object we're decoding.
+ * \param[in]  frame      The frame to be decoded.
+ * \param[in]  frame_idx  The index of the frame to be decoded.
+ * \param[out] area       Returns the area, clipped to the bitmap.
+ */
+static void nsgif__damage_area(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		uint32_t frame_idx,
+		nsgif_rect_t *area)
+{
+	const nsgif_rect_t full = {
+		.x1 = gif->info.width,
+		.y1 = gif->info.height,
+	};
+	const struct nsgif_frame *prev;
+
+	if (frame_idx == 0) {
+		*area = full;
+		return;
+	}
+
+	*area = frame->info.rect;
+	prev = nsgif__frame(gif, frame_idx - 1);
+
+	switch (prev->info.disposal) {
+	case NSGIF_DISPOSAL_RESTORE_BG:
+		nsgif__redraw_rect_extend(&prev->info.rect, area);
+		break;
+	case NSGIF_DISPOSAL_RESTORE_PREV:
+		if (gif->prev_index == frame_idx - 1) {
+			/* Recorded just before the previous frame was drawn. */
+			nsgif__redraw_rect_extend(&prev->info.rect, area);
+		} else {
+			*area = full;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (area->x1 > full.x1) area->x1 = full.x1;
+	if (area->y1 > full.y1) area->y1 = full.y1;
+	if (area->x0 > area->x1) area->x0 = area->x1;
+	if (area->y0 > area->y1) area->y0 = area->y1;
+}
+
+/**
+ * Check whether any pixels in an area's rows are noted as changed.
+ *
+ * \param[in] gif   The gif object we're decoding, tracking damage.
+ * \param[in] area  The area whose rows to check.
+ * \return true if any of the rows have changed pixels, false otherwise.
+ */
+static bool nsgif__damage_changed(
+		const struct nsgif *gif,
+		const nsgif_rect_t *area)
+{
+	for (uint32_t y = area->y0; y < area->y1; y++) {
+		const struct nsgif_damage_span *span = &gif->damage_rows[y];
+
+		if (span->x0 < span->x1) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Start tracking the bitmap area changed by a decode.
+ *
+ * The changed span of each row is noted by the functions that write the
+ * bitmap, as they write it.
+ *
+ * \param[in] gif  The gif object we're decoding.
+ */
+static void nsgif__damage_start(
+		struct nsgif *gif)
+{
+	const nsgif_rect_t full = {
+		.x1 = gif->info.width,
+		.y1 = gif->info.height,
+	};
+	size_t size = gif->info.height * sizeof(*gif->damage_rows);
+
+	gif->damage = (nsgif_rect_t) { 0 };
+
+	if (gif->damage_rows == NULL && size != 0) {
+		gif->damage_rows = malloc(size);
+		if (gif->damage_rows == NULL) {
+			/* Can't tell what changes; assume everything. */
+			gif->damage = full;
+			return;
+		}
+	}
+
+	if (size != 0) {
+		memset(gif->damage_rows, 0, size);
+	}
+
+	if (gif->frame_image == NULL) {
+		/* New bitmap; nothing is known about its content. */
+		for (uint32_t y = 0; y < gif->info.height; y++) {
+			gif->damage_rows[y] = (struct nsgif_damage_span) {
+				.x1 = gif->info.width,
+			};
+		}
+		gif->damage = full;
+	}
+}
+
+/**
+ * Get the bounding box of the bitmap rows changed by a decode.
+ *
+ * \param[in] gif  The gif object we're decoding.
+ */
+static void nsgif__damage_finish(
+		struct nsgif *gif)
+{
+	if (gif->damage_rows == NULL) {
+		return;
+	}
+
+	for (uint32_t y = 0; y < gif->info.height; y++) {
+		const struct nsgif_damage_span *span = &gif->damage_rows[y];
+		nsgif_rect_t changed = {
+			.x0 = span->x0,
+			.y0 = y,
+			.x1 = span->x1,
+			.y1 = y + 1,
+		};
+
+		if (span->x0 < span->x1) {
+			nsgif__redraw_rect_extend(&changed, &gif->damage);
+		}
+	}
+}
+
 /**
  * Restore a GIF to the background colour.
  *
@@ -641,14 +1666,17 @@ static void nsgif__restore_bg(
 		struct nsgif_frame *frame,
 		uint32_t *bitmap)
 {
-	size_t pixel_bytes = sizeof(*bitmap);
+	struct nsgif_area_job job = {
+		.dst_stride = gif->info.width * sizeof(*bitmap),
+		.pixel_bytes = sizeof(*bitmap),
+	};
 
 	if (frame == NULL) {
-		size_t width  = gif->info.width;
-		size_t height = gif->info.height;
-
-		memset(bitmap, NSGIF_TRANSPARENT_COLOUR,
-				width * height * pixel_bytes);
+		job.dst = (uint8_t *)bitmap;
+		job.row_bytes = job.dst_stride;
+		job.value = NSGIF_TRANSPARENT_COLOUR;
+		nsgif__area_damage(gif, &job, 0, 0);
+		nsgif__area_run(gif, &job, gif->info.height);
 	} else {
 		uint32_t width  = frame->info.rect.x1 - frame->info.rect.x0;
 		uint32_t height = frame->info.rect.y1 - frame->info.rect.y0;
@@ -664,1330 +1692,4575 @@ static void nsgif__restore_bg(
 		width -= gif__clip(offset_x, width, gif->info.width);
 		height -= gif__clip(offset_y, height, gif->info.height);
 
-		if (frame->info.transparency) {
-			for (uint32_t y = 0; y < height; y++) {
-				uint32_t *scanline = bitmap + offset_x +
-						(offset_y + y) * gif->info.width;
-				memset(scanline, NSGIF_TRANSPARENT_COLOUR,
-						width * pixel_bytes);
-			}
-		} else {
-			for (uint32_t y = 0; y < height; y++) {
-				uint32_t *scanline = bitmap + offset_x +
-						(offset_y + y) * gif->info.width;
-				for (uint32_t x = 0; x < width; x++) {
-					scanline[x] = gif->info.background;
-				}
-			}
-		}
+		job.dst = (uint8_t *)(bitmap + offset_x +
+				offset_y * gif->info.width);
+		job.row_bytes = width * sizeof(*bitmap);
+		job.value = frame->info.transparency ?
+				NSGIF_TRANSPARENT_COLOUR :
+				gif->info.background;
+		nsgif__area_damage(gif, &job, offset_x, offset_y);
+		nsgif__area_run(gif, &job, height);
 	}
 }
 
-static nsgif_error nsgif__update_bitmap(
+/**
+ * Get the colour index that the index canvas is cleared to.
+ *
+ * This is beyond the end of the global colour table, where the colour is
+ * transparent.
+ *
+ * \param[in] gif  The gif object.
+ * \return the index for transparent pixels.
+ */
+static inline uint8_t nsgif__index_clear(
+		const struct nsgif *gif)
+{
+	return gif->colour_table_size;
+}
+
+/**
+ * Restore the index canvas to the background colour.
+ *
+ * \param[in] gif     The gif object we're decoding.
+ * \param[in] frame   The frame to clear, or NULL.
+ * \param[in] canvas  The index canvas to clear the frame in.
+ */
+static void nsgif__restore_bg_index(
 		struct nsgif *gif,
 		struct nsgif_frame *frame,
-		const uint8_t *data,
-		uint32_t frame_idx)
+		uint8_t *canvas)
 {
-	nsgif_error ret;
-	uint32_t *bitmap;
+	uint32_t width  = gif->info.width;
+	uint32_t height = gif->info.height;
+	uint32_t offset_x = 0;
+	uint32_t offset_y = 0;
+	uint8_t index = nsgif__index_clear(gif);
+	struct nsgif_area_job job = { 0 };
+
+	if (frame != NULL) {
+		if (frame->info.display == false ||
+		    frame->info.rect.x0 >= gif->info.width ||
+		    frame->info.rect.y0 >= gif->info.height) {
+			return;
+		}
 
-	gif->decoded_frame = frame_idx;
+		width  = frame->info.rect.x1 - frame->info.rect.x0;
+		height = frame->info.rect.y1 - frame->info.rect.y0;
+		offset_x = frame->info.rect.x0;
+		offset_y = frame->info.rect.y0;
 
-	bitmap = nsgif__bitmap_get(gif);
-	if (bitmap == NULL) {
-		return NSGIF_ERR_OOM;
+		width -= gif__clip(offset_x, width, gif->info.width);
+		height -= gif__clip(offset_y, height, gif->info.height);
+
+		if (!frame->info.transparency) {
+			index = (gif->bg_index < gif->colour_table_size) ?
+					gif->bg_index : 0;
+		}
 	}
 
-	/* Handle any bitmap clearing/restoration required before decoding this
-	 * frame. */
-	if (frame_idx == 0 || gif->decoded_frame == NSGIF_FRAME_INVALID) {
-		nsgif__restore_bg(gif, NULL, bitmap);
+	job.dst = canvas + offset_x + offset_y * gif->info.width;
+	job.dst_stride = gif->info.width;
+	job.row_bytes = width;
+	job.value = index;
+	job.pixel_bytes = sizeof(*canvas);
+	nsgif__area_run(gif, &job, height);
+}
 
-	} else {
-		struct nsgif_frame *prev = &gif->frames[frame_idx - 1];
+/** Index canvas expansion, for \ref nsgif__index_expand_rows. */
+struct nsgif_expand_job {
+	const struct nsgif *gif; /**< The gif object. */
+	uint32_t *bitmap;        /**< The client bitmap to update. */
+	nsgif_rect_t area;       /**< The area to expand. */
+};
 
-		if (prev->info.disposal == NSGIF_DISPOSAL_RESTORE_BG) {
-			nsgif__restore_bg(gif, prev, bitmap);
+/**
+ * Expand a band of rows of the index canvas to the client bitmap.
+ *
+ * \param[in] ctx    The \ref nsgif_expand_job.
+ * \param[in] start  First row, relative to the area.
+ * \param[in] end    Row after the last.
+ */
+static void nsgif__index_expand_rows(
+		void *ctx,
+		uint32_t start,
+		uint32_t end)
+{
+	const struct nsgif_expand_job *job = ctx;
+	const struct nsgif *gif = job->gif;
+	const uint32_t *colour_table = gif->global_colour_table;
+	const nsgif_rect_t *area = &job->area;
+
+	for (uint32_t y = area->y0 + start; y < area->y0 + end; y++) {
+		const uint8_t *restrict src = gif->index_canvas +
+				y * gif->info.width;
+		uint32_t *restrict dst = job->bitmap + y * gif->rowspan;
+
+		if (gif->damage_rows != NULL) {
+			uint32_t x0 = area->x1;
+			uint32_t x1 = 0;
+
+			for (uint32_t x = area->x0; x < area->x1; x++) {
+				uint32_t colour = colour_table[src[x]];
+
+				if (dst[x] != colour) {
+					x0 = (x0 > x) ? x : x0;
+					x1 = x + 1;
+				}
+				dst[x] = colour;
+			}
 
-		} else if (prev->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
-			ret = nsgif__recover_frame(gif, bitmap);
-			if (ret != NSGIF_OK) {
-				nsgif__restore_bg(gif, prev, bitmap);
+			if (x0 < x1) {
+				nsgif__damage_mark(&gif->damage_rows[y],
+						x0, x1);
 			}
+			continue;
 		}
-	}
 
-	if (frame->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
-		/* Store the previous frame for later restoration */
-		nsgif__record_frame(gif, bitmap);
+		for (uint32_t x = area->x0; x < area->x1; x++) {
+			dst[x] = colour_table[src[x]];
+		}
 	}
+}
 
-	ret = nsgif__decode(gif, frame, data, bitmap);
-
-	nsgif__bitmap_modified(gif);
+/**
+ * Expand an area of the index canvas to the client bitmap.
+ *
+ * \param[in] gif     The gif object we're decoding.
+ * \param[in] bitmap  The client bitmap to update.
+ * \param[in] area    The area to expand.
+ */
+static void nsgif__index_expand(
+		const struct nsgif *gif,
+		uint32_t *restrict bitmap,
+		const nsgif_rect_t *area)
+{
+	struct nsgif_expand_job job = {
+		.gif = gif,
+		.bitmap = bitmap,
+		.area = *area,
+	};
 
-	if (!frame->decoded) {
-		frame->opaque = nsgif__bitmap_get_opaque(gif);
-		frame->decoded = true;
+	if (area->x1 <= area->x0 || area->y1 <= area->y0) {
+		return;
 	}
-	nsgif__bitmap_set_opaque(gif, frame);
 
-	return ret;
+	nsgif__parallel_run(gif, area->y1 - area->y0,
+			(size_t)(area->x1 - area->x0) * (area->y1 - area->y0),
+			nsgif__index_expand_rows, &job);
 }
 
 /**
- * Parse the graphic control extension
+ * Expand the area of the index canvas changed since it was last expanded.
  *
- * \param[in] frame  The gif frame object we're decoding.
- * \param[in] data   The data to decode.
- * \param[in] len    Byte length of data.
- * \return NSGIF_ERR_END_OF_DATA if more data is needed,
- *         NSGIF_OK for success.
+ * \param[in] gif     The gif object we're decoding.
+ * \param[in] bitmap  The client bitmap to update.
  */
-static nsgif_error nsgif__parse_extension_graphic_control(
-		struct nsgif_frame *frame,
-		const uint8_t *data,
-		size_t len)
+static void nsgif__index_expand_pending(
+		struct nsgif *gif,
+		uint32_t *restrict bitmap)
 {
-	enum {
-		GIF_MASK_TRANSPARENCY = 0x01,
-		GIF_MASK_DISPOSAL     = 0x1c,
-	};
-
-	/* 6-byte Graphic Control Extension is:
-	 *
-	 *  +0  CHAR    Graphic Control Label
-	 *  +1  CHAR    Block Size
-	 *  +2  CHAR    __Packed Fields__
-	 *              3BITS   Reserved
-	 *              3BITS   Disposal Method
-	 *              1BIT    User Input Flag
-	 *              1BIT    Transparent Color Flag
-	 *  +3  SHORT   Delay Time
-	 *  +5  CHAR    Transparent Color Index
-	 */
-	if (len < 6) {
-		return NSGIF_ERR_END_OF_DATA;
-	}
-
-	frame->info.delay = data[3] | (data[4] << 8);
+	nsgif__index_expand(gif, bitmap, &gif->expand_area);
+	gif->expand_area = (nsgif_rect_t) { 0 };
+}
 
-	if (data[2] & GIF_MASK_TRANSPARENCY) {
-		frame->info.transparency = true;
-		frame->transparency_index = data[5];
-	}
+/**
+ * Check whether frames can be composited on a colour index canvas.
+ *
+ * All frames must use the global colour table, and there must be an index
+ * free to represent transparent pixels.
+ *
+ * \param[in] gif  The gif object.
+ * \return true if the index canvas can be used, false otherwise.
+ */
+static bool nsgif__index_mode_usable(
+		const struct nsgif *gif)
+{
+	return gif->info.global_palette &&
+			gif->local_palettes == false &&
+			gif->colour_table_size < NSGIF_MAX_COLOURS &&
+			gif->global_colour_table[gif->colour_table_size] ==
+					NSGIF_TRANSPARENT_COLOUR;
+}
 
-	frame->info.disposal = ((data[2] & GIF_MASK_DISPOSAL) >> 2);
-	/* I have encountered documentation and GIFs in the
-	 * wild that use 0x04 to restore the previous frame,
-	 * rather than the officially documented 0x03.  I
-	 * believe some (older?)  software may even actually
-	 * export this way.  We handle this as a type of
-	 * "quirks" mode. */
-	if (frame->info.disposal == NSGIF_DISPOSAL_RESTORE_QUIRK) {
-		frame->info.disposal = NSGIF_DISPOSAL_RESTORE_PREV;
+/**
+ * Free any composited frame checkpoints.
+ *
+ * \param[in] gif  The gif object.
+ */
+static void nsgif__checkpoints_free(
+		struct nsgif *gif)
+{
+	for (uint32_t i = 0; i < gif->checkpoint_count; i++) {
+		free(gif->checkpoints[i].canvas);
 	}
 
-	/* if we are clearing the background then we need to
-	 * redraw enough to cover the previous frame too. */
-	frame->redraw_required =
-			frame->info.disposal == NSGIF_DISPOSAL_RESTORE_BG ||
-			frame->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV;
-
-	return NSGIF_OK;
+	free(gif->checkpoints);
+	gif->checkpoints = NULL;
+	gif->checkpoint_count = 0;
 }
 
 /**
- * Check an app ext identifier and authentication code for loop count extension.
+ * Select whether to composite frames on a colour index canvas.
  *
- * \param[in] data  The data to decode.
- * \param[in] len   Byte length of data.
- * \return true if extension is a loop count extension.
+ * Switching loses the composited state, so frames must then be decoded from
+ * the start.
+ *
+ * \param[in] gif  The gif object.
  */
-static bool nsgif__app_ext_is_loop_count(
-		const uint8_t *data,
-		size_t len)
+static void nsgif__index_mode_update(
+		struct nsgif *gif)
 {
-	enum {
-		EXT_LOOP_COUNT_BLOCK_SIZE = 0x0b,
-	};
+	uint32_t frames = nsgif__published(&gif->frame_count_ready);
+	bool index_mode;
 
-	assert(len > 13);
-	(void)(len);
+	/* Only look at frames that are ready, which scanning leaves alone. */
+	for (uint32_t f = gif->local_palettes_checked; f < frames; f++) {
+		if (nsgif__frame(gif, f)->info.local_palette) {
+			gif->local_palettes = true;
+		}
+	}
+	gif->local_palettes_checked = frames;
 
-	if (data[1] == EXT_LOOP_COUNT_BLOCK_SIZE) {
-		if (strncmp((const char *)data + 2, "NETSCAPE2.0", 11) == 0 ||
-		    strncmp((const char *)data + 2, "ANIMEXTS1.0", 11) == 0) {
-			return true;
+	index_mode = nsgif__index_mode_usable(gif);
+
+	if (index_mode && gif->index_canvas == NULL) {
+		gif->index_canvas = malloc((size_t)gif->info.width *
+				gif->info.height);
+		if (gif->index_canvas == NULL) {
+			index_mode = false;
 		}
 	}
 
-	return false;
+	if (index_mode != gif->index_mode) {
+		gif->index_mode = index_mode;
+		gif->decoded_frame = NSGIF_FRAME_INVALID;
+		gif->prev_index = NSGIF_FRAME_INVALID;
+		nsgif__checkpoints_free(gif);
+	}
 }
 
 /**
- * Parse the application extension
+ * Get the source position to point-sample for an output position.
  *
- * \param[in] gif   The gif object we're decoding.
- * \param[in] data  The data to decode.
- * \param[in] len   Byte length of data.
- * \return NSGIF_ERR_END_OF_DATA if more data is needed,
- *         NSGIF_OK for success.
+ * \param[in] pos     Output pixel position.
+ * \param[in] out_ext Output width or height.
+ * \param[in] in_ext  Source width or height.
+ * \return the source pixel position at the centre of the output pixel.
  */
-static nsgif_error nsgif__parse_extension_application(
-		struct nsgif *gif,
-		const uint8_t *data,
-		size_t len)
+static inline uint32_t nsgif__sample_pos(
+		uint32_t pos,
+		uint32_t out_ext,
+		uint32_t in_ext)
 {
-	/* 14-byte+ Application Extension is:
-	 *
-	 *  +0    CHAR    Application Extension Label
-	 *  +1    CHAR    Block Size
-	 *  +2    8CHARS  Application Identifier
-	 *  +10   3CHARS  Appl. Authentication Code
-	 *  +13   1-256   Application Data (Data sub-blocks)
-	 */
-	if (len < 17) {
-		return NSGIF_ERR_END_OF_DATA;
-	}
+	return ((2 * (uint64_t)pos + 1) * in_ext) / (2 * (uint64_t)out_ext);
+}
 
-	if (nsgif__app_ext_is_loop_count(data, len)) {
-		enum {
-			EXT_LOOP_COUNT_SUB_BLOCK_SIZE = 0x03,
-			EXT_LOOP_COUNT_SUB_BLOCK_ID   = 0x01,
-		};
-		if ((data[13] == EXT_LOOP_COUNT_SUB_BLOCK_SIZE) &&
-		    (data[14] == EXT_LOOP_COUNT_SUB_BLOCK_ID)) {
-			gif->info.loop_max = data[15] | (data[16] << 8);
+/**
+ * Point-sample a span of a frame row into an output row.
+ *
+ * \param[in] gif       The gif object we're decoding.
+ * \param[in] frame     The frame being decoded.
+ * \param[in] colours   The frame's colour table.
+ * \param[in] indices   Colour indices for the span.
+ * \param[in] x         Image x position of the start of the span.
+ * \param[in] count     Number of pixels in the span.
+ * \param[in] row       Output row to sample into.
+ * \param[in] width     Output width in pixels.
+ */
+static void nsgif__sample_span(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		const uint32_t *colours,
+		const uint8_t *indices,
+		uint32_t x,
+		uint32_t count,
+		uint32_t *row,
+		uint32_t width)
+{
+	for (uint32_t ox = 0; ox < width; ox++) {
+		uint32_t sx = nsgif__sample_pos(ox, width, gif->info.width);
+		uint32_t index;
 
-			/* The value in the source data means repeat N times
-			 * after the first implied play. A value of zero has
-			 * the special meaning of loop forever. (The only way
-			 * to play the animation once is  not to have this
-			 * extension at all. */
-			if (gif->info.loop_max > 0) {
-				gif->info.loop_max++;
-			}
+		if (sx < x) {
+			continue;
+		} else if (sx >= x + count) {
+			break;
 		}
-	}
 
-	return NSGIF_OK;
+		index = indices[sx - x];
+		if (index != frame->transparency_index) {
+			row[ox] = colours[index];
+		}
+	}
 }
 
 /**
- * Parse the frame's extensions
+ * Decode a frame, point-sampled to a small output buffer.
  *
- * \param[in] gif     The gif object we're decoding.
- * \param[in] frame   The frame to parse extensions for.
- * \param[in] pos     Current position in data, updated on exit.
- * \param[in] decode  Whether to decode or skip over the extension.
- * \return NSGIF_ERR_END_OF_DATA if more data is needed,
- *         NSGIF_OK for success.
+ * Only the rows that are sampled are expanded, and LZW decoding stops once
+ * the last sampled row has been decoded.
+ *
+ * \param[in] gif      The gif object we're decoding.
+ * \param[in] frame    The frame to decode.
+ * \param[in] colours  The frame's colour table.
+ * \param[in] data     The frame's image data.
+ * \param[in] buffer   Output buffer, already cleared.
+ * \param[in] width    Output width in pixels.
+ * \param[in] height   Output height in pixels.
+ * \return NSGIF_OK on success, appropriate error otherwise.
  */
-static nsgif_error nsgif__parse_frame_extensions(
+static nsgif_error nsgif__decode_sampled(
 		struct nsgif *gif,
-		struct nsgif_frame *frame,
-		const uint8_t **pos,
-		bool decode)
+		const struct nsgif_frame *frame,
+		const uint32_t *colours,
+		const uint8_t *data,
+		uint32_t *buffer,
+		uint32_t width,
+		uint32_t height)
 {
-	enum {
-		GIF_EXT_INTRODUCER      = 0x21,
-		GIF_EXT_GRAPHIC_CONTROL = 0xf9,
-		GIF_EXT_COMMENT         = 0xfe,
-		GIF_EXT_PLAIN_TEXT      = 0x01,
-		GIF_EXT_APPLICATION     = 0xff,
-	};
-	const uint8_t *nsgif_data = *pos;
-	const uint8_t *nsgif_end = gif->buf + gif->buf_len;
-	int nsgif_bytes = nsgif_end - nsgif_data;
+	uint32_t offset_x = frame->info.rect.x0;
+	uint32_t offset_y = frame->info.rect.y0;
+	uint32_t frame_width  = frame->info.rect.x1 - offset_x;
+	uint32_t frame_height = frame->info.rect.y1 - offset_y;
+	const uint8_t *uncompressed;
+	uint32_t available = 0;
+	uint32_t needed = 0;
+	uint8_t step = 24;
+	uint32_t y = 0;
+	lzw_result res;
 
-	/* Initialise the extensions */
-	while (nsgif_bytes > 0 && nsgif_data[0] == GIF_EXT_INTRODUCER) {
-		bool block_step = true;
-		nsgif_error ret;
+	for (uint32_t oy = 0; oy < height; oy++) {
+		uint32_t sy = nsgif__sample_pos(oy, height, gif->info.height);
+		if (sy >= offset_y && sy < offset_y + frame_height) {
+			needed++;
+		}
+	}
 
-		nsgif_data++;
-		nsgif_bytes--;
+	if (needed == 0 || frame_width == 0) {
+		return NSGIF_OK;
+	}
 
-		if (nsgif_bytes == 0) {
-			return NSGIF_ERR_END_OF_DATA;
-		}
+	res = lzw_decode_init(gif->lzw_ctx, data[0],
+			gif->buf, nsgif__frame_data_len(gif, frame),
+			data + 1 - gif->buf);
+	if (res != LZW_OK) {
+		return nsgif__error_from_lzw(res);
+	}
 
-		/* Switch on extension label */
-		switch (nsgif_data[0]) {
-		case GIF_EXT_GRAPHIC_CONTROL:
-			if (decode) {
-				ret = nsgif__parse_extension_graphic_control(
-						frame,
-						nsgif_data,
-						nsgif_bytes);
-				if (ret != NSGIF_OK) {
-					return ret;
+	do {
+		uint32_t x = 0;
+
+		while (x < frame_width) {
+			uint32_t count;
+
+			if (available == 0) {
+				if (res != LZW_OK) {
+					/* Unexpected end of frame */
+					if (res == LZW_OK_EOD ||
+					    res == LZW_EOI_CODE) {
+						return NSGIF_OK;
+					}
+					return nsgif__error_from_lzw(res);
+				}
+				res = lzw_decode(gif->lzw_ctx,
+						&uncompressed, &available);
+				if (available == 0) {
+					return NSGIF_OK;
 				}
+				continue;
 			}
-			break;
 
-		case GIF_EXT_APPLICATION:
-			if (decode) {
-				ret = nsgif__parse_extension_application(
-						gif, nsgif_data, nsgif_bytes);
-				if (ret != NSGIF_OK) {
-					return ret;
+			count = frame_width - x;
+			if (count > available) {
+				count = available;
+			}
+
+			for (uint32_t oy = 0; oy < height; oy++) {
+				uint32_t sy = nsgif__sample_pos(oy, height,
+						gif->info.height);
+				if (sy == offset_y + y) {
+					nsgif__sample_span(gif, frame,
+							colours, uncompressed,
+							offset_x + x, count,
+							buffer + oy * width,
+							width);
+					if (x + count == frame_width) {
+						needed--;
+					}
 				}
 			}
-			break;
 
-		case GIF_EXT_COMMENT:
-			/* Move the pointer to the first data sub-block Skip 1
-			 * byte for the extension label. */
-			++nsgif_data;
-			block_step = false;
-			break;
+			uncompressed += count;
+			available -= count;
+			x += count;
+		}
+	} while (needed > 0 && nsgif__next_row(frame->info.interlaced,
+			frame_height, &y, &step));
 
-		default:
-			break;
+	return NSGIF_OK;
+}
+
+/**
+ * Work out a frame's colour statistics from its colour index histogram.
+ *
+ * \param[in]     gif    The gif object we're decoding.
+ * \param[in]     frame  The frame that was decoded.
+ * \param[in,out] stats  The frame's statistics, with histogram filled in.
+ */
+static void nsgif__colour_stats_finish(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		nsgif_colour_stats_t *stats)
+{
+	const uint8_t *table = (const uint8_t *)gif->colour_table;
+	uint8_t *average = (uint8_t *)&stats->average;
+	uint64_t sum[4] = { 0 };
+	uint32_t max = 0;
+
+	for (uint32_t i = 0; i < NSGIF_MAX_COLOURS; i++) {
+		uint32_t count = stats->histogram[i];
+
+		if (count == 0 || i == frame->transparency_index) {
+			continue;
 		}
 
-		if (block_step) {
-			/* Move the pointer to the first data sub-block Skip 2
-			 * bytes for the extension label and size fields Skip
-			 * the extension size itself
-			 */
-			if (nsgif_bytes < 2) {
-				return NSGIF_ERR_END_OF_DATA;
-			}
-			nsgif_data += 2 + nsgif_data[1];
+		for (uint32_t c = 0; c < 4; c++) {
+			sum[c] += (uint64_t)count * table[i * 4 + c];
 		}
+		stats->pixels += count;
 
-		/* Repeatedly skip blocks until we get a zero block or run out
-		 * of data.  This data is ignored by this gif decoder. */
-		while (nsgif_data < nsgif_end && nsgif_data[0] != NSGIF_BLOCK_TERMINATOR) {
-			nsgif_data += nsgif_data[0] + 1;
-			if (nsgif_data >= nsgif_end) {
-				return NSGIF_ERR_END_OF_DATA;
-			}
+		if (count > max) {
+			stats->dominant = gif->colour_table[i];
+			max = count;
 		}
-		nsgif_data++;
-		nsgif_bytes = nsgif_end - nsgif_data;
 	}
 
-	if (nsgif_data > nsgif_end) {
-		nsgif_data = nsgif_end;
+	if (stats->pixels > 0) {
+		for (uint32_t c = 0; c < 4; c++) {
+			average[c] = sum[c] / stats->pixels;
+		}
 	}
-
-	/* Set buffer position and return */
-	*pos = nsgif_data;
-	return NSGIF_OK;
 }
 
 /**
- * Parse a GIF Image Descriptor.
+ * Decode a frame's image onto the bitmap.
  *
- * The format is:
- *
- *  +0   CHAR   Image Separator (0x2c)
- *  +1   SHORT  Image Left Position
- *  +3   SHORT  Image Top Position
- *  +5   SHORT  Width
- *  +7   SHORT  Height
- *  +9   CHAR   __Packed Fields__
- *              1BIT    Local Colour Table Flag
- *              1BIT    Interlace Flag
- *              1BIT    Sort Flag
- *              2BITS   Reserved
- *              3BITS   Size of Local Colour Table
+ * Also collects the frame's colour statistics, if wanted.
  *
- * \param[in] gif     The gif object we're decoding.
- * \param[in] frame   The frame to parse an image descriptor for.
- * \param[in] pos     Current position in data, updated on exit.
- * \param[in] decode  Whether to decode the image descriptor.
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame to decode.
+ * \param[in] frame_idx  The index of the frame to decode.
+ * \param[in] data       The frame's image data.
+ * \param[in] bitmap     The bitmap to decode into.
+ * \param[in] repeat     Whether the frame is already on the bitmap.
  * \return NSGIF_OK on success, appropriate error otherwise.
  */
-static nsgif_error nsgif__parse_image_descriptor(
+static nsgif_error nsgif__decode_image(
 		struct nsgif *gif,
 		struct nsgif_frame *frame,
-		const uint8_t **pos,
-		bool decode)
+		uint32_t frame_idx,
+		const uint8_t *data,
+		uint32_t *bitmap,
+		bool repeat)
 {
-	const uint8_t *data = *pos;
-	size_t len = gif->buf + gif->buf_len - data;
-	enum {
-		NSGIF_IMAGE_DESCRIPTOR_LEN = 10u,
-		NSGIF_IMAGE_SEPARATOR      = 0x2Cu,
-		NSGIF_MASK_INTERLACE       = 0x40u,
-	};
-
-	assert(gif != NULL);
-	assert(frame != NULL);
+	nsgif_colour_stats_t *stats = NULL;
+	nsgif_error ret;
 
-	if (len < NSGIF_IMAGE_DESCRIPTOR_LEN) {
-		return NSGIF_ERR_END_OF_DATA;
+	if (gif->colour_stats && frame->colour_stats == NULL) {
+		stats = calloc(1, sizeof(*stats));
 	}
 
-	if (decode) {
-		uint32_t x, y, w, h;
-
-		if (data[0] != NSGIF_IMAGE_SEPARATOR) {
-			return NSGIF_ERR_DATA_FRAME;
-		}
+	if (repeat) {
+		/* Bitmap already has this frame's image. */
+		const struct nsgif_frame *prev;
 
-		x = data[1] | (data[2] << 8);
-		y = data[3] | (data[4] << 8);
-		w = data[5] | (data[6] << 8);
-		h = data[7] | (data[8] << 8);
-		frame->flags = data[9];
+		prev = nsgif__frame(gif, frame_idx - 1);
 
-		frame->info.rect.x0 = x;
-		frame->info.rect.y0 = y;
-		frame->info.rect.x1 = x + w;
-		frame->info.rect.y1 = y + h;
+		if (stats != NULL) {
+			if (prev->colour_stats != NULL) {
+				*stats = *prev->colour_stats;
+				frame->colour_stats = stats;
+			} else {
+				free(stats);
+			}
+		}
+		return NSGIF_OK;
+	}
 
-		frame->info.interlaced = frame->flags & NSGIF_MASK_INTERLACE;
+	ret = nsgif__decode(gif, frame, data, bitmap,
+			(stats != NULL) ? stats->histogram : NULL);
 
-		/* Allow first frame to grow image dimensions. */
-		if (gif->info.frame_count == 0) {
-			if (x + w > gif->info.width) {
-				gif->info.width = x + w;
-			}
-			if (y + h > gif->info.height) {
-				gif->info.height = y + h;
-			}
+	if (stats != NULL) {
+		if (ret == NSGIF_OK) {
+			nsgif__colour_stats_finish(gif, frame, stats);
+			frame->colour_stats = stats;
+		} else {
+			free(stats);
 		}
 	}
 
-	*pos += NSGIF_IMAGE_DESCRIPTOR_LEN;
-	return NSGIF_OK;
+	return ret;
 }
 
 /**
- * Extract a GIF colour table into a LibNSGIF colour table buffer.
+ * Check whether a frame draws the same image as the previous frame.
  *
- * \param[in] colour_table          The colour table to populate.
- * \param[in] layout                la.
- * \param[in] colour_table_entries  The number of colour table entries.
- * \param[in] data                  Raw colour table data.
+ * Requires frame hashing. The previous frame must not be disposed of, so
+ * that drawing this frame over it changes nothing.
+ *
+ * \param[in] gif        The gif object.
+ * \param[in] frame      The frame to check.
+ * \param[in] frame_idx  The index of the frame to check.
+ * \return true if the frame repeats the previous frame, false otherwise.
  */
-static void nsgif__colour_table_decode(
-		uint32_t colour_table[NSGIF_MAX_COLOURS],
-		const struct nsgif_colour_layout *layout,
-		size_t colour_table_entries,
-		const uint8_t *data)
+static bool nsgif__frame_is_repeat_of_prev(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		uint32_t frame_idx)
 {
-	uint8_t *entry = (uint8_t *)colour_table;
+	const struct nsgif_frame *prev;
 
-	while (colour_table_entries--) {
-		/* Gif colour map contents are r,g,b.
-		 *
-		 * We want to pack them bytewise into the colour table,
-		 * according to the client colour layout.
-		 */
+	if (frame_idx == 0 || frame->info.hash == 0) {
+		return false;
+	}
 
-		entry[layout->r] = *data++;
-		entry[layout->g] = *data++;
-		entry[layout->b] = *data++;
-		entry[layout->a] = 0xff;
+	prev = nsgif__frame(gif, frame_idx - 1);
 
-		entry += sizeof(uint32_t);
-	}
+	return prev->info.hash == frame->info.hash &&
+			prev->info.display &&
+			(prev->info.disposal == NSGIF_DISPOSAL_UNSPECIFIED ||
+			 prev->info.disposal == NSGIF_DISPOSAL_NONE);
 }
 
 /**
- * Extract a GIF colour table into a LibNSGIF colour table buffer.
+ * Check whether decoding a frame would leave the bitmap unchanged.
  *
- * \param[in]  colour_table          The colour table to populate.
- * \param[in]  layout                The target pixel format to decode to.
- * \param[in]  colour_table_entries  The number of colour table entries.
- * \param[in]  data                  Current position in data.
- * \param[in]  data_len              The available length of `data`.
- * \param[out] used                  Number of colour table bytes read.
- * \param[in]  decode                Whether to decode the colour table.
- * \return NSGIF_OK on success, appropriate error otherwise.
+ * This is the case if the frame's image data is identical to that of the
+ * previous frame, and the previous frame is on the bitmap, undisposed.
+ *
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame to check.
+ * \param[in] frame_idx  The index of the frame to check.
+ * \return true if the frame's decode can be skipped, false otherwise.
  */
-static inline nsgif_error nsgif__colour_table_extract(
-		uint32_t colour_table[NSGIF_MAX_COLOURS],
-		const struct nsgif_colour_layout *layout,
-		size_t colour_table_entries,
-		const uint8_t *data,
-		size_t data_len,
-		size_t *used,
-		bool decode)
+static bool nsgif__frame_is_repeat(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		uint32_t frame_idx)
 {
-	if (data_len < colour_table_entries * 3) {
-		return NSGIF_ERR_END_OF_DATA;
+	if (frame_idx == 0 ||
+	    gif->decoded_frame != frame_idx - 1 ||
+	    gif->decoded_ok == false) {
+		return false;
 	}
 
-	if (decode) {
-		nsgif__colour_table_decode(colour_table, layout,
-				colour_table_entries, data);
+	return nsgif__frame_is_repeat_of_prev(gif, frame, frame_idx);
+}
+
+/**
+ * Check whether every frame in the GIF has been scanned.
+ *
+ * \param[in] gif  The GIF object.
+ * \return true if there can be no further frames, false otherwise.
+ */
+static inline bool nsgif__frames_complete(
+		const nsgif_t *gif)
+{
+	return nsgif__published(&gif->frames_final);
+}
+
+/**
+ * Check whether a frame's canvas must be recorded before it is drawn.
+ *
+ * The record is used to dispose of frames with restore previous disposal,
+ * before drawing the next frame. Nothing follows the final frame, as the
+ * animation restarts on a cleared canvas.
+ *
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame about to be decoded.
+ * \param[in] frame_idx  The index of the frame about to be decoded.
+ * \return true if the canvas must be recorded, false otherwise.
+ */
+static bool nsgif__frame_needs_record(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		uint32_t frame_idx)
+{
+	if (frame->info.disposal != NSGIF_DISPOSAL_RESTORE_PREV) {
+		return false;
 	}
 
-	*used = colour_table_entries * 3;
-	return NSGIF_OK;
+	/* The frame count is only final once the frames are complete. */
+	return !nsgif__frames_complete(gif) ||
+			frame_idx + 1 != gif->info.frame_count;
 }
 
 /**
- * Get a frame's colour table.
+ * Dispose of the previous frame on the client bitmap.
  *
- * Sets up gif->colour_table for the frame.
+ * Also records the bitmap if the frame is to be disposed of by restoring
+ * it.
  *
- * \param[in] gif     The gif object we're decoding.
- * \param[in] frame   The frame to get the colour table for.
- * \param[in] pos     Current position in data, updated on exit.
- * \param[in] decode  Whether to decode the colour table.
- * \return NSGIF_OK on success, appropriate error otherwise.
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame about to be decoded.
+ * \param[in] frame_idx  The index of the frame about to be decoded.
+ * \param[in] bitmap     The client bitmap.
+ * \param[in] dispose    Whether to dispose of the previous frame.
  */
-static nsgif_error nsgif__parse_colour_table(
+static void nsgif__update_canvas(
 		struct nsgif *gif,
 		struct nsgif_frame *frame,
-		const uint8_t **pos,
-		bool decode)
+		uint32_t frame_idx,
+		uint32_t *bitmap,
+		bool dispose)
 {
 	nsgif_error ret;
-	const uint8_t *data = *pos;
-	size_t len = gif->buf + gif->buf_len - data;
-	size_t used_bytes;
 
-	assert(gif != NULL);
-	assert(frame != NULL);
+	/* Handle any bitmap clearing/restoration required before decoding this
+	 * frame. */
+	if (frame_idx == 0 || gif->decoded_frame == NSGIF_FRAME_INVALID) {
+		nsgif__restore_bg(gif, NULL, bitmap);
 
-	if ((frame->flags & NSGIF_COLOUR_TABLE_MASK) == 0) {
-		gif->colour_table = gif->global_colour_table;
-		return NSGIF_OK;
-	}
+	} else if (dispose) {
+		struct nsgif_frame *prev = nsgif__frame(gif, frame_idx - 1);
 
-	if (decode == false) {
-		frame->colour_table_offset = *pos - gif->buf;
-	}
+		if (prev->info.disposal == NSGIF_DISPOSAL_RESTORE_BG) {
+			nsgif__restore_bg(gif, prev, bitmap);
 
-	ret = nsgif__colour_table_extract(
-			gif->local_colour_table, &gif->colour_layout,
-			2 << (frame->flags & NSGIF_COLOUR_TABLE_SIZE_MASK),
-			data, len, &used_bytes, decode);
-	if (ret != NSGIF_OK) {
-		return ret;
+		} else if (prev->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
+			ret = nsgif__recover_frame(gif, bitmap,
+					sizeof(*bitmap), gif->rowspan);
+			if (ret != NSGIF_OK) {
+				nsgif__restore_bg(gif, prev, bitmap);
+			}
+		}
 	}
-	*pos += used_bytes;
 
-	if (decode) {
-		gif->colour_table = gif->local_colour_table;
-	} else {
-		frame->info.local_palette = true;
+	if (nsgif__frame_needs_record(gif, frame, frame_idx)) {
+		/* Store the previous frame for later restoration */
+		nsgif__record_frame(gif, frame, bitmap,
+				sizeof(*bitmap), gif->rowspan);
 	}
-
-	return NSGIF_OK;
 }
 
 /**
- * Parse the image data for a gif frame.
+ * Dispose of the previous frame on the index canvas.
  *
- * Sets up gif->colour_table for the frame.
+ * Also records the canvas if the frame is to be disposed of by restoring
+ * it.
  *
- * \param[in] gif     The gif object we're decoding.
- * \param[in] frame   The frame to parse image data for.
- * \param[in] pos     Current position in data, updated on exit.
- * \param[in] decode  Whether to decode the image data.
- * \return NSGIF_OK on success, appropriate error otherwise.
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame about to be decoded.
+ * \param[in] frame_idx  The index of the frame about to be decoded.
+ * \param[in] dispose    Whether to dispose of the previous frame.
  */
-static nsgif_error nsgif__parse_image_data(
+static void nsgif__update_index_canvas(
 		struct nsgif *gif,
 		struct nsgif_frame *frame,
-		const uint8_t **pos,
-		bool decode)
+		uint32_t frame_idx,
+		bool dispose)
 {
-	const uint8_t *data = *pos;
-	size_t len = gif->buf + gif->buf_len - data;
-	uint32_t frame_idx = frame - gif->frames;
-	uint8_t minimum_code_size;
+	uint8_t *canvas = gif->index_canvas;
 	nsgif_error ret;
 
-	assert(gif != NULL);
-	assert(frame != NULL);
-
-	if (!decode) {
-		gif->frame_count_partial = frame_idx + 1;
-	}
-
-	/* Ensure sufficient data remains.  A gif trailer or a minimum lzw code
-	 * followed by a gif trailer is treated as OK, although without any
-	 * image data. */
-	switch (len) {
-		default: if (data[0] == NSGIF_TRAILER) return NSGIF_OK;
-			break;
-		case 2: if (data[1] == NSGIF_TRAILER) return NSGIF_OK;
-			/* Fall through. */
-		case 1: if (data[0] == NSGIF_TRAILER) return NSGIF_OK;
-			/* Fall through. */
-		case 0: return NSGIF_ERR_END_OF_DATA;
-	}
-
-	minimum_code_size = data[0];
-	if (minimum_code_size >= LZW_CODE_MAX) {
-		return NSGIF_ERR_DATA_FRAME;
-	}
+	if (frame_idx == 0) {
+		nsgif__restore_bg_index(gif, NULL, canvas);
 
-	if (decode) {
-		ret = nsgif__update_bitmap(gif, frame, data, frame_idx);
-	} else {
-		uint32_t block_size = 0;
+	} else if (dispose) {
+		struct nsgif_frame *prev = nsgif__frame(gif, frame_idx - 1);
 
-		/* Skip the minimum code size. */
-		data++;
-		len--;
+		if (prev->info.disposal == NSGIF_DISPOSAL_RESTORE_BG) {
+			nsgif__restore_bg_index(gif, prev, canvas);
 
-		while (block_size != 1) {
-			if (len < 1) {
-				return NSGIF_ERR_END_OF_DATA;
-			}
-			block_size = data[0] + 1;
-			/* Check if the frame data runs off the end of the file */
-			if (block_size > len) {
-				frame->lzw_data_length += len;
-				return NSGIF_ERR_END_OF_DATA;
+		} else if (prev->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
+			ret = nsgif__recover_frame(gif, canvas,
+					sizeof(*canvas), gif->info.width);
+			if (ret != NSGIF_OK) {
+				nsgif__restore_bg_index(gif, prev, canvas);
 			}
-
-			len -= block_size;
-			data += block_size;
-			frame->lzw_data_length += block_size;
 		}
+	}
 
-		*pos = data;
+	if (nsgif__frame_needs_record(gif, frame, frame_idx)) {
+		nsgif__record_frame(gif, frame, canvas,
+				sizeof(*canvas), gif->info.width);
+	}
+}
 
-		gif->info.frame_count = frame_idx + 1;
-		gif->frames[frame_idx].info.display = true;
+/**
+ * Check whether a frame's image hides the previous frame's disposal.
+ *
+ * The frame must be opaque, and its area must contain the previous frame's
+ * area, which is cleared or restored when the previous frame is disposed
+ * of. The frame mustn't be recorded for restore previous disposal either,
+ * as the record would need the previous frame disposed of first.
+ *
+ * \param[in] frame  The frame to check.
+ * \param[in] prev   The frame before it.
+ * \return true if the previous frame's disposal needn't be done.
+ */
+static bool nsgif__frame_covers(
+		const struct nsgif_frame *frame,
+		const struct nsgif_frame *prev)
+{
+	const nsgif_rect_t *r = &frame->info.rect;
+	const nsgif_rect_t *p = &prev->info.rect;
 
-		return NSGIF_OK;
+	if (frame->info.display == false ||
+	    frame->info.transparency ||
+	    frame->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
+		return false;
 	}
 
-	return ret;
+	if (prev->info.display == false ||
+	    (prev->info.disposal != NSGIF_DISPOSAL_RESTORE_BG &&
+	     prev->info.disposal != NSGIF_DISPOSAL_RESTORE_PREV)) {
+		return false;
+	}
+
+	return r->x0 <= p->x0 && r->y0 <= p->y0 &&
+			r->x1 >= p->x1 && r->y1 >= p->y1;
 }
 
-static struct nsgif_frame *nsgif__get_frame(
-		struct nsgif *gif,
-		uint32_t frame_idx)
+/**
+ * Get the number of pixels in a frame's redraw rectangle within the image.
+ *
+ * \param[in] gif    The gif object.
+ * \param[in] frame  The frame to get the clipped area of.
+ * \return the frame's clipped area.
+ */
+static uint32_t nsgif__frame_clipped_area(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame)
 {
-	struct nsgif_frame *frame;
+	const nsgif_rect_t *r = &frame->info.rect;
+	uint32_t w = r->x1 - r->x0;
+	uint32_t h = r->y1 - r->y0;
 
-	if (gif->frame_holders > frame_idx) {
-		frame = &gif->frames[frame_idx];
-	} else {
-		/* Allocate more memory */
-		size_t count = frame_idx + 1;
-		struct nsgif_frame *temp;
+	if (r->x0 >= gif->info.width || r->y0 >= gif->info.height) {
+		return 0;
+	}
 
-		temp = realloc(gif->frames, count * sizeof(*frame));
-		if (temp == NULL) {
-			return NULL;
-		}
-		gif->frames = temp;
-		gif->frame_holders = count;
+	w -= gif__clip(r->x0, w, gif->info.width);
+	h -= gif__clip(r->y0, h, gif->info.height);
 
-		frame = &gif->frames[frame_idx];
+	return w * h;
+}
 
-		frame->info.local_palette = false;
-		frame->info.transparency = false;
-		frame->info.display = false;
-		frame->info.disposal = 0;
-		frame->info.delay = 10;
+/**
+ * Compile a frame's compositing plan.
+ *
+ * Also fills in the cost predictors in the frame's info.
+ *
+ * \param[in] gif        The gif object.
+ * \param[in] frame_idx  The index of the frame to plan.
+ */
+static void nsgif__frame_plan(
+		struct nsgif *gif,
+		uint32_t frame_idx)
+{
+	struct nsgif_frame *frame = nsgif__frame(gif, frame_idx);
+	const nsgif_rect_t *r = &frame->info.rect;
 
-		frame->transparency_index = NSGIF_NO_TRANSPARENCY;
-		frame->frame_offset = gif->buf_pos;
-		frame->redraw_required = false;
-		frame->lzw_data_length = 0;
-		frame->decoded = false;
+	frame->plan = 0;
+
+	if (frame_idx > 0 &&
+	    nsgif__frame_covers(frame, nsgif__frame(gif, frame_idx - 1))) {
+		frame->plan |= NSGIF_PLAN_SKIP_DISPOSE;
 	}
 
-	return frame;
+	frame->info.data_length = frame->lzw_data_length;
+	frame->info.area = (r->x1 - r->x0) * (r->y1 - r->y0);
+	frame->info.clipped_area = nsgif__frame_clipped_area(gif, frame);
+	frame->info.full_restore = (frame_idx == 0);
+
+	if (frame_idx > 0 && !(frame->plan & NSGIF_PLAN_SKIP_DISPOSE)) {
+		const struct nsgif_frame *prev;
+
+		prev = nsgif__frame(gif, frame_idx - 1);
+
+		if ((prev->info.disposal == NSGIF_DISPOSAL_RESTORE_BG ||
+		     prev->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) &&
+		    prev->info.clipped_area ==
+				gif->info.width * gif->info.height) {
+			frame->info.full_restore = true;
+		}
+	}
 }
 
 /**
- * Attempts to initialise the next frame
+ * Dispose of the previous frame, and draw a frame's image.
  *
- * \param[in] gif       The animation context
- * \param[in] frame_idx The frame number to decode.
- * \param[in] decode    Whether to decode the graphical image data.
+ * Disposal is skipped if the frame's plan says the frame's image covers
+ * the previous frame. If the image turns out to be incomplete, it didn't,
+ * so the previous frame is disposed of and the image drawn again.
+ *
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame to draw.
+ * \param[in] frame_idx  The index of the frame to draw.
+ * \param[in] data       The frame's image data.
+ * \param[in] bitmap     The client bitmap, or NULL in index mode.
+ * \param[in] repeat     Whether the frame is already on the canvas.
  * \return NSGIF_OK on success, appropriate error otherwise.
-*/
-static nsgif_error nsgif__process_frame(
+ */
+static nsgif_error nsgif__composite(
 		struct nsgif *gif,
+		struct nsgif_frame *frame,
 		uint32_t frame_idx,
-		bool decode)
+		const uint8_t *data,
+		uint32_t *bitmap,
+		bool repeat)
 {
+	bool dispose = !(frame->plan & NSGIF_PLAN_SKIP_DISPOSE) || repeat;
 	nsgif_error ret;
-	const uint8_t *pos;
-	const uint8_t *end;
-	struct nsgif_frame *frame;
 
-	frame = nsgif__get_frame(gif, frame_idx);
-	if (frame == NULL) {
-		return NSGIF_ERR_OOM;
+	if (gif->skip_image) {
+		/* The frame's image is hidden before it would be seen. */
+		dispose = true;
 	}
 
-	end = gif->buf + gif->buf_len;
+	if (gif->index_mode) {
+		nsgif__update_index_canvas(gif, frame, frame_idx, dispose);
+	} else {
+		nsgif__update_canvas(gif, frame, frame_idx, bitmap, dispose);
+	}
 
-	if (decode) {
-		pos = gif->buf + frame->frame_offset;
+	if (gif->skip_image) {
+		return NSGIF_OK;
+	}
 
-		/* Ensure this frame is supposed to be decoded */
-		if (frame->info.display == false) {
-			return NSGIF_OK;
-		}
+	ret = nsgif__decode_image(gif, frame, frame_idx, data, bitmap, repeat);
 
-		/* Ensure the frame is in range to decode */
-		if (frame_idx > gif->frame_count_partial) {
-			return NSGIF_ERR_END_OF_DATA;
+	if (!dispose && !gif->image_complete) {
+		if (gif->index_mode) {
+			nsgif__update_index_canvas(gif, frame, frame_idx, true);
+		} else {
+			nsgif__update_canvas(gif, frame, frame_idx,
+					bitmap, true);
 		}
+		ret = nsgif__decode_image(gif, frame, frame_idx,
+				data, bitmap, repeat);
+	}
 
-		/* Done if frame is already decoded */
-		if (frame_idx == gif->decoded_frame) {
-			return NSGIF_OK;
-		}
-	} else {
-		pos = gif->buf + gif->buf_pos;
+	return ret;
+}
 
-		/* Check if we've finished */
-		if (pos < end && pos[0] == NSGIF_TRAILER) {
-			return NSGIF_OK;
-		}
+static nsgif_error nsgif__update_bitmap(
+		struct nsgif *gif,
+		struct nsgif_frame *frame,
+		const uint8_t *data,
+		uint32_t frame_idx)
+{
+	nsgif_error ret;
+	uint32_t *bitmap;
+	nsgif_rect_t area;
+	bool unchanged = false;
+	bool prev_ok = gif->decoded_ok;
+	bool repeat;
+
+	repeat = nsgif__frame_is_repeat(gif, frame, frame_idx);
+	gif->decoded_frame = frame_idx;
+	gif->checkpoint_restored = false;
+
+	if (gif->canvas_only) {
+		ret = nsgif__composite(gif, frame, frame_idx,
+				data, NULL, repeat);
+		gif->decoded_ok = (ret == NSGIF_OK) && !gif->skip_image;
+		return ret;
 	}
 
-	ret = nsgif__parse_frame_extensions(gif, frame, &pos, !decode);
-	if (ret != NSGIF_OK) {
-		goto cleanup;
+	bitmap = nsgif__bitmap_get(gif);
+	if (bitmap == NULL) {
+		return NSGIF_ERR_OOM;
 	}
 
-	ret = nsgif__parse_image_descriptor(gif, frame, &pos, !decode);
-	if (ret != NSGIF_OK) {
-		goto cleanup;
+	if (gif->damage_rows != NULL || gif->index_mode) {
+		nsgif__damage_area(gif, frame, frame_idx, &area);
 	}
 
-	ret = nsgif__parse_colour_table(gif, frame, &pos, decode);
-	if (ret != NSGIF_OK) {
-		goto cleanup;
+	if (gif->damage_rows != NULL) {
+		/* Whether this frame changes anything can only be told if
+		 * nothing in its area has changed yet, and the bitmap holds
+		 * the previous frame. */
+		unchanged = !nsgif__damage_changed(gif, &area) &&
+				gif->expand_area.x1 == 0;
 	}
 
-	ret = nsgif__parse_image_data(gif, frame, &pos, decode);
-	if (ret != NSGIF_OK) {
-		goto cleanup;
+	ret = nsgif__composite(gif, frame, frame_idx, data, bitmap, repeat);
+	gif->decoded_ok = (ret == NSGIF_OK) && !gif->skip_image;
+
+	if (gif->index_mode) {
+		if (area.x0 < area.x1 && area.y0 < area.y1) {
+			nsgif__redraw_rect_extend(&area, &gif->expand_area);
+		}
+		if (gif->expand_defer) {
+			/* The frame is only seen through later frames in
+			 * this decode, so it's expanded along with them. */
+			return ret;
+		}
+		nsgif__index_expand_pending(gif, bitmap);
 	}
 
-cleanup:
-	if (!decode) {
-		gif->buf_pos = pos - gif->buf;
+	if (unchanged && !nsgif__damage_changed(gif, &area) &&
+	    frame_idx > 0 && prev_ok && gif->decoded_ok) {
+		/* Composited image matches the previous frame. */
+		frame->info.duplicate = true;
 	}
 
+	nsgif__bitmap_modified(gif);
+
+	if (gif->skip_image) {
+		return ret;
+	}
+
+	if (!frame->decoded) {
+		frame->opaque = nsgif__bitmap_get_opaque(gif);
+		frame->decoded = true;
+	}
+	nsgif__bitmap_set_opaque(gif, frame);
+
 	return ret;
 }
 
-/* exported function documented in nsgif.h */
-void nsgif_destroy(nsgif_t *gif)
+/**
+ * Parse the graphic control extension
+ *
+ * \param[in] frame  The gif frame object we're decoding.
+ * \param[in] data   The data to decode.
+ * \param[in] len    Byte length of data.
+ * \return NSGIF_ERR_END_OF_DATA if more data is needed,
+ *         NSGIF_OK for success.
+ */
+static nsgif_error nsgif__parse_extension_graphic_control(
+		struct nsgif_frame *frame,
+		const uint8_t *data,
+		size_t len)
 {
-	if (gif == NULL) {
-		return;
-	}
+	enum {
+		GIF_MASK_TRANSPARENCY = 0x01,
+		GIF_MASK_DISPOSAL     = 0x1c,
+	};
 
-	/* Release all our memory blocks */
-	if (gif->frame_image) {
-		assert(gif->bitmap.destroy);
-		gif->bitmap.destroy(gif->frame_image);
-		gif->frame_image = NULL;
+	/* 6-byte Graphic Control Extension is:
+	 *
+	 *  +0  CHAR    Graphic Control Label
+	 *  +1  CHAR    Block Size
+	 *  +2  CHAR    __Packed Fields__
+	 *              3BITS   Reserved
+	 *              3BITS   Disposal Method
+	 *              1BIT    User Input Flag
+	 *              1BIT    Transparent Color Flag
+	 *  +3  SHORT   Delay Time
+	 *  +5  CHAR    Transparent Color Index
+	 */
+	if (len < 6) {
+		return NSGIF_ERR_END_OF_DATA;
 	}
 
-	free(gif->frames);
-	gif->frames = NULL;
+	frame->info.delay = data[3] | (data[4] << 8);
 
-	free(gif->prev_frame);
-	gif->prev_frame = NULL;
+	if (data[2] & GIF_MASK_TRANSPARENCY) {
+		frame->info.transparency = true;
+		frame->transparency_index = data[5];
+	}
 
-	lzw_context_destroy(gif->lzw_ctx);
-	gif->lzw_ctx = NULL;
+	frame->info.disposal = ((data[2] & GIF_MASK_DISPOSAL) >> 2);
+	/* I have encountered documentation and GIFs in the
+	 * wild that use 0x04 to restore the previous frame,
+	 * rather than the officially documented 0x03.  I
+	 * believe some (older?)  software may even actually
+	 * export this way.  We handle this as a type of
+	 * "quirks" mode. */
+	if (frame->info.disposal == NSGIF_DISPOSAL_RESTORE_QUIRK) {
+		frame->info.disposal = NSGIF_DISPOSAL_RESTORE_PREV;
+	}
 
-	free(gif);
+	/* if we are clearing the background then we need to
+	 * redraw enough to cover the previous frame too. */
+	frame->redraw_required =
+			frame->info.disposal == NSGIF_DISPOSAL_RESTORE_BG ||
+			frame->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV;
+
+	return NSGIF_OK;
 }
 
 /**
- * Check whether the host is little endian.
- *
- * Checks whether least significant bit is in the first byte of a `uint16_t`.
+ * Check an app ext identifier and authentication code for loop count extension.
  *
- * \return true if host is little endian.
+ * \param[in] data  The data to decode.
+ * \param[in] len   Byte length of data.
+ * \return true if extension is a loop count extension.
  */
-static inline bool nsgif__host_is_little_endian(void)
+static bool nsgif__app_ext_is_loop_count(
+		const uint8_t *data,
+		size_t len)
 {
-	const uint16_t test = 1;
+	enum {
+		EXT_LOOP_COUNT_BLOCK_SIZE = 0x0b,
+	};
 
-	return ((const uint8_t *) &test)[0];
+	assert(len > 13);
+	(void)(len);
+
+	if (data[1] == EXT_LOOP_COUNT_BLOCK_SIZE) {
+		if (strncmp((const char *)data + 2, "NETSCAPE2.0", 11) == 0 ||
+		    strncmp((const char *)data + 2, "ANIMEXTS1.0", 11) == 0) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
-static struct nsgif_colour_layout nsgif__bitmap_fmt_to_colour_layout(
-		nsgif_bitmap_fmt_t bitmap_fmt)
+/**
+ * Check an app ext identifier and authentication code for ICC profile.
+ *
+ * \param[in] data  The data to decode.
+ * \param[in] len   Byte length of data.
+ * \return true if extension is an ICC colour profile extension.
+ */
+static bool nsgif__app_ext_is_icc_profile(
+		const uint8_t *data,
+		size_t len)
 {
-	bool le = nsgif__host_is_little_endian();
+	enum {
+		EXT_ICC_PROFILE_BLOCK_SIZE = 0x0b,
+	};
 
-	/* Map endian-dependant formats to byte-wise format for the host. */
-	switch (bitmap_fmt) {
-	case NSGIF_BITMAP_FMT_RGBA8888:
-		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_A8B8G8R8
-		                  : NSGIF_BITMAP_FMT_R8G8B8A8;
-		break;
-	case NSGIF_BITMAP_FMT_BGRA8888:
-		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_A8R8G8B8
-		                  : NSGIF_BITMAP_FMT_B8G8R8A8;
-		break;
-	case NSGIF_BITMAP_FMT_ARGB8888:
-		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_B8G8R8A8
-		                  : NSGIF_BITMAP_FMT_A8R8G8B8;
-		break;
-	case NSGIF_BITMAP_FMT_ABGR8888:
-		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_R8G8B8A8
-		                  : NSGIF_BITMAP_FMT_A8B8G8R8;
-		break;
-	default:
-		break;
+	assert(len > 13);
+	(void)(len);
+
+	if (data[1] == EXT_ICC_PROFILE_BLOCK_SIZE) {
+		if (strncmp((const char *)data + 2, "ICCRGBG1012", 11) == 0) {
+			return true;
+		}
 	}
 
-	/* Set up colour component order for bitmap format. */
-	switch (bitmap_fmt) {
-	default:
-		/* Fall through. */
-	case NSGIF_BITMAP_FMT_R8G8B8A8:
-		return (struct nsgif_colour_layout) {
-			.r = 0,
-			.g = 1,
-			.b = 2,
-			.a = 3,
-		};
+	return false;
+}
 
-	case NSGIF_BITMAP_FMT_B8G8R8A8:
-		return (struct nsgif_colour_layout) {
-			.b = 0,
-			.g = 1,
-			.r = 2,
-			.a = 3,
-		};
+/**
+ * Parse the application extension
+ *
+ * \param[in] gif   The gif object we're decoding.
+ * \param[in] data  The data to decode.
+ * \param[in] len   Byte length of data.
+ * \return NSGIF_ERR_END_OF_DATA if more data is needed,
+ *         NSGIF_OK for success.
+ */
+static nsgif_error nsgif__parse_extension_application(
+		struct nsgif *gif,
+		const uint8_t *data,
+		size_t len)
+{
+	/* 14-byte+ Application Extension is:
+	 *
+	 *  +0    CHAR    Application Extension Label
+	 *  +1    CHAR    Block Size
+	 *  +2    8CHARS  Application Identifier
+	 *  +10   3CHARS  Appl. Authentication Code
+	 *  +13   1-256   Application Data (Data sub-blocks)
+	 */
+	if (len < 17) {
+		return NSGIF_ERR_END_OF_DATA;
+	}
 
-	case NSGIF_BITMAP_FMT_A8R8G8B8:
-		return (struct nsgif_colour_layout) {
-			.a = 0,
-			.r = 1,
-			.g = 2,
-			.b = 3,
+	if (nsgif__app_ext_is_loop_count(data, len)) {
+		enum {
+			EXT_LOOP_COUNT_SUB_BLOCK_SIZE = 0x03,
+			EXT_LOOP_COUNT_SUB_BLOCK_ID   = 0x01,
 		};
+		if ((data[13] == EXT_LOOP_COUNT_SUB_BLOCK_SIZE) &&
+		    (data[14] == EXT_LOOP_COUNT_SUB_BLOCK_ID)) {
+			gif->info.loop_max = data[15] | (data[16] << 8);
 
-	case NSGIF_BITMAP_FMT_A8B8G8R8:
-		return (struct nsgif_colour_layout) {
-			.a = 0,
-			.b = 1,
-			.g = 2,
-			.r = 3,
-		};
+			/* The value in the source data means repeat N times
+			 * after the first implied play. A value of zero has
+			 * the special meaning of loop forever. (The only way
+			 * to play the animation once is  not to have this
+			 * extension at all. */
+			if (gif->info.loop_max > 0) {
+				gif->info.loop_max++;
+			}
+		}
+	} else if (nsgif__app_ext_is_icc_profile(data, len)) {
+		if (gif->info.icc_profile == false) {
+			gif->icc_offset = data + 13 - gif->buf;
+			gif->info.icc_profile = true;
+		}
+	}
+
+	return NSGIF_OK;
+}
+
+/**
+ * Add an extension block to the extension index.
+ *
+ * Extensions that have already been indexed are ignored, so frames may be
+ * rescanned.
+ *
+ * \param[in] gif         The gif object we're scanning.
+ * \param[in] frame_idx   The index of the frame the extension precedes.
+ * \param[in] ext         The extension's introducer byte.
+ * \param[in] sub_blocks  The extension's first data sub-block.
+ * \param[in] end         The extension's block terminator.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__extension_index_add(
+		struct nsgif *gif,
+		uint32_t frame_idx,
+		const uint8_t *ext,
+		const uint8_t *sub_blocks,
+		const uint8_t *end)
+{
+	uint32_t count = gif->info.extension_count;
+	size_t offset = ext - gif->buf;
+	nsgif_extension_info_t *info;
+
+	if (count > 0 && gif->extensions[count - 1].offset >= offset) {
+		return NSGIF_OK;
+	}
+
+	if (count == gif->extension_holders) {
+		uint32_t holders = (count == 0) ? 8 : count * 2;
+		nsgif_extension_info_t *temp;
+
+		temp = realloc(gif->extensions, holders * sizeof(*temp));
+		if (temp == NULL) {
+			return NSGIF_ERR_OOM;
+		}
+		gif->extensions = temp;
+		gif->extension_holders = holders;
+	}
+
+	info = &gif->extensions[count];
+	info->label = ext[1];
+	info->frame = frame_idx;
+	info->offset = offset;
+	if (sub_blocks == ext + 2) {
+		/* No header block (comment extension). */
+		info->header_offset = offset + 2;
+		info->header_len = 0;
+	} else {
+		info->header_offset = offset + 3;
+		info->header_len = ext[2];
+	}
+	info->sub_blocks = 0;
+	info->data_len = 0;
+
+	while (sub_blocks < end) {
+		info->sub_blocks++;
+		info->data_len += sub_blocks[0];
+		sub_blocks += sub_blocks[0] + 1;
+	}
+
+	gif->info.extension_count = count + 1;
+	return NSGIF_OK;
+}
+
+/**
+ * Parse the frame's extensions
+ *
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame to parse extensions for.
+ * \param[in] frame_idx  The index of the frame to parse extensions for.
+ * \param[in] pos        Current position in data, updated on exit.
+ * \param[in] decode     Whether to decode or skip over the extension.
+ * \return NSGIF_ERR_END_OF_DATA if more data is needed,
+ *         NSGIF_OK for success.
+ */
+static nsgif_error nsgif__parse_frame_extensions(
+		struct nsgif *gif,
+		struct nsgif_frame *frame,
+		uint32_t frame_idx,
+		const uint8_t **pos,
+		bool decode)
+{
+	enum {
+		GIF_EXT_INTRODUCER      = 0x21,
+		GIF_EXT_GRAPHIC_CONTROL = 0xf9,
+		GIF_EXT_COMMENT         = 0xfe,
+		GIF_EXT_PLAIN_TEXT      = 0x01,
+		GIF_EXT_APPLICATION     = 0xff,
+	};
+	const uint8_t *nsgif_data = *pos;
+	const uint8_t *nsgif_end = gif->buf + nsgif__frame_data_len(gif, frame);
+	int nsgif_bytes = nsgif_end - nsgif_data;
+
+	/* Initialise the extensions */
+	while (nsgif_bytes > 0 && nsgif_data[0] == GIF_EXT_INTRODUCER) {
+		const uint8_t *ext = nsgif_data;
+		const uint8_t *sub_blocks;
+		bool block_step = true;
+		nsgif_error ret;
+
+		nsgif_data++;
+		nsgif_bytes--;
+
+		if (nsgif_bytes == 0) {
+			return NSGIF_ERR_END_OF_DATA;
+		}
+
+		/* Switch on extension label */
+		switch (nsgif_data[0]) {
+		case GIF_EXT_GRAPHIC_CONTROL:
+			if (decode) {
+				ret = nsgif__parse_extension_graphic_control(
+						frame,
+						nsgif_data,
+						nsgif_bytes);
+				if (ret != NSGIF_OK) {
+					return ret;
+				}
+			}
+			break;
+
+		case GIF_EXT_APPLICATION:
+			if (decode) {
+				ret = nsgif__parse_extension_application(
+						gif, nsgif_data, nsgif_bytes);
+				if (ret != NSGIF_OK) {
+					return ret;
+				}
+			}
+			break;
+
+		case GIF_EXT_COMMENT:
+			/* Move the pointer to the first data sub-block Skip 1
+			 * byte for the extension label. */
+			++nsgif_data;
+			block_step = false;
+			break;
+
+		default:
+			break;
+		}
+
+		if (block_step) {
+			/* Move the pointer to the first data sub-block Skip 2
+			 * bytes for the extension label and size fields Skip
+			 * the extension size itself
+			 */
+			if (nsgif_bytes < 2) {
+				return NSGIF_ERR_END_OF_DATA;
+			}
+			nsgif_data += 2 + nsgif_data[1];
+		}
+
+		/* Repeatedly skip blocks until we get a zero block or run out
+		 * of data.  This data is ignored by this gif decoder. */
+		sub_blocks = nsgif_data;
+		while (nsgif_data < nsgif_end && nsgif_data[0] != NSGIF_BLOCK_TERMINATOR) {
+			nsgif_data += nsgif_data[0] + 1;
+			if (nsgif_data >= nsgif_end) {
+				return NSGIF_ERR_END_OF_DATA;
+			}
+		}
+
+		if (decode && gif->extension_index && nsgif_data < nsgif_end) {
+			ret = nsgif__extension_index_add(gif, frame_idx,
+					ext, sub_blocks, nsgif_data);
+			if (ret != NSGIF_OK) {
+				return ret;
+			}
+		}
+		nsgif_data++;
+		nsgif_bytes = nsgif_end - nsgif_data;
+	}
+
+	if (nsgif_data > nsgif_end) {
+		nsgif_data = nsgif_end;
+	}
+
+	/* Set buffer position and return */
+	*pos = nsgif_data;
+	return NSGIF_OK;
+}
+
+/**
+ * Parse a GIF Image Descriptor.
+ *
+ * The format is:
+ *
+ *  +0   CHAR   Image Separator (0x2c)
+ *  +1   SHORT  Image Left Position
+ *  +3   SHORT  Image Top Position
+ *  +5   SHORT  Width
+ *  +7   SHORT  Height
+ *  +9   CHAR   __Packed Fields__
+ *              1BIT    Local Colour Table Flag
+ *              1BIT    Interlace Flag
+ *              1BIT    Sort Flag
+ *              2BITS   Reserved
+ *              3BITS   Size of Local Colour Table
+ *
+ * \param[in] gif     The gif object we're decoding.
+ * \param[in] frame   The frame to parse an image descriptor for.
+ * \param[in] pos     Current position in data, updated on exit.
+ * \param[in] decode  Whether to decode the image descriptor.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__parse_image_descriptor(
+		struct nsgif *gif,
+		struct nsgif_frame *frame,
+		const uint8_t **pos,
+		bool decode)
+{
+	const uint8_t *data = *pos;
+	size_t len = gif->buf + nsgif__frame_data_len(gif, frame) - data;
+	enum {
+		NSGIF_IMAGE_DESCRIPTOR_LEN = 10u,
+		NSGIF_IMAGE_SEPARATOR      = 0x2Cu,
+		NSGIF_MASK_INTERLACE       = 0x40u,
+	};
+
+	assert(gif != NULL);
+	assert(frame != NULL);
+
+	if (len < NSGIF_IMAGE_DESCRIPTOR_LEN) {
+		return NSGIF_ERR_END_OF_DATA;
+	}
+
+	if (decode) {
+		uint32_t x, y, w, h;
+
+		if (data[0] != NSGIF_IMAGE_SEPARATOR) {
+			return NSGIF_ERR_DATA_FRAME;
+		}
+
+		x = data[1] | (data[2] << 8);
+		y = data[3] | (data[4] << 8);
+		w = data[5] | (data[6] << 8);
+		h = data[7] | (data[8] << 8);
+		frame->flags = data[9];
+
+		frame->info.rect.x0 = x;
+		frame->info.rect.y0 = y;
+		frame->info.rect.x1 = x + w;
+		frame->info.rect.y1 = y + h;
+
+		frame->info.interlaced = frame->flags & NSGIF_MASK_INTERLACE;
+
+		/* Allow first frame to grow image dimensions. */
+		if (gif->info.frame_count == 0) {
+			if (x + w > gif->info.width) {
+				gif->info.width = x + w;
+			}
+			if (y + h > gif->info.height) {
+				gif->info.height = y + h;
+			}
+		}
+	}
+
+	*pos += NSGIF_IMAGE_DESCRIPTOR_LEN;
+	return NSGIF_OK;
+}
+
+/**
+ * Extract a GIF colour table into a LibNSGIF colour table buffer.
+ *
+ * Any client colour transform is applied to the extracted colours.
+ *
+ * \param[in] gif                   The gif object we're decoding.
+ * \param[in] colour_table          The colour table to populate.
+ * \param[in] colour_table_entries  The number of colour table entries.
+ * \param[in] data                  Raw colour table data.
+ */
+static void nsgif__colour_table_decode(
+		const struct nsgif *gif,
+		uint32_t colour_table[NSGIF_MAX_COLOURS],
+		size_t colour_table_entries,
+		const uint8_t *data)
+{
+	const struct nsgif_colour_layout *layout = &gif->colour_layout;
+	uint8_t *entry = (uint8_t *)colour_table;
+	size_t entries = colour_table_entries;
+
+	while (colour_table_entries--) {
+		/* Gif colour map contents are r,g,b.
+		 *
+		 * We want to pack them bytewise into the colour table,
+		 * according to the client colour layout.
+		 */
+
+		entry[layout->r] = *data++;
+		entry[layout->g] = *data++;
+		entry[layout->b] = *data++;
+		entry[layout->a] = 0xff;
+
+		entry += sizeof(uint32_t);
+	}
+
+	if (gif->colour_transform != NULL) {
+		gif->colour_transform(gif->colour_transform_pw,
+				colour_table, entries);
+	}
+}
+
+/**
+ * Extract a GIF colour table into a LibNSGIF colour table buffer.
+ *
+ * \param[in]  gif                   The gif object we're decoding.
+ * \param[in]  colour_table          The colour table to populate.
+ * \param[in]  colour_table_entries  The number of colour table entries.
+ * \param[in]  data                  Current position in data.
+ * \param[in]  data_len              The available length of `data`.
+ * \param[out] used                  Number of colour table bytes read.
+ * \param[in]  decode                Whether to decode the colour table.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static inline nsgif_error nsgif__colour_table_extract(
+		const struct nsgif *gif,
+		uint32_t colour_table[NSGIF_MAX_COLOURS],
+		size_t colour_table_entries,
+		const uint8_t *data,
+		size_t data_len,
+		size_t *used,
+		bool decode)
+{
+	if (data_len < colour_table_entries * 3) {
+		return NSGIF_ERR_END_OF_DATA;
+	}
+
+	if (decode) {
+		nsgif__colour_table_decode(gif, colour_table,
+				colour_table_entries, data);
+	}
+
+	*used = colour_table_entries * 3;
+	return NSGIF_OK;
+}
+
+/**
+ * Get a decoded local colour table for a frame from the colour table cache.
+ *
+ * Frames with identical colour tables share a cached table, and a table
+ * identical to the global colour table resolves to the global colour table.
+ *
+ * \param[in] gif      The gif object we're decoding.
+ * \param[in] frame    The frame to get the colour table for.
+ * \param[in] entries  The number of colour table entries.
+ * \return the decoded colour table, or NULL if it can't be cached.
+ */
+static uint32_t *nsgif__colour_table_cached(
+		struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		uint32_t entries)
+{
+	const uint8_t *data = gif->buf + frame->colour_table_offset;
+	size_t len = entries * 3;
+	struct nsgif_palette *palette;
+	uint64_t hash;
+
+	if (frame->colour_table_offset + len >
+			nsgif__frame_data_len(gif, frame)) {
+		return NULL;
+	}
+
+	if (gif->info.global_palette &&
+	    gif->colour_table_size == entries &&
+	    memcmp(gif->buf + gif->colour_table_offset, data, len) == 0) {
+		return gif->global_colour_table;
+	}
+
+	hash = nsgif__hash(NSGIF_HASH_INIT, data, len);
+	for (palette = gif->palettes; palette; palette = palette->next) {
+		if (palette->hash == hash && palette->entries == entries &&
+		    memcmp(gif->buf + palette->offset, data, len) == 0) {
+			return palette->table;
+		}
+	}
+
+	if (gif->palette_count >= NSGIF_PALETTE_CACHE_MAX) {
+		return NULL;
+	}
+
+	palette = calloc(1, sizeof(*palette));
+	if (palette == NULL) {
+		return NULL;
+	}
+
+	nsgif__colour_table_decode(gif, palette->table, entries, data);
+	palette->hash = hash;
+	palette->offset = frame->colour_table_offset;
+	palette->entries = entries;
+
+	palette->next = gif->palettes;
+	gif->palettes = palette;
+	gif->palette_count++;
+
+	return palette->table;
+}
+
+/**
+ * Empty the colour table cache.
+ *
+ * \param[in] gif  The gif object.
+ */
+static void nsgif__colour_table_cache_clear(
+		struct nsgif *gif)
+{
+	struct nsgif_palette *palette = gif->palettes;
+
+	while (palette != NULL) {
+		struct nsgif_palette *next = palette->next;
+		free(palette);
+		palette = next;
+	}
+	gif->palettes = NULL;
+	gif->palette_count = 0;
+
+	for (uint32_t f = 0; f < gif->frame_holders; f++) {
+		nsgif__frame(gif, f)->colour_table = NULL;
+	}
+}
+
+/**
+ * Free all frames' colour statistics.
+ *
+ * \param[in] gif  The gif object.
+ */
+static void nsgif__colour_stats_clear(
+		struct nsgif *gif)
+{
+	for (uint32_t f = 0; f < gif->frame_holders; f++) {
+		free(nsgif__frame(gif, f)->colour_stats);
+		nsgif__frame(gif, f)->colour_stats = NULL;
+	}
+}
+
+/**
+ * Get a frame's colour table.
+ *
+ * Sets up gif->colour_table for the frame.
+ *
+ * \param[in] gif     The gif object we're decoding.
+ * \param[in] frame   The frame to get the colour table for.
+ * \param[in] pos     Current position in data, updated on exit.
+ * \param[in] decode  Whether to decode the colour table.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__parse_colour_table(
+		struct nsgif *gif,
+		struct nsgif_frame *frame,
+		const uint8_t **pos,
+		bool decode)
+{
+	nsgif_error ret;
+	const uint8_t *data = *pos;
+	size_t len = gif->buf + nsgif__frame_data_len(gif, frame) - data;
+	uint32_t entries;
+	size_t used_bytes;
+
+	assert(gif != NULL);
+	assert(frame != NULL);
+
+	if ((frame->flags & NSGIF_COLOUR_TABLE_MASK) == 0) {
+		if (decode) {
+			gif->colour_table = gif->global_colour_table;
+		}
+		return NSGIF_OK;
+	}
+
+	entries = 2 << (frame->flags & NSGIF_COLOUR_TABLE_SIZE_MASK);
+
+	if (decode == false) {
+		frame->colour_table_offset = *pos - gif->buf;
+
+	} else {
+		/* Avoid converting the colour table every time the frame is
+		 * decoded, if we can. */
+		if (frame->colour_table == NULL) {
+			frame->colour_table = nsgif__colour_table_cached(
+					gif, frame, entries);
+		}
+		if (frame->colour_table != NULL) {
+			*pos += entries * 3;
+			gif->colour_table = frame->colour_table;
+			return NSGIF_OK;
+		}
+	}
+
+	ret = nsgif__colour_table_extract(gif,
+			gif->local_colour_table, entries,
+			data, len, &used_bytes, decode);
+	if (ret != NSGIF_OK) {
+		return ret;
+	}
+	*pos += used_bytes;
+
+	if (decode) {
+		gif->colour_table = gif->local_colour_table;
+	} else {
+		frame->info.local_palette = true;
+	}
+
+	return NSGIF_OK;
+}
+
+/**
+ * Parse the image data for a gif frame.
+ *
+ * Sets up gif->colour_table for the frame.
+ *
+ * \param[in] gif        The gif object we're decoding.
+ * \param[in] frame      The frame to parse image data for.
+ * \param[in] frame_idx  The index of the frame to parse image data for.
+ * \param[in] pos        Current position in data, updated on exit.
+ * \param[in] decode     Whether to decode the image data.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__parse_image_data(
+		struct nsgif *gif,
+		struct nsgif_frame *frame,
+		uint32_t frame_idx,
+		const uint8_t **pos,
+		bool decode)
+{
+	const uint8_t *data = *pos;
+	size_t len = gif->buf + nsgif__frame_data_len(gif, frame) - data;
+	uint8_t minimum_code_size;
+	nsgif_error ret;
+
+	assert(gif != NULL);
+	assert(frame != NULL);
+
+	if (!decode) {
+		gif->frame_count_partial = frame_idx + 1;
+	}
+
+	/* Ensure sufficient data remains.  A gif trailer or a minimum lzw code
+	 * followed by a gif trailer is treated as OK, although without any
+	 * image data. */
+	switch (len) {
+		default: if (data[0] == NSGIF_TRAILER) return NSGIF_OK;
+			break;
+		case 2: if (data[1] == NSGIF_TRAILER) return NSGIF_OK;
+			/* Fall through. */
+		case 1: if (data[0] == NSGIF_TRAILER) return NSGIF_OK;
+			/* Fall through. */
+		case 0: return NSGIF_ERR_END_OF_DATA;
+	}
+
+	minimum_code_size = data[0];
+	if (minimum_code_size >= LZW_CODE_MAX) {
+		return NSGIF_ERR_DATA_FRAME;
+	}
+
+	if (decode) {
+		ret = nsgif__update_bitmap(gif, frame, data, frame_idx);
+	} else {
+		uint32_t block_size = 0;
+
+		/* Skip the minimum code size. */
+		data++;
+		len--;
+
+		/* We may be rescanning a frame that was previously truncated. */
+		frame->lzw_data_length = 0;
+
+		while (block_size != 1) {
+			if (len < 1) {
+				return NSGIF_ERR_END_OF_DATA;
+			}
+			block_size = data[0] + 1;
+			/* Check if the frame data runs off the end of the file */
+			if (block_size > len) {
+				frame->lzw_data_length += len;
+				return NSGIF_ERR_END_OF_DATA;
+			}
+
+			len -= block_size;
+			data += block_size;
+			frame->lzw_data_length += block_size;
+		}
+
+		*pos = data;
+
+		gif->info.frame_count = frame_idx + 1;
+		nsgif__frame(gif, frame_idx)->info.display = true;
+
+		return NSGIF_OK;
+	}
+
+	return ret;
+}
+
+/**
+ * Hash a frame's image data.
+ *
+ * The hash covers the image descriptor, any local colour table, the LZW
+ * data, and the transparent colour index, which are everything that
+ * determine how the frame is drawn.
+ *
+ * \param[in] frame  The frame to hash.
+ * \param[in] image  The frame's image descriptor.
+ * \param[in] len    Length of the image descriptor, colour table and data.
+ */
+static void nsgif__frame_hash(
+		struct nsgif_frame *frame,
+		const uint8_t *image,
+		size_t len)
+{
+	uint32_t index = frame->transparency_index;
+	uint8_t transparency[4] = {
+		index & 0xff,
+		(index >> 8) & 0xff,
+		(index >> 16) & 0xff,
+		(index >> 24) & 0xff,
+	};
+	uint64_t hash;
+
+	hash = nsgif__hash(NSGIF_HASH_INIT, image, len);
+	hash = nsgif__hash(hash, transparency, sizeof(transparency));
+
+	/* Zero means no hash. */
+	frame->info.hash = (hash != 0) ? hash : 1;
+}
+
+/**
+ * Get a frame to scan, allocating it if it's new.
+ *
+ * Frames are allocated in blocks which never move, so frames that have been
+ * scanned may be decoded on another thread while later frames are added.
+ *
+ * \param[in] gif        The gif object.
+ * \param[in] frame_idx  The index of the frame, at most the frame count.
+ * \return the frame, or NULL on memory exhaustion.
+ */
+static struct nsgif_frame *nsgif__get_frame(
+		struct nsgif *gif,
+		uint32_t frame_idx)
+{
+	struct nsgif_frame *frame;
+
+	if (gif->frame_holders > frame_idx) {
+		frame = nsgif__frame(gif, frame_idx);
+	} else {
+		uint32_t block = nsgif__frame_block(frame_idx);
+		size_t count = (size_t)NSGIF_FRAME_BLOCK << block;
+
+		if (block >= NSGIF_FRAME_BLOCKS ||
+		    count > SIZE_MAX / sizeof(*frame)) {
+			return NULL;
+		}
+
+		/* Allocate more memory */
+		if (gif->frames[block] == NULL) {
+			gif->frames[block] = malloc(count * sizeof(*frame));
+			if (gif->frames[block] == NULL) {
+				return NULL;
+			}
+		}
+		gif->frame_holders = frame_idx + 1;
+
+		frame = nsgif__frame(gif, frame_idx);
+
+		frame->info.local_palette = false;
+		frame->info.transparency = false;
+		frame->info.display = false;
+		frame->info.disposal = 0;
+		frame->info.delay = 10;
+		frame->info.hash = 0;
+		frame->info.duplicate = false;
+
+		frame->transparency_index = NSGIF_NO_TRANSPARENCY;
+		frame->frame_offset = gif->buf_pos;
+		frame->data_len = 0;
+		frame->redraw_required = false;
+		frame->lzw_data_length = 0;
+		frame->decoded = false;
+		frame->plan = 0;
+		frame->colour_table = NULL;
+		frame->colour_stats = NULL;
+	}
+
+	return frame;
+}
+
+/**
+ * Attempts to initialise the next frame
+ *
+ * \param[in] gif       The animation context
+ * \param[in] frame_idx The frame number to decode.
+ * \param[in] decode    Whether to decode the graphical image data.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+*/
+static nsgif_error nsgif__process_frame(
+		struct nsgif *gif,
+		uint32_t frame_idx,
+		bool decode)
+{
+	nsgif_error ret;
+	const uint8_t *pos;
+	const uint8_t *end;
+	const uint8_t *image;
+	struct nsgif_frame *frame;
+
+	if (decode) {
+		/* Only frames that have been scanned are decoded, and they
+		 * are left alone by any scan running alongside. */
+		frame = nsgif__frame(gif, frame_idx);
+		pos = gif->buf + frame->frame_offset;
+
+		/* Ensure this frame is supposed to be decoded */
+		if (frame->info.display == false) {
+			return NSGIF_OK;
+		}
+
+		/* Done if frame is already decoded */
+		if (frame_idx == gif->decoded_frame) {
+			return NSGIF_OK;
+		}
+	} else {
+		frame = nsgif__get_frame(gif, frame_idx);
+		if (frame == NULL) {
+			return NSGIF_ERR_OOM;
+		}
+
+		pos = gif->buf + gif->buf_pos;
+		end = gif->buf + gif->buf_len;
+
+		/* Check if we've finished */
+		if (pos < end && pos[0] == NSGIF_TRAILER) {
+			return NSGIF_OK;
+		}
+	}
+
+	ret = nsgif__parse_frame_extensions(gif, frame, frame_idx,
+			&pos, !decode);
+	if (ret != NSGIF_OK) {
+		goto cleanup;
+	}
+
+	image = pos;
+	ret = nsgif__parse_image_descriptor(gif, frame, &pos, !decode);
+	if (ret != NSGIF_OK) {
+		goto cleanup;
+	}
+
+	ret = nsgif__parse_colour_table(gif, frame, &pos, decode);
+	if (ret != NSGIF_OK) {
+		goto cleanup;
+	}
+
+	ret = nsgif__parse_image_data(gif, frame, frame_idx, &pos, decode);
+	if (ret != NSGIF_OK) {
+		goto cleanup;
+	}
+
+	if (!decode && gif->frame_hashing && frame->info.display) {
+		nsgif__frame_hash(frame, image, pos - image);
+		frame->info.duplicate = nsgif__frame_is_repeat_of_prev(
+				gif, frame, frame_idx);
+	}
+
+	if (!decode) {
+		frame->data_len = gif->buf_len;
+		nsgif__frame_plan(gif, frame_idx);
+	}
+
+cleanup:
+	if (!decode) {
+		if (ret == NSGIF_ERR_END_OF_DATA) {
+			/* Rescan the whole frame when there is more data. */
+			gif->buf_pos = frame->frame_offset;
+		} else {
+			gif->buf_pos = pos - gif->buf;
+		}
+	}
+
+	return ret;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_destroy(nsgif_t *gif)
+{
+	if (gif == NULL) {
+		return;
+	}
+
+	/* Release all our memory blocks */
+	if (gif->frame_image) {
+		assert(gif->bitmap.destroy);
+		gif->bitmap.destroy(gif->frame_image);
+		gif->frame_image = NULL;
+	}
+
+	nsgif__colour_table_cache_clear(gif);
+	nsgif__colour_stats_clear(gif);
+
+	for (uint32_t b = 0; b < NSGIF_FRAME_BLOCKS; b++) {
+		free(gif->frames[b]);
+		gif->frames[b] = NULL;
+	}
+
+	free(gif->prev_frame);
+	gif->prev_frame = NULL;
+	gif->prev_frame_size = 0;
+
+	free(gif->extensions);
+	gif->extensions = NULL;
+
+	free(gif->damage_rows);
+	gif->damage_rows = NULL;
+
+	free(gif->index_canvas);
+	gif->index_canvas = NULL;
+
+	nsgif__checkpoints_free(gif);
+
+	lzw_context_destroy(gif->lzw_ctx);
+	gif->lzw_ctx = NULL;
+
+	free(gif);
+}
+
+/**
+ * Check whether the host is little endian.
+ *
+ * Checks whether least significant bit is in the first byte of a `uint16_t`.
+ *
+ * \return true if host is little endian.
+ */
+static inline bool nsgif__host_is_little_endian(void)
+{
+	const uint16_t test = 1;
+
+	return ((const uint8_t *) &test)[0];
+}
+
+static struct nsgif_colour_layout nsgif__bitmap_fmt_to_colour_layout(
+		nsgif_bitmap_fmt_t bitmap_fmt)
+{
+	bool le = nsgif__host_is_little_endian();
+
+	/* Map endian-dependant formats to byte-wise format for the host. */
+	switch (bitmap_fmt) {
+	case NSGIF_BITMAP_FMT_RGBA8888:
+		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_A8B8G8R8
+		                  : NSGIF_BITMAP_FMT_R8G8B8A8;
+		break;
+	case NSGIF_BITMAP_FMT_BGRA8888:
+		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_A8R8G8B8
+		                  : NSGIF_BITMAP_FMT_B8G8R8A8;
+		break;
+	case NSGIF_BITMAP_FMT_ARGB8888:
+		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_B8G8R8A8
+		                  : NSGIF_BITMAP_FMT_A8R8G8B8;
+		break;
+	case NSGIF_BITMAP_FMT_ABGR8888:
+		bitmap_fmt = (le) ? NSGIF_BITMAP_FMT_R8G8B8A8
+		                  : NSGIF_BITMAP_FMT_A8B8G8R8;
+		break;
+	default:
+		break;
+	}
+
+	/* Set up colour component order for bitmap format. */
+	switch (bitmap_fmt) {
+	default:
+		/* Fall through. */
+	case NSGIF_BITMAP_FMT_R8G8B8A8:
+		return (struct nsgif_colour_layout) {
+			.r = 0,
+			.g = 1,
+			.b = 2,
+			.a = 3,
+		};
+
+	case NSGIF_BITMAP_FMT_B8G8R8A8:
+		return (struct nsgif_colour_layout) {
+			.b = 0,
+			.g = 1,
+			.r = 2,
+			.a = 3,
+		};
+
+	case NSGIF_BITMAP_FMT_A8R8G8B8:
+		return (struct nsgif_colour_layout) {
+			.a = 0,
+			.r = 1,
+			.g = 2,
+			.b = 3,
+		};
+
+	case NSGIF_BITMAP_FMT_A8B8G8R8:
+		return (struct nsgif_colour_layout) {
+			.a = 0,
+			.b = 1,
+			.g = 2,
+			.r = 3,
+		};
+	}
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_create(
+		const nsgif_bitmap_cb_vt *bitmap_vt,
+		nsgif_bitmap_fmt_t bitmap_fmt,
+		nsgif_t **gif_out)
+{
+	nsgif_t *gif;
+
+	gif = calloc(1, sizeof(*gif));
+	if (gif == NULL) {
+		return NSGIF_ERR_OOM;
+	}
+
+	gif->bitmap = *bitmap_vt;
+	gif->decoded_frame = NSGIF_FRAME_INVALID;
+	gif->prev_index = NSGIF_FRAME_INVALID;
+
+	gif->delay_min = NSGIF_FRAME_DELAY_MIN;
+	gif->delay_default = NSGIF_FRAME_DELAY_DEFAULT;
+
+	gif->scan_limit = NSGIF_INFINITE;
+
+	gif->colour_layout = nsgif__bitmap_fmt_to_colour_layout(bitmap_fmt);
+
+	*gif_out = gif;
+	return NSGIF_OK;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_frame_delay_behaviour(
+		nsgif_t *gif,
+		uint16_t delay_min,
+		uint16_t delay_default)
+{
+	gif->delay_min = delay_min;
+	gif->delay_default = delay_default;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_frame_hashing(
+		nsgif_t *gif,
+		bool enable)
+{
+	gif->frame_hashing = enable;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_duplicate_merging(
+		nsgif_t *gif,
+		bool enable)
+{
+	gif->merge_duplicates = enable;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_zero_delay_coalescing(
+		nsgif_t *gif,
+		bool enable)
+{
+	gif->coalesce_zero_delay = enable;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_frame_decimation(
+		nsgif_t *gif,
+		uint32_t interval)
+{
+	gif->decimation = interval;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_playback(
+		nsgif_t *gif,
+		nsgif_playback playback)
+{
+	gif->playback = playback;
+	gif->reverse = false;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_checkpoint_budget(
+		nsgif_t *gif,
+		size_t budget)
+{
+	nsgif__checkpoints_free(gif);
+	gif->checkpoint_budget = budget;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_colour_stats(
+		nsgif_t *gif,
+		bool enable)
+{
+	gif->colour_stats = enable;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_damage_tracking(
+		nsgif_t *gif,
+		bool enable)
+{
+	gif->damage_tracking = enable;
+	gif->damage = (nsgif_rect_t) { 0 };
+
+	if (!enable) {
+		free(gif->damage_rows);
+		gif->damage_rows = NULL;
+	}
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_extension_index(
+		nsgif_t *gif,
+		bool enable)
+{
+	gif->extension_index = enable;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_scan_limit(
+		nsgif_t *gif,
+		uint32_t frame_limit)
+{
+	gif->scan_limit = frame_limit;
+}
+
+/**
+ * Read GIF header.
+ *
+ * 6-byte GIF file header is:
+ *
+ *  +0   3CHARS   Signature ('GIF')
+ *  +3   3CHARS   Version ('87a' or '89a')
+ *
+ * \param[in]      gif     The GIF object we're decoding.
+ * \param[in,out]  pos     The current buffer position, updated on success.
+ * \param[in]      strict  Whether to require a known GIF version.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__parse_header(
+		struct nsgif *gif,
+		const uint8_t **pos,
+		bool strict)
+{
+	const uint8_t *data = *pos;
+	size_t len = gif->buf + gif->buf_len - data;
+
+	if (len < 6) {
+		return NSGIF_ERR_END_OF_DATA;
+	}
+
+	if (strncmp((const char *) data, "GIF", 3) != 0) {
+		return NSGIF_ERR_DATA;
+	}
+	data += 3;
+
+	if (strict == true) {
+		if ((strncmp((const char *) data, "87a", 3) != 0) &&
+		    (strncmp((const char *) data, "89a", 3) != 0)) {
+			return NSGIF_ERR_DATA;
+		}
+	}
+	data += 3;
+
+	*pos = data;
+	return NSGIF_OK;
+}
+
+/**
+ * Read Logical Screen Descriptor.
+ *
+ * 7-byte Logical Screen Descriptor is:
+ *
+ *  +0   SHORT   Logical Screen Width
+ *  +2   SHORT   Logical Screen Height
+ *  +4   CHAR    __Packed Fields__
+ *               1BIT    Global Colour Table Flag
+ *               3BITS   Colour Resolution
+ *               1BIT    Sort Flag
+ *               3BITS   Size of Global Colour Table
+ *  +5   CHAR    Background Colour Index
+ *  +6   CHAR    Pixel Aspect Ratio
+ *
+ * \param[in]      gif     The GIF object we're decoding.
+ * \param[in,out]  pos     The current buffer position, updated on success.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__parse_logical_screen_descriptor(
+		struct nsgif *gif,
+		const uint8_t **pos)
+{
+	const uint8_t *data = *pos;
+	size_t len = gif->buf + gif->buf_len - data;
+
+	if (len < 7) {
+		return NSGIF_ERR_END_OF_DATA;
+	}
+
+	gif->info.width = data[0] | (data[1] << 8);
+	gif->info.height = data[2] | (data[3] << 8);
+	gif->info.global_palette = data[4] & NSGIF_COLOUR_TABLE_MASK;
+	gif->colour_table_size = 2 << (data[4] & NSGIF_COLOUR_TABLE_SIZE_MASK);
+	gif->bg_index = data[5];
+	gif->aspect_ratio = data[6];
+	gif->info.loop_max = 1;
+
+	*pos += 7;
+	return NSGIF_OK;
+}
+
+/**
+ * Set the GIF's background colour from the global colour table.
+ *
+ * \param[in] gif  The GIF object.
+ */
+static void nsgif__background_update(
+		struct nsgif *gif)
+{
+	if (gif->info.global_palette &&
+	    gif->bg_index < gif->colour_table_size) {
+		size_t bg_idx = gif->bg_index;
+		gif->info.background = gif->global_colour_table[bg_idx];
+	} else {
+		gif->info.background = gif->global_colour_table[0];
+	}
+}
+
+/**
+ * Publish newly scanned frames, and tell the client about them.
+ *
+ * \param[in] gif    The GIF object.
+ * \param[in] first  The first frame that may be new.
+ */
+static void nsgif__frames_ready(
+		nsgif_t *gif,
+		uint32_t first)
+{
+	/* Everything scanned for the frames goes with the count. */
+	nsgif__publish(&gif->frame_count_ready, gif->info.frame_count);
+
+	if (gif->frame_ready == NULL) {
+		return;
+	}
+
+	for (uint32_t f = first; f < gif->info.frame_count; f++) {
+		gif->frame_ready(gif->frame_ready_pw, f);
+	}
+}
+
+/**
+ * Scan the source data we have been given, up to the scan limit.
+ *
+ * \param[in] gif  The GIF object we're scanning.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__data_scan(
+		nsgif_t *gif)
+{
+	const uint8_t *nsgif_data;
+	const uint8_t *nsgif_end;
+	nsgif_error ret;
+	uint32_t frames;
+
+	/* Get our current processing position */
+	nsgif_data = gif->buf + gif->buf_pos;
+
+	/* See if we should initialise the GIF */
+	if (gif->buf_pos == 0) {
+		/* We want everything to be NULL before we start so we've no
+		 * chance of freeing bad pointers (paranoia)
+		 */
+		gif->frame_image = NULL;
+		memset(gif->frames, 0, sizeof(gif->frames));
+		gif->frame_holders = 0;
+
+		/* The caller may have been lazy and not reset any values */
+		gif->info.frame_count = 0;
+		gif->info.extension_count = 0;
+		gif->info.icc_profile = false;
+		gif->frame_count_partial = 0;
+		gif->frame_count_ready = 0;
+		gif->decoded_frame = NSGIF_FRAME_INVALID;
+		gif->frame = NSGIF_FRAME_INVALID;
+
+		ret = nsgif__parse_header(gif, &nsgif_data, false);
+		if (ret != NSGIF_OK) {
+			return ret;
+		}
+
+		ret = nsgif__parse_logical_screen_descriptor(gif, &nsgif_data);
+		if (ret != NSGIF_OK) {
+			return ret;
+		}
+
+		/* Remember we've done this now */
+		gif->buf_pos = nsgif_data - gif->buf;
+
+		/* Some broken GIFs report the size as the screen size they
+		 * were created in. As such, we detect for the common cases and
+		 * set the sizes as 0 if they are found which results in the
+		 * GIF being the maximum size of the frames.
+		 */
+		if (((gif->info.width == 640) && (gif->info.height == 480)) ||
+		    ((gif->info.width == 640) && (gif->info.height == 512)) ||
+		    ((gif->info.width == 800) && (gif->info.height == 600)) ||
+		    ((gif->info.width == 1024) && (gif->info.height == 768)) ||
+		    ((gif->info.width == 1280) && (gif->info.height == 1024)) ||
+		    ((gif->info.width == 1600) && (gif->info.height == 1200)) ||
+		    ((gif->info.width == 0) || (gif->info.height == 0)) ||
+		    ((gif->info.width > 2048) || (gif->info.height > 2048))) {
+			gif->info.width = 1;
+			gif->info.height = 1;
+		}
+
+		/* Set the first colour to a value that will never occur in
+		 * reality so we know if we've processed it
+		*/
+		gif->global_colour_table[0] = NSGIF_PROCESS_COLOURS;
+
+		/* Check if the GIF has no frame data (13-byte header + 1-byte
+		 * termination block) Although generally useless, the GIF
+		 * specification does not expressly prohibit this
+		 */
+		if (gif->buf_len == gif->buf_pos + 1) {
+			if (nsgif_data[0] == NSGIF_TRAILER) {
+				return NSGIF_OK;
+			}
+		}
+	}
+
+	/*  Do the colour map if we haven't already. As the top byte is always
+	 *  0xff or 0x00 depending on the transparency we know if it's been
+	 *  filled in.
+	 */
+	if (gif->global_colour_table[0] == NSGIF_PROCESS_COLOURS) {
+		/* Check for a global colour map signified by bit 7 */
+		if (gif->info.global_palette) {
+			size_t remaining = gif->buf + gif->buf_len - nsgif_data;
+			size_t used;
+
+			ret = nsgif__colour_table_extract(gif,
+					gif->global_colour_table,
+					gif->colour_table_size,
+					nsgif_data, remaining, &used, true);
+			if (ret != NSGIF_OK) {
+				return ret;
+			}
+
+			gif->colour_table_offset = nsgif_data - gif->buf;
+			nsgif_data += used;
+			gif->buf_pos = (nsgif_data - gif->buf);
+		} else {
+			/* Create a default colour table with the first two
+			 * colours as black and white. */
+			uint8_t *entry = (uint8_t *)gif->global_colour_table;
+
+			/* Black */
+			entry[gif->colour_layout.r] = 0x00;
+			entry[gif->colour_layout.g] = 0x00;
+			entry[gif->colour_layout.b] = 0x00;
+			entry[gif->colour_layout.a] = 0xFF;
+
+			entry += sizeof(uint32_t);
+
+			/* White */
+			entry[gif->colour_layout.r] = 0xFF;
+			entry[gif->colour_layout.g] = 0xFF;
+			entry[gif->colour_layout.b] = 0xFF;
+			entry[gif->colour_layout.a] = 0xFF;
+
+			gif->colour_table_size = 2;
+		}
+
+		nsgif__background_update(gif);
+	}
+
+	if (gif->lzw_ctx == NULL) {
+		lzw_result res = lzw_context_create(
+				(struct lzw_ctx **)&gif->lzw_ctx);
+		if (res != LZW_OK) {
+			return nsgif__error_from_lzw(res);
+		}
+	}
+
+	/* Try to initialise all frames, up to the scan limit. */
+	do {
+		frames = gif->info.frame_count;
+		if (frames >= gif->scan_limit) {
+			ret = NSGIF_OK;
+			break;
+		}
+		ret = nsgif__process_frame(gif, frames, false);
+		nsgif__frames_ready(gif, frames);
+	} while (gif->info.frame_count > frames);
+
+	/* Note whether we stopped early, with more frames to come. */
+	nsgif_data = gif->buf + gif->buf_pos;
+	nsgif_end = gif->buf + gif->buf_len;
+	gif->scan_limited = gif->info.frame_count >= gif->scan_limit &&
+			nsgif_data < nsgif_end && nsgif_data[0] != NSGIF_TRAILER;
+
+	if (ret == NSGIF_ERR_END_OF_DATA && gif->info.frame_count > 0) {
+		ret = NSGIF_OK;
+	}
+
+	return ret;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_colour_transform(
+		nsgif_t *gif,
+		nsgif_colour_transform_cb transform,
+		void *pw)
+{
+	gif->colour_transform = transform;
+	gif->colour_transform_pw = pw;
+
+	if (gif->buf == NULL ||
+	    gif->global_colour_table[0] == NSGIF_PROCESS_COLOURS) {
+		/* Global colour table hasn't been decoded yet. */
+		return;
+	}
+
+	if (gif->info.global_palette) {
+		nsgif__colour_table_decode(gif, gif->global_colour_table,
+				gif->colour_table_size,
+				gif->buf + gif->colour_table_offset);
+		nsgif__background_update(gif);
+	}
+
+	/* Any decoded colour tables and frames used the old colours. */
+	nsgif__colour_table_cache_clear(gif);
+	nsgif__colour_stats_clear(gif);
+	nsgif__checkpoints_free(gif);
+	gif->decoded_frame = NSGIF_FRAME_INVALID;
+	gif->prev_index = NSGIF_FRAME_INVALID;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_parallel(
+		nsgif_t *gif,
+		nsgif_parallel_cb parallel,
+		void *pw,
+		size_t threshold)
+{
+	gif->parallel = parallel;
+	gif->parallel_pw = pw;
+	gif->parallel_threshold = threshold;
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_data_scan(
+		nsgif_t *gif,
+		size_t size,
+		const uint8_t *data)
+{
+	if (gif->data_complete) {
+		return NSGIF_ERR_DATA_COMPLETE;
+	}
+
+	/* Initialize values.  The data pointer is left alone if it hasn't
+	 * moved, as frames may be decoded from it on another thread. */
+	gif->buf_len = size;
+	if (gif->buf != data) {
+		gif->buf = data;
+	}
+
+	return nsgif__data_scan(gif);
+}
+
+/**
+ * Make any truncated final frame displayable.
+ *
+ * Only valid once all the source data has been provided.
+ *
+ * \param[in] gif  The GIF object.
+ */
+static void nsgif__truncated_frame_complete(
+		nsgif_t *gif)
+{
+	uint32_t start = gif->info.frame_count;
+	uint32_t end = gif->frame_count_partial;
+
+	for (uint32_t f = start; f < end; f++) {
+		nsgif_frame *frame = nsgif__frame(gif, f);
+
+		if (frame->lzw_data_length > 0) {
+			frame->info.display = true;
+			frame->data_len = gif->buf_len;
+			gif->info.frame_count = f + 1;
+
+			if (f == 0) {
+				frame->info.transparency = true;
+			}
+			nsgif__frame_plan(gif, f);
+			nsgif__frames_ready(gif, start);
+			break;
+		}
+	}
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_set_frame_ready(
+		nsgif_t *gif,
+		nsgif_frame_ready_cb ready,
+		void *pw)
+{
+	gif->frame_ready = ready;
+	gif->frame_ready_pw = pw;
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_data_scan_continue(
+		nsgif_t *gif,
+		uint32_t frame_limit)
+{
+	nsgif_error ret;
+
+	if (gif->buf == NULL) {
+		return NSGIF_ERR_END_OF_DATA;
+	}
+
+	gif->scan_limit = frame_limit;
+
+	ret = nsgif__data_scan(gif);
+
+	if (gif->data_complete) {
+		nsgif__truncated_frame_complete(gif);
+		nsgif__publish(&gif->frames_final, !gif->scan_limited);
+	}
+
+	return ret;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_data_complete(
+		nsgif_t *gif)
+{
+	if (gif->data_complete == false) {
+		/* Set first, so a frame ready callback can decode the frame. */
+		nsgif__publish(&gif->data_complete, true);
+		nsgif__truncated_frame_complete(gif);
+		nsgif__publish(&gif->frames_final, !gif->scan_limited);
+	}
+}
+
+/** Frame image data checks, for \ref nsgif__frames_check. */
+struct nsgif_check_job {
+	const struct nsgif *gif;     /**< The gif object. */
+	nsgif_frame_check_t *checks; /**< Client array of results. */
+};
+
+/**
+ * Decode a frame's image data, without output, to check it.
+ *
+ * \param[in]     gif    The gif object.
+ * \param[in]     frame  The frame to check.
+ * \param[in]     lzw    LZW context to decode with.
+ * \param[in,out] check  The frame's check, with the image data offset.
+ */
+static void nsgif__frame_check(
+		const struct nsgif *gif,
+		const struct nsgif_frame *frame,
+		struct lzw_ctx *lzw,
+		nsgif_frame_check_t *check)
+{
+	const uint8_t *data = gif->buf + check->start;
+	lzw_result res;
+
+	if (check->expected == 0) {
+		return;
+	}
+
+	/* Same data bounds as nsgif__decode. */
+	res = lzw_decode_init(lzw, data[0],
+			gif->buf, nsgif__frame_data_len(gif, frame),
+			check->start + 1);
+	while (res == LZW_OK && check->pixels < check->expected) {
+		const uint8_t *uncompressed;
+		uint32_t written;
+
+		res = lzw_decode(lzw, &uncompressed, &written);
+		check->pixels += written;
+	}
+
+	check->end = lzw_decode_position(lzw);
+
+	if (check->pixels >= check->expected) {
+		check->pixels = check->expected;
+		check->status = NSGIF_OK;
+
+	} else if (res == LZW_OK_EOD || res == LZW_EOI_CODE) {
+		/* Decoding shows what there is. */
+		check->status = NSGIF_OK;
+
+	} else {
+		check->status = nsgif__error_from_lzw(res);
+		if (gif->data_complete &&
+		    check->status == NSGIF_ERR_END_OF_DATA) {
+			check->status = NSGIF_OK;
+		}
+	}
+}
+
+/**
+ * Check a range of frames' image data.
+ *
+ * \param[in] ctx    The \ref nsgif_check_job.
+ * \param[in] start  First frame.
+ * \param[in] end    Frame after the last.
+ */
+static void nsgif__frames_check(
+		void *ctx,
+		uint32_t start,
+		uint32_t end)
+{
+	const struct nsgif_check_job *job = ctx;
+	struct lzw_ctx *lzw;
+
+	if (lzw_context_create(&lzw) != LZW_OK) {
+		for (uint32_t f = start; f < end; f++) {
+			job->checks[f].status = NSGIF_ERR_OOM;
+		}
+		return;
+	}
+
+	for (uint32_t f = start; f < end; f++) {
+		if (job->checks[f].status == NSGIF_OK) {
+			nsgif__frame_check(job->gif,
+					nsgif__frame(job->gif, f),
+					lzw, &job->checks[f]);
+		}
+	}
+
+	lzw_context_destroy(lzw);
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_data_check(
+		nsgif_t *gif,
+		nsgif_frame_check_t *checks)
+{
+	struct nsgif_check_job job = {
+		.gif = gif,
+		.checks = checks,
+	};
+	nsgif_error ret = NSGIF_OK;
+	size_t pixels = 0;
+
+	/* Find each frame's image data. */
+	for (uint32_t f = 0; f < gif->info.frame_count; f++) {
+		struct nsgif_frame *frame = nsgif__frame(gif, f);
+		nsgif_frame_check_t *check = &checks[f];
+		const uint8_t *pos = gif->buf + frame->frame_offset;
+		uint32_t width = frame->info.rect.x1 - frame->info.rect.x0;
+		uint32_t height = frame->info.rect.y1 - frame->info.rect.y0;
+
+		/* Like nsgif__decode, rows below the image aren't decoded,
+		 * and nor are frames that start outside it. */
+		check->expected = 0;
+		if (frame->info.rect.x0 < gif->info.width &&
+		    frame->info.rect.y0 < gif->info.height) {
+			height -= gif__clip(frame->info.rect.y0, height,
+					gif->info.height);
+			check->expected = width * height;
+		}
+		check->pixels = 0;
+		check->start = frame->frame_offset;
+		check->end = frame->frame_offset;
+		check->status = NSGIF_ERR_FRAME_DISPLAY;
+
+		if (frame->info.display == false) {
+			continue;
+		}
+
+		check->status = nsgif__parse_frame_extensions(
+				gif, frame, f, &pos, false);
+		if (check->status == NSGIF_OK) {
+			check->status = nsgif__parse_image_descriptor(
+					gif, frame, &pos, false);
+		}
+		if (check->status == NSGIF_OK) {
+			check->status = nsgif__parse_colour_table(
+					gif, frame, &pos, false);
+		}
+		if (check->status == NSGIF_OK) {
+			check->start = pos - gif->buf;
+			check->end = check->start;
+			pixels += check->expected;
+		}
+	}
+
+	nsgif__parallel_run(gif, gif->info.frame_count, pixels,
+			nsgif__frames_check, &job);
+
+	for (uint32_t f = 0; f < gif->info.frame_count; f++) {
+		if (checks[f].status == NSGIF_ERR_OOM) {
+			return NSGIF_ERR_OOM;
+		}
+		if (checks[f].status == NSGIF_ERR_FRAME_DISPLAY) {
+			continue;
+		}
+		if (checks[f].status != NSGIF_OK ||
+		    checks[f].pixels < checks[f].expected) {
+			ret = NSGIF_ERR_DATA_FRAME;
+		}
+	}
+
+	return ret;
+}
+
+static uint32_t nsgif__frame_next(
+		const nsgif_t *gif,
+		bool partial,
+		uint32_t frame)
+{
+	uint32_t frames = partial ?
+			gif->frame_count_partial :
+			gif->info.frame_count;
+
+	if (frames == 0) {
+		return NSGIF_FRAME_INVALID;
+	}
+
+	frame++;
+	return (frame >= frames) ? 0 : frame;
+}
+
+static nsgif_error nsgif__next_displayable_frame(
+		const nsgif_t *gif,
+		uint32_t *frame,
+		uint32_t *delay)
+{
+	uint32_t next = *frame;
+
+	do {
+		next = nsgif__frame_next(gif, false, next);
+		if (next <= *frame && *frame != NSGIF_FRAME_INVALID &&
+				nsgif__frames_complete(gif) == false) {
+			return NSGIF_ERR_END_OF_DATA;
+
+		} else if (next == *frame || next == NSGIF_FRAME_INVALID) {
+			return NSGIF_ERR_FRAME_DISPLAY;
+		}
+
+		if (delay != NULL) {
+			*delay += nsgif__frame(gif, next)->info.delay;
+		}
+
+	} while (nsgif__frame(gif, next)->info.display == false);
+
+	*frame = next;
+	return NSGIF_OK;
+}
+
+/**
+ * Find the previous displayable frame, for playing backwards.
+ *
+ * Playing backwards needs every frame to have been scanned.
+ *
+ * \param[in]     gif    The GIF object.
+ * \param[in,out] frame  The frame to step back from, updated on success.
+ *                       From NSGIF_FRAME_INVALID, the last frame is found.
+ * \param[in,out] delay  If non-NULL, the delays of the frames stepped to
+ *                       are added to this.
+ * \return NSGIF_OK on success, or appropriate error otherwise.
+ */
+static nsgif_error nsgif__prev_displayable_frame(
+		const nsgif_t *gif,
+		uint32_t *frame,
+		uint32_t *delay)
+{
+	uint32_t frames = gif->info.frame_count;
+	uint32_t prev = *frame;
+
+	if (nsgif__frames_complete(gif) == false) {
+		return NSGIF_ERR_END_OF_DATA;
+	}
+
+	for (uint32_t i = 0; i < frames; i++) {
+		prev = (prev == 0 || prev >= frames) ? frames - 1 : prev - 1;
+		if (prev == *frame) {
+			break;
+		}
+
+		if (delay != NULL) {
+			*delay += nsgif__frame(gif, prev)->info.delay;
+		}
+
+		if (nsgif__frame(gif, prev)->info.display) {
+			*frame = prev;
+			return NSGIF_OK;
+		}
+	}
+
+	return NSGIF_ERR_FRAME_DISPLAY;
+}
+
+/**
+ * Step to the next frame to show, in playback order.
+ *
+ * \param[in]     gif      The GIF object.
+ * \param[in,out] frame    The frame to step from, updated on success.
+ * \param[in,out] delay    If non-NULL, the delays of the frames stepped to
+ *                         are added to this.
+ * \param[in,out] reverse  Whether ping-pong playback is going backwards,
+ *                         updated on success.
+ * \param[out]    wrapped  Returns whether the step starts a new loop.
+ * \return NSGIF_OK on success, or appropriate error otherwise.
+ */
+static nsgif_error nsgif__frame_step(
+		const nsgif_t *gif,
+		uint32_t *frame,
+		uint32_t *delay,
+		bool *reverse,
+		bool *wrapped)
+{
+	uint32_t start = *frame;
+	uint32_t step_delay = 0;
+	uint32_t next = start;
+	nsgif_error ret;
+
+	*wrapped = false;
+
+	switch (gif->playback) {
+	case NSGIF_PLAYBACK_REVERSE:
+		ret = nsgif__prev_displayable_frame(gif, &next, &step_delay);
+		*wrapped = (start != NSGIF_FRAME_INVALID && next > start);
+		break;
+
+	case NSGIF_PLAYBACK_PING_PONG:
+		if (*reverse == false) {
+			ret = nsgif__next_displayable_frame(gif,
+					&next, &step_delay);
+			if (ret != NSGIF_OK || start == NSGIF_FRAME_INVALID ||
+			    next > start) {
+				break;
+			}
+			/* Reached the end; turn around. */
+			*reverse = true;
+			next = start;
+			step_delay = 0;
+			ret = nsgif__prev_displayable_frame(gif,
+					&next, &step_delay);
+		} else {
+			ret = nsgif__prev_displayable_frame(gif,
+					&next, &step_delay);
+			if (ret != NSGIF_OK || next < start) {
+				break;
+			}
+			/* Reached the start; turn around. */
+			*reverse = false;
+			*wrapped = true;
+			next = start;
+			step_delay = 0;
+			ret = nsgif__next_displayable_frame(gif,
+					&next, &step_delay);
+		}
+		break;
+
+	default:
+		ret = nsgif__next_displayable_frame(gif, &next, &step_delay);
+		*wrapped = (start != NSGIF_FRAME_INVALID && next < start);
+		break;
+	}
+
+	if (ret != NSGIF_OK) {
+		return ret;
+	}
+
+	if (delay != NULL) {
+		*delay += step_delay;
+	}
+	*frame = next;
+	return NSGIF_OK;
+}
+
+/**
+ * Check whether a frame should be shown together with the next frame.
+ *
+ * \param[in] gif   The GIF object.
+ * \param[in] frame The current frame.
+ * \param[in] next  The next displayable frame.
+ * \return true if the frames should be merged, false otherwise.
+ */
+static inline bool nsgif__frame_merge_next(
+		const nsgif_t *gif,
+		uint32_t frame,
+		uint32_t next)
+{
+	if (gif->merge_duplicates && nsgif__frame(gif, next)->info.duplicate) {
+		return true;
+	}
+
+	if (gif->coalesce_zero_delay &&
+	    nsgif__frame(gif, frame)->info.delay == 0) {
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Advance over any frames to be merged into the display of a frame.
+ *
+ * Merging is not followed past the end of the animation.
+ *
+ * \param[in]     gif    The GIF object.
+ * \param[in,out] frame  The frame to advance from, updated on exit.
+ * \param[in,out] delay  Delay to add skipped frames' delays to.
+ * \param[in,out] rect   Redraw area to add skipped frames' areas to.
+ */
+static void nsgif__frame_merge(
+		const nsgif_t *gif,
+		uint32_t *frame,
+		uint32_t *delay,
+		nsgif_rect_t *rect)
+{
+	while (true) {
+		uint32_t next = *frame;
+		uint32_t next_delay = 0;
+		nsgif_error ret;
+
+		ret = nsgif__next_displayable_frame(gif, &next, &next_delay);
+		if (ret != NSGIF_OK || next < *frame ||
+		    nsgif__frame_merge_next(gif, *frame, next) == false) {
+			break;
+		}
+
+		nsgif__redraw_rect_extend(
+				&nsgif__frame(gif, *frame)->info.rect, rect);
+		*delay += next_delay;
+		*frame = next;
+	}
+}
+
+/**
+ * Get the time a frame delay shows a frame for.
+ *
+ * \param[in] gif    The GIF object.
+ * \param[in] delay  Frame delay in cs, from the GIF.
+ * \return the delay used when the frame is shown.
+ */
+static inline uint32_t nsgif__frame_delay(
+		const nsgif_t *gif,
+		uint32_t delay)
+{
+	return (delay < gif->delay_min) ? gif->delay_default : delay;
+}
+
+/**
+ * Advance over frames shown too soon after a frame, for decimation.
+ *
+ * Frames are skipped until the frames' delays add up to at least the
+ * decimation interval. Decimation is not followed past the end of the
+ * animation.
+ *
+ * \param[in]     gif    The GIF object.
+ * \param[in,out] frame  The frame to advance from, updated on exit.
+ * \param[in,out] delay  The frame's delay, updated to the total delay.
+ * \param[in,out] rect   Redraw area to add skipped frames' areas to.
+ */
+static void nsgif__frame_decimate(
+		const nsgif_t *gif,
+		uint32_t *frame,
+		uint32_t *delay,
+		nsgif_rect_t *rect)
+{
+	uint32_t shown = nsgif__frame_delay(gif, *delay);
+
+	while (shown < gif->decimation) {
+		uint32_t next = *frame;
+		uint32_t next_delay = 0;
+		nsgif_error ret;
+
+		ret = nsgif__next_displayable_frame(gif, &next, &next_delay);
+		if (ret != NSGIF_OK || next < *frame) {
+			break;
+		}
+
+		nsgif__redraw_rect_extend(
+				&nsgif__frame(gif, *frame)->info.rect, rect);
+		shown += nsgif__frame_delay(gif, next_delay);
+		*frame = next;
+	}
+
+	*delay = shown;
+}
+
+static inline bool nsgif__animation_complete(int count, int max)
+{
+	if (max == 0) {
+		return false;
+	}
+
+	return (count >= max);
+}
+
+nsgif_error nsgif_reset(
+		nsgif_t *gif)
+{
+	gif->loop_count = 0;
+	gif->frame = NSGIF_FRAME_INVALID;
+	gif->reverse = false;
+
+	return NSGIF_OK;
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_frame_prepare(
+		nsgif_t *gif,
+		nsgif_rect_t *area,
+		uint32_t *delay_cs,
+		uint32_t *frame_new)
+{
+	nsgif_error ret;
+	nsgif_rect_t rect = {
+		.x1 = 0,
+		.y1 = 0,
+	};
+	uint32_t delay = 0;
+	uint32_t frame = gif->frame;
+	bool reverse = gif->reverse;
+	bool wrapped;
+
+	if (gif->frame != NSGIF_FRAME_INVALID &&
+	    gif->frame < gif->info.frame_count &&
+	    nsgif__frame(gif, gif->frame)->info.display) {
+		rect = nsgif__frame(gif, gif->frame)->info.rect;
+	}
+
+	if (nsgif__animation_complete(
+			gif->loop_count,
+			gif->info.loop_max)) {
+		return NSGIF_ERR_ANIMATION_END;
+	}
+
+	ret = nsgif__frame_step(gif, &frame, &delay, &reverse, &wrapped);
+	if (ret != NSGIF_OK) {
+		return ret;
+	}
+
+	if (wrapped) {
+		gif->loop_count++;
+	}
+
+	if (gif->playback == NSGIF_PLAYBACK_REVERSE &&
+	    (wrapped || gif->frame == NSGIF_FRAME_INVALID)) {
+		/* Jumps to the end of the animation. */
+		rect.x0 = 0;
+		rect.y0 = 0;
+		rect.x1 = gif->info.width;
+		rect.y1 = gif->info.height;
+	}
+
+	/* Frames are only merged when playing forwards. */
+	if (!reverse && (gif->merge_duplicates || gif->coalesce_zero_delay)) {
+		nsgif__frame_merge(gif, &frame, &delay, &rect);
+	}
+
+	if (!reverse && gif->decimation != 0) {
+		nsgif__frame_decimate(gif, &frame, &delay, &rect);
+	}
+
+	if (nsgif__frames_complete(gif)) {
+		/* Check for last frame, which has infinite delay. */
+
+		if (gif->info.frame_count == 1) {
+			delay = NSGIF_INFINITE;
+		} else if (gif->info.loop_max != 0) {
+			uint32_t frame_next = frame;
+			bool reverse_next = reverse;
+			bool wrap_next;
+
+			ret = nsgif__frame_step(gif, &frame_next, NULL,
+					&reverse_next, &wrap_next);
+			if (ret != NSGIF_OK) {
+				return ret;
+			}
+
+			if (gif->data_complete && wrap_next) {
+				if (nsgif__animation_complete(
+						gif->loop_count + 1,
+						gif->info.loop_max)) {
+					delay = NSGIF_INFINITE;
+				}
+			}
+		}
+	}
+
+	gif->frame = frame;
+	gif->reverse = reverse;
+	nsgif__redraw_rect_extend(&nsgif__frame(gif, frame)->info.rect, &rect);
+
+	if (delay < gif->delay_min) {
+		delay = gif->delay_default;
+	}
+
+	*frame_new = gif->frame;
+	*delay_cs = delay;
+	*area = rect;
+
+	return NSGIF_OK;
+}
+
+/**
+ * Check whether a frame's image can't be seen once the next frame is drawn.
+ *
+ * Either the frame is disposed of before the next frame is drawn, or the
+ * next frame's image covers it, and isn't disposed of by restoring the
+ * frame.
+ *
+ * \param[in] gif        The gif object.
+ * \param[in] frame_idx  The frame to check, which isn't the last frame.
+ * \return true if the frame's image needn't be drawn, false otherwise.
+ */
+static bool nsgif__frame_occluded(
+		const nsgif_t *gif,
+		uint32_t frame_idx)
+{
+	const struct nsgif_frame *frame = nsgif__frame(gif, frame_idx);
+	const struct nsgif_frame *next = nsgif__frame(gif, frame_idx + 1);
+	const nsgif_rect_t *r = &frame->info.rect;
+	const nsgif_rect_t *n = &next->info.rect;
+
+	if (frame->info.display == false || next->info.display == false) {
+		return false;
+	}
+
+	if (frame->info.disposal == NSGIF_DISPOSAL_RESTORE_BG ||
+	    frame->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
+		return true;
+	}
+
+	if (next->info.transparency ||
+	    next->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
+		return false;
+	}
+
+	return n->x0 <= r->x0 && n->y0 <= r->y0 &&
+			n->x1 >= r->x1 && n->y1 >= r->y1;
+}
+
+/**
+ * Set up the composited frame checkpoints, if enabled.
+ *
+ * Checkpoints are only kept once every frame has been scanned, so that
+ * the composited frames can't change.
+ *
+ * \param[in] gif  The gif object.
+ * \return true if checkpoints can be used, false otherwise.
+ */
+static bool nsgif__checkpoints_init(
+		struct nsgif *gif)
+{
+	size_t pixel_bytes = gif->index_mode ? 1 : sizeof(uint32_t);
+	size_t size = (size_t)gif->info.width * gif->info.height * pixel_bytes;
+	size_t count;
+
+	if (gif->checkpoints != NULL) {
+		return true;
+	}
+
+	if (gif->checkpoint_budget == 0 || size == 0 ||
+	    !nsgif__frames_complete(gif)) {
+		return false;
+	}
+
+	count = gif->checkpoint_budget / size;
+	if (count > gif->info.frame_count) {
+		count = gif->info.frame_count;
+	}
+	if (count < 2) {
+		return false;
+	}
+
+	gif->checkpoints = calloc(count, sizeof(*gif->checkpoints));
+	if (gif->checkpoints == NULL) {
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		gif->checkpoints[i].frame = NSGIF_FRAME_INVALID;
+	}
+	gif->checkpoint_count = count;
+	gif->checkpoint_size = size;
+
+	return true;
+}
+
+/**
+ * Get the interval between keyframe checkpoints.
+ *
+ * Half the checkpoints are kept for keyframes, spread evenly through the
+ * animation. The rest hold a window of the frames before the last frame
+ * decoded backwards.
+ *
+ * \param[in] gif  The gif object, with checkpoints set up.
+ * \return the number of frames between keyframes.
+ */
+static inline uint32_t nsgif__checkpoint_interval(
+		const struct nsgif *gif)
+{
+	uint32_t keys = gif->checkpoint_count / 2;
+
+	return (gif->info.frame_count + keys - 1) / keys;
+}
+
+/**
+ * Copy the canvas to or from a checkpoint.
+ *
+ * \param[in] gif         The gif object.
+ * \param[in] checkpoint  The checkpoint, with its canvas allocated.
+ * \param[in] save        Whether to save the canvas, or restore it.
+ * \return true on success, or false if there's no bitmap.
+ */
+static bool nsgif__checkpoint_copy(
+		struct nsgif *gif,
+		struct nsgif_checkpoint *checkpoint,
+		bool save)
+{
+	size_t pixel_bytes = gif->index_mode ? 1 : sizeof(uint32_t);
+	size_t row_bytes = gif->info.width * pixel_bytes;
+	size_t stride = row_bytes;
+	uint8_t *canvas = gif->index_canvas;
+	struct nsgif_area_job job = {
+		.row_bytes = row_bytes,
+		.pixel_bytes = pixel_bytes,
+	};
+
+	if (!gif->index_mode) {
+		canvas = (uint8_t *)nsgif__bitmap_get(gif);
+		if (canvas == NULL) {
+			return false;
+		}
+		stride = gif->rowspan * pixel_bytes;
+	}
+
+	if (save) {
+		job.dst = checkpoint->canvas;
+		job.dst_stride = row_bytes;
+		job.src = canvas;
+		job.src_stride = stride;
+	} else {
+		job.dst = canvas;
+		job.dst_stride = stride;
+		job.src = checkpoint->canvas;
+		job.src_stride = row_bytes;
+		nsgif__area_damage(gif, &job, 0, 0);
+	}
+
+	nsgif__area_run(gif, &job, gif->info.height);
+	return true;
+}
+
+/**
+ * Save the composited frame as a checkpoint, if it should be kept.
+ *
+ * Keyframes are always kept. Other frames are kept in the window, if there
+ * is a checkpoint free, or one that isn't a keyframe to replace.
+ *
+ * \param[in] gif        The gif object.
+ * \param[in] frame_idx  The frame composited on the canvas.
+ * \param[in] window     Whether to keep the frame if it's not a keyframe.
+ */
+static void nsgif__checkpoint_save(
+		struct nsgif *gif,
+		uint32_t frame_idx,
+		bool window)
+{
+	struct nsgif_checkpoint *slot = NULL;
+	unsigned slot_rank = 0;
+	uint32_t interval;
+
+	if (!nsgif__checkpoints_init(gif)) {
+		return;
+	}
+
+	interval = nsgif__checkpoint_interval(gif);
+	if (!window && frame_idx % interval != 0) {
+		return;
+	}
+
+	/* Use a free checkpoint, or else replace the least recently used
+	 * window frame, or else keyframe. */
+	for (uint32_t i = 0; i < gif->checkpoint_count; i++) {
+		struct nsgif_checkpoint *cp = &gif->checkpoints[i];
+		unsigned rank;
+
+		if (cp->frame == frame_idx) {
+			cp->used = ++gif->checkpoint_clock;
+			return;
+		}
+
+		rank = (cp->frame == NSGIF_FRAME_INVALID) ? 0 :
+				(cp->frame % interval != 0) ? 1 : 2;
+		if (slot == NULL || rank < slot_rank ||
+		    (rank == slot_rank && cp->used < slot->used)) {
+			slot = cp;
+			slot_rank = rank;
+		}
+	}
+
+	if (slot_rank == 2 && frame_idx % interval != 0) {
+		/* Don't lose a keyframe for a window frame. */
+		return;
+	}
+
+	if (slot->canvas == NULL) {
+		slot->canvas = malloc(gif->checkpoint_size);
+		if (slot->canvas == NULL) {
+			return;
+		}
+	}
+
+	slot->frame = NSGIF_FRAME_INVALID;
+	if (nsgif__checkpoint_copy(gif, slot, true)) {
+		slot->frame = frame_idx;
+		slot->used = ++gif->checkpoint_clock;
+	}
+}
+
+/**
+ * Find the best checkpoint to composite a frame from.
+ *
+ * Frames with restore previous disposal can't be continued from, since
+ * the canvas to restore isn't saved with them. They are only restored if
+ * compositing wouldn't otherwise continue straight on to them.
+ *
+ * \param[in] gif    The gif object.
+ * \param[in] frame  The frame to composite.
+ * \param[in] start  The frame compositing would otherwise start from.
+ * \return the latest checkpoint at or after `start`, up to `frame`, or NULL.
+ */
+static struct nsgif_checkpoint *nsgif__checkpoint_find(
+		const struct nsgif *gif,
+		uint32_t frame,
+		uint32_t start)
+{
+	struct nsgif_checkpoint *best = NULL;
+
+	for (uint32_t i = 0; i < gif->checkpoint_count; i++) {
+		struct nsgif_checkpoint *cp = &gif->checkpoints[i];
+
+		if (cp->frame == NSGIF_FRAME_INVALID ||
+		    cp->frame < start || cp->frame > frame) {
+			continue;
+		}
+
+		if ((cp->frame != frame || cp->frame == start) &&
+		    nsgif__frame(gif, cp->frame)->info.disposal ==
+				NSGIF_DISPOSAL_RESTORE_PREV) {
+			continue;
+		}
+
+		if (best == NULL || cp->frame > best->frame) {
+			best = cp;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Restore a checkpoint's frame to the canvas, and the client bitmap.
+ *
+ * \param[in] gif         The gif object.
+ * \param[in] checkpoint  The checkpoint to restore.
+ * \return true on success, or false if there's no bitmap.
+ */
+static bool nsgif__checkpoint_restore(
+		struct nsgif *gif,
+		struct nsgif_checkpoint *checkpoint)
+{
+	const nsgif_rect_t full = {
+		.x1 = gif->info.width,
+		.y1 = gif->info.height,
+	};
+
+	if (!nsgif__checkpoint_copy(gif, checkpoint, false)) {
+		return false;
+	}
+
+	checkpoint->used = ++gif->checkpoint_clock;
+	gif->decoded_frame = checkpoint->frame;
+	gif->decoded_ok = true;
+	gif->checkpoint_restored = true;
+
+	if (gif->canvas_only) {
+		return true;
+	}
+
+	if (gif->index_mode) {
+		uint32_t *bitmap = nsgif__bitmap_get(gif);
+		if (bitmap == NULL) {
+			gif->decoded_frame = NSGIF_FRAME_INVALID;
+			return false;
+		}
+		nsgif__index_expand(gif, bitmap, &full);
+		gif->expand_area = (nsgif_rect_t) { 0 };
+	}
+
+	nsgif__bitmap_modified(gif);
+	nsgif__bitmap_set_opaque(gif, nsgif__frame(gif, checkpoint->frame));
+
+	return true;
+}
+
+/**
+ * Get the frame to start compositing from, to composite a frame.
+ *
+ * \param[in] gif    The gif object.
+ * \param[in] frame  The frame to composite, which isn't the decoded frame.
+ * \return the first frame to composite.
+ */
+static uint32_t nsgif__frames_start(
+		const nsgif_t *gif,
+		uint32_t frame)
+{
+	if (gif->decoded_frame >= frame ||
+	    gif->decoded_frame == NSGIF_FRAME_INVALID) {
+		/* Can skip to first frame or restart. */
+		return 0;
+	}
+
+	if (gif->checkpoint_restored &&
+	    nsgif__frame(gif, gif->decoded_frame)->info.disposal ==
+			NSGIF_DISPOSAL_RESTORE_PREV) {
+		/* Canvas to restore wasn't saved with the checkpoint. */
+		return 0;
+	}
+
+	/* The decoded frame is before the frame, so it isn't the last. */
+	return gif->decoded_frame + 1;
+}
+
+/**
+ * Composite frames up to the given frame.
+ *
+ * Compositing starts from the latest checkpoint, if there is one closer
+ * than the decoded frame. Keyframes are saved as checkpoints on the way,
+ * along with the frames before the given frame, when decoding backwards.
+ *
+ * With decimation, frames which can't be seen in the given frame are
+ * disposed of without being drawn. If a frame relied on to cover a skipped
+ * frame turns out to be incomplete, or fails to decode, the frames are
+ * composited again, in full.
+ *
+ * \param[in] gif    The gif object.
+ * \param[in] frame  The frame to composite.
+ * \return NSGIF_OK on success, appropriate error otherwise.
+ */
+static nsgif_error nsgif__frames_decode(
+		nsgif_t *gif,
+		uint32_t frame)
+{
+	bool skip = gif->decimation != 0;
+	bool covered = false;
+	struct nsgif_checkpoint *checkpoint;
+	uint32_t start_frame;
+	nsgif_error ret = NSGIF_OK;
+	bool backward;
+
+	if (gif->decoded_frame == frame) {
+		return NSGIF_OK;
+	}
+
+	backward = gif->decoded_frame != NSGIF_FRAME_INVALID &&
+			gif->decoded_frame > frame;
+	start_frame = nsgif__frames_start(gif, frame);
+
+	checkpoint = nsgif__checkpoint_find(gif, frame, start_frame);
+	if (checkpoint != NULL && nsgif__checkpoint_restore(gif, checkpoint)) {
+		if (checkpoint->frame == frame) {
+			return NSGIF_OK;
+		}
+		start_frame = checkpoint->frame + 1;
+	}
+
+	while (start_frame <= frame) {
+		uint32_t f = start_frame++;
+		bool skipped;
+
+		gif->skip_image = skip && f < frame &&
+				nsgif__frame_occluded(gif, f);
+		gif->expand_defer = f < frame;
+		ret = nsgif__process_frame(gif, f, true);
+		skipped = gif->skip_image;
+		gif->skip_image = false;
+
+		if (ret != NSGIF_OK && (skipped || covered)) {
+			/* The error leaves a partial frame that skipped
+			 * frames may show through; redo without skipping. */
+			skip = false;
+			covered = false;
+			gif->decoded_frame = NSGIF_FRAME_INVALID;
+			start_frame = 0;
+			continue;
+		} else if (ret != NSGIF_OK) {
+			return ret;
+		}
+
+		if (skipped) {
+			if (nsgif__frame(gif, f)->info.disposal ==
+					NSGIF_DISPOSAL_UNSPECIFIED ||
+			    nsgif__frame(gif, f)->info.disposal ==
+					NSGIF_DISPOSAL_NONE) {
+				covered = true;
+			}
+		} else if (covered && nsgif__frame(gif, f)->info.display) {
+			covered = false;
+			if (!gif->image_complete) {
+				/* Skipped frames would show through; redo
+				 * without skipping any. */
+				skip = false;
+				gif->decoded_frame = NSGIF_FRAME_INVALID;
+				start_frame = 0;
+				continue;
+			}
+		}
+
+		if (!skipped && gif->decoded_frame == f && gif->decoded_ok) {
+			nsgif__checkpoint_save(gif, f, backward && f < frame);
+		}
+	}
+
+	return ret;
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_frame_decode(
+		nsgif_t *gif,
+		uint32_t frame,
+		nsgif_bitmap_t **bitmap)
+{
+	nsgif_error ret;
+
+	if (frame >= nsgif__published(&gif->frame_count_ready)) {
+		return NSGIF_ERR_BAD_FRAME;
+	}
+
+	if (gif->canvas_only) {
+		/* Bitmap wasn't kept up to date. */
+		gif->canvas_only = false;
+		gif->decoded_frame = NSGIF_FRAME_INVALID;
+	}
+
+	nsgif__index_mode_update(gif);
+
+	gif->damage = (nsgif_rect_t) { 0 };
+	if (gif->damage_tracking) {
+		nsgif__damage_start(gif);
+	}
+
+	ret = nsgif__frames_decode(gif, frame);
+
+	gif->expand_defer = false;
+	if (gif->expand_area.x1 != 0) {
+		/* Stopped before the frame that would have expanded it. */
+		uint32_t *pixels = nsgif__bitmap_get(gif);
+		if (pixels != NULL) {
+			nsgif__index_expand_pending(gif, pixels);
+			nsgif__bitmap_modified(gif);
+		}
+	}
+
+	if (gif->damage_tracking) {
+		nsgif__damage_finish(gif);
+	}
+
+	if (ret != NSGIF_OK) {
+		return ret;
+	}
+
+	*bitmap = gif->frame_image;
+	return NSGIF_OK;
+}
+
+/** Number of slots in a \ref nsgif_colour_map. */
+#define NSGIF_COLOUR_MAP_SLOTS (NSGIF_MAX_COLOURS * 2)
+
+/** Lookup from colour to global palette index. */
+struct nsgif_colour_map {
+	/** Colour in each slot. */
+	uint32_t colour[NSGIF_COLOUR_MAP_SLOTS];
+	/** Palette index of each slot's colour, or -1 for empty slots. */
+	int16_t index[NSGIF_COLOUR_MAP_SLOTS];
+};
+
+/** Index canvas or bitmap packing, for \ref nsgif__index_pack_rows. */
+struct nsgif_pack_job {
+	const struct nsgif *gif; /**< The gif object. */
+	uint8_t bpp;             /**< Bits per pixel: 1, 2, 4 or 8. */
+	uint8_t *buffer;         /**< Client buffer to fill. */
+	size_t stride;           /**< Row stride of `buffer` in bytes. */
+	/** Bitmap pixels, for \ref nsgif__bitmap_pack_rows. */
+	const uint32_t *pixels;
+	/** Colours to map bitmap pixels back to palette indices. */
+	const struct nsgif_colour_map *map;
+};
+
+/**
+ * Pack a band of rows of the index canvas into a client buffer.
+ *
+ * \param[in] ctx    The \ref nsgif_pack_job.
+ * \param[in] start  First row.
+ * \param[in] end    Row after the last.
+ */
+static void nsgif__index_pack_rows(
+		void *ctx,
+		uint32_t start,
+		uint32_t end)
+{
+	const struct nsgif_pack_job *job = ctx;
+	const struct nsgif *gif = job->gif;
+	uint8_t bpp = job->bpp;
+	uint8_t bg = (gif->bg_index < gif->colour_table_size) ?
+			gif->bg_index : 0;
+	uint8_t pixels_per_byte = 8 / bpp;
+
+	for (uint32_t y = start; y < end; y++) {
+		const uint8_t *src = gif->index_canvas + y * gif->info.width;
+		uint8_t *dst = job->buffer + y * job->stride;
+		uint32_t x = 0;
+
+		while (x < gif->info.width) {
+			uint8_t byte = 0;
+
+			for (uint8_t i = 0; i < pixels_per_byte; i++, x++) {
+				uint8_t index = 0;
+
+				if (x < gif->info.width) {
+					index = src[x];
+					if (index >= gif->colour_table_size) {
+						/* Transparent. */
+						index = bg;
+					}
+				}
+				byte = (byte << bpp) | index;
+			}
+			*dst++ = byte;
+		}
+	}
+}
+
+/**
+ * Pack the index canvas into a client buffer.
+ *
+ * \param[in]  gif     The gif object.
+ * \param[in]  bpp     Bits per pixel: 1, 2, 4 or 8.
+ * \param[out] buffer  Client buffer to fill.
+ * \param[in]  stride  Row stride of `buffer` in bytes.
+ */
+static void nsgif__index_pack(
+		const struct nsgif *gif,
+		uint8_t bpp,
+		uint8_t *buffer,
+		size_t stride)
+{
+	struct nsgif_pack_job job = {
+		.gif = gif,
+		.bpp = bpp,
+		.buffer = buffer,
+		.stride = stride,
+	};
+
+	nsgif__parallel_run(gif, gif->info.height,
+			(size_t)gif->info.width * gif->info.height,
+			nsgif__index_pack_rows, &job);
+}
+
+/**
+ * Get a colour map slot for a colour.
+ *
+ * \param[in] colour  The colour.
+ * \return the first slot to look in.
+ */
+static inline uint32_t nsgif__colour_map_slot(
+		uint32_t colour)
+{
+	/* Fibonacci hashing, keeping the top nine bits. */
+	return (uint32_t)(colour * 2654435761u) >> 23;
+}
+
+/**
+ * Fill a colour map from a colour table.
+ *
+ * Where the table has the same colour more than once, the first index is
+ * kept.
+ *
+ * \param[out] map      The colour map to fill.
+ * \param[in]  colours  The colour table.
+ * \param[in]  count    Number of entries in the colour table.
+ */
+static void nsgif__colour_map_init(
+		struct nsgif_colour_map *map,
+		const uint32_t *colours,
+		size_t count)
+{
+	memset(map->index, 0xff, sizeof(map->index));
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t slot = nsgif__colour_map_slot(colours[i]);
+
+		while (map->index[slot] != -1 &&
+		       map->colour[slot] != colours[i]) {
+			slot = (slot + 1) % NSGIF_COLOUR_MAP_SLOTS;
+		}
+		if (map->index[slot] == -1) {
+			map->colour[slot] = colours[i];
+			map->index[slot] = (int16_t)i;
+		}
+	}
+}
+
+/**
+ * Look up a colour's palette index in a colour map.
+ *
+ * \param[in] map     The colour map.
+ * \param[in] colour  The colour to find.
+ * \return the palette index, or -1 if the colour isn't in the palette.
+ */
+static inline int16_t nsgif__colour_map_find(
+		const struct nsgif_colour_map *map,
+		uint32_t colour)
+{
+	uint32_t slot = nsgif__colour_map_slot(colour);
+
+	while (map->index[slot] != -1 && map->colour[slot] != colour) {
+		slot = (slot + 1) % NSGIF_COLOUR_MAP_SLOTS;
+	}
+
+	return map->index[slot];
+}
+
+/**
+ * Get the palette index to pack for a bitmap pixel.
+ *
+ * \param[in] map     The colour map.
+ * \param[in] colour  The pixel's colour.
+ * \param[in] bg      Index to give colours that aren't in the palette.
+ * \return the palette index to pack.
+ */
+static inline uint8_t nsgif__colour_map_pack(
+		const struct nsgif_colour_map *map,
+		uint32_t colour,
+		uint8_t bg)
+{
+	int16_t index = nsgif__colour_map_find(map, colour);
+
+	return (index == -1) ? bg : (uint8_t)index;
+}
+
+/**
+ * Pack a band of rows of the client bitmap into a client buffer.
+ *
+ * Each pixel is mapped back to its index in the global colour table.
+ * Transparent pixels are given the background colour index.
+ *
+ * \param[in] ctx    The \ref nsgif_pack_job.
+ * \param[in] start  First row.
+ * \param[in] end    Row after the last.
+ */
+static void nsgif__bitmap_pack_rows(
+		void *ctx,
+		uint32_t start,
+		uint32_t end)
+{
+	const struct nsgif_pack_job *job = ctx;
+	const struct nsgif *gif = job->gif;
+	uint8_t bpp = job->bpp;
+	uint8_t bg = (gif->bg_index < gif->colour_table_size) ?
+			gif->bg_index : 0;
+	uint8_t pixels_per_byte = 8 / bpp;
+
+	for (uint32_t y = start; y < end; y++) {
+		const uint32_t *src = job->pixels + y * gif->rowspan;
+		uint8_t *dst = job->buffer + y * job->stride;
+		/* Runs of the same colour are only looked up once. */
+		uint32_t colour = src[0];
+		uint8_t last = nsgif__colour_map_pack(job->map, colour, bg);
+		uint32_t x = 0;
+
+		while (x < gif->info.width) {
+			uint8_t byte = 0;
+
+			for (uint8_t i = 0; i < pixels_per_byte; i++, x++) {
+				uint8_t index = 0;
+
+				if (x < gif->info.width) {
+					if (src[x] != colour) {
+						colour = src[x];
+						last = nsgif__colour_map_pack(
+								job->map,
+								colour, bg);
+					}
+					index = last;
+				}
+				byte = (byte << bpp) | index;
+			}
+			*dst++ = byte;
+		}
+	}
+}
+
+/**
+ * Decode a frame to the client bitmap, and pack it into a client buffer.
+ *
+ * This is for GIFs whose global colour table leaves no index free for the
+ * index canvas to use for transparent pixels.
+ *
+ * \param[in]  gif     The gif object.
+ * \param[in]  frame   The frame number to decode.
+ * \param[in]  bpp     Bits per pixel: 1, 2, 4 or 8.
+ * \param[out] buffer  Client buffer to fill.
+ * \param[in]  stride  Row stride of `buffer` in bytes.
+ * \return NSGIF_OK on success, or appropriate error otherwise.
+ */
+static nsgif_error nsgif__frame_decode_packed_bitmap(
+		struct nsgif *gif,
+		uint32_t frame,
+		uint8_t bpp,
+		uint8_t *buffer,
+		size_t stride)
+{
+	struct nsgif_colour_map map;
+	struct nsgif_pack_job job = {
+		.gif = gif,
+		.bpp = bpp,
+		.buffer = buffer,
+		.stride = stride,
+		.map = &map,
+	};
+	nsgif_bitmap_t *bitmap;
+	nsgif_error ret;
+
+	ret = nsgif_frame_decode(gif, frame, &bitmap);
+	if (ret != NSGIF_OK &&
+	    ret != NSGIF_ERR_DATA_FRAME &&
+	    ret != NSGIF_ERR_END_OF_DATA) {
+		return ret;
+	}
+
+	/* Partially decoded frames are left in the bitmap too. */
+	job.pixels = nsgif__bitmap_get(gif);
+	if (job.pixels == NULL) {
+		return NSGIF_ERR_OOM;
+	}
+
+	nsgif__colour_map_init(&map, gif->global_colour_table,
+			gif->colour_table_size);
+	nsgif__parallel_run(gif, gif->info.height,
+			(size_t)gif->info.width * gif->info.height,
+			nsgif__bitmap_pack_rows, &job);
+	return ret;
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_frame_decode_packed(
+		nsgif_t *gif,
+		uint32_t frame,
+		uint8_t bpp,
+		uint8_t *buffer,
+		size_t stride)
+{
+	nsgif_error ret;
+
+	if (frame >= nsgif__published(&gif->frame_count_ready)) {
+		return NSGIF_ERR_BAD_FRAME;
+	}
+
+	if (bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8) {
+		return NSGIF_ERR_FORMAT;
+	}
+
+	nsgif__index_mode_update(gif);
+	if (gif->info.global_palette == false ||
+	    gif->local_palettes ||
+	    gif->colour_table_size > (1u << bpp)) {
+		return NSGIF_ERR_FORMAT;
+
+	} else if (gif->index_mode == false) {
+		/* No index free for transparent pixels. */
+		return nsgif__frame_decode_packed_bitmap(gif, frame, bpp,
+				buffer, stride);
+	}
+
+	/* The index canvas is up to date in index mode, so only the bitmap
+	 * needs to be left behind. */
+	gif->canvas_only = true;
+
+	ret = nsgif__frames_decode(gif, frame);
+	if (ret != NSGIF_OK &&
+	    ret != NSGIF_ERR_DATA_FRAME &&
+	    ret != NSGIF_ERR_END_OF_DATA) {
+		return ret;
+	}
+
+	/* Partially decoded frames are still given. */
+	nsgif__index_pack(gif, bpp, buffer, stride);
+	return ret;
+}
+
+/* exported function documented in nsgif.h */
+const nsgif_info_t *nsgif_get_info(const nsgif_t *gif)
+{
+	return &gif->info;
+}
+
+/* exported function documented in nsgif.h */
+const nsgif_frame_info_t *nsgif_get_frame_info(
+		const nsgif_t *gif,
+		uint32_t frame)
+{
+	if (frame >= gif->info.frame_count) {
+		return NULL;
 	}
+
+	return &nsgif__frame(gif, frame)->info;
 }
 
 /* exported function documented in nsgif.h */
-nsgif_error nsgif_create(
-		const nsgif_bitmap_cb_vt *bitmap_vt,
-		nsgif_bitmap_fmt_t bitmap_fmt,
-		nsgif_t **gif_out)
+nsgif_error nsgif_frame_cost(
+		const nsgif_t *gif,
+		uint32_t frame,
+		nsgif_frame_cost_t *cost)
 {
-	nsgif_t *gif;
+	const struct nsgif_checkpoint *checkpoint;
+	uint32_t start_frame;
 
-	gif = calloc(1, sizeof(*gif));
-	if (gif == NULL) {
-		return NSGIF_ERR_OOM;
+	if (frame >= gif->info.frame_count) {
+		return NSGIF_ERR_BAD_FRAME;
 	}
 
-	gif->bitmap = *bitmap_vt;
-	gif->decoded_frame = NSGIF_FRAME_INVALID;
-	gif->prev_index = NSGIF_FRAME_INVALID;
+	*cost = (nsgif_frame_cost_t) { 0 };
 
-	gif->delay_min = NSGIF_FRAME_DELAY_MIN;
-	gif->delay_default = NSGIF_FRAME_DELAY_DEFAULT;
+	/* Same choice of first frame to draw as nsgif__frames_decode. */
+	if (gif->canvas_only == false && gif->decoded_frame == frame) {
+		return NSGIF_OK;
 
-	gif->colour_layout = nsgif__bitmap_fmt_to_colour_layout(bitmap_fmt);
+	} else if (gif->canvas_only) {
+		start_frame = 0;
+	} else {
+		start_frame = nsgif__frames_start(gif, frame);
+	}
 
-	*gif_out = gif;
-	return NSGIF_OK;
-}
+	checkpoint = nsgif__checkpoint_find(gif, frame, start_frame);
+	if (checkpoint != NULL) {
+		cost->disposal += (size_t)gif->info.width * gif->info.height;
+		if (checkpoint->frame == frame) {
+			return NSGIF_OK;
+		}
+		start_frame = checkpoint->frame + 1;
+	}
 
-/* exported function documented in nsgif.h */
-void nsgif_set_frame_delay_behaviour(
-		nsgif_t *gif,
-		uint16_t delay_min,
-		uint16_t delay_default)
-{
-	gif->delay_min = delay_min;
-	gif->delay_default = delay_default;
-}
+	for (uint32_t f = start_frame; f <= frame; f++) {
+		const struct nsgif_frame *current = nsgif__frame(gif, f);
+		const struct nsgif_frame *prev;
 
-/**
- * Read GIF header.
- *
- * 6-byte GIF file header is:
- *
- *  +0   3CHARS   Signature ('GIF')
- *  +3   3CHARS   Version ('87a' or '89a')
- *
- * \param[in]      gif     The GIF object we're decoding.
- * \param[in,out]  pos     The current buffer position, updated on success.
- * \param[in]      strict  Whether to require a known GIF version.
- * \return NSGIF_OK on success, appropriate error otherwise.
- */
-static nsgif_error nsgif__parse_header(
-		struct nsgif *gif,
-		const uint8_t **pos,
-		bool strict)
-{
-	const uint8_t *data = *pos;
-	size_t len = gif->buf + gif->buf_len - data;
+		if (current->info.display == false) {
+			continue;
+		}
 
-	if (len < 6) {
-		return NSGIF_ERR_END_OF_DATA;
-	}
+		cost->frames++;
+		if (gif->decimation == 0 || f == frame ||
+		    !nsgif__frame_occluded(gif, f)) {
+			cost->data_length += current->info.data_length;
+			cost->pixels += current->info.clipped_area;
+		}
 
-	if (strncmp((const char *) data, "GIF", 3) != 0) {
-		return NSGIF_ERR_DATA;
-	}
-	data += 3;
+		if (f == 0) {
+			cost->disposal += (size_t)gif->info.width *
+					gif->info.height;
 
-	if (strict == true) {
-		if ((strncmp((const char *) data, "87a", 3) != 0) &&
-		    (strncmp((const char *) data, "89a", 3) != 0)) {
-			return NSGIF_ERR_DATA;
+		} else if (!(current->plan & NSGIF_PLAN_SKIP_DISPOSE)) {
+			prev = nsgif__frame(gif, f - 1);
+			if (prev->info.disposal == NSGIF_DISPOSAL_RESTORE_BG ||
+			    prev->info.disposal == NSGIF_DISPOSAL_RESTORE_PREV) {
+				cost->disposal += prev->info.clipped_area;
+			}
+		}
+
+		if (nsgif__frame_needs_record(gif, current, f)) {
+			cost->disposal += current->info.clipped_area;
 		}
 	}
-	data += 3;
 
-	*pos = data;
 	return NSGIF_OK;
 }
 
-/**
- * Read Logical Screen Descriptor.
- *
- * 7-byte Logical Screen Descriptor is:
- *
- *  +0   SHORT   Logical Screen Width
- *  +2   SHORT   Logical Screen Height
- *  +4   CHAR    __Packed Fields__
- *               1BIT    Global Colour Table Flag
- *               3BITS   Colour Resolution
- *               1BIT    Sort Flag
- *               3BITS   Size of Global Colour Table
- *  +5   CHAR    Background Colour Index
- *  +6   CHAR    Pixel Aspect Ratio
- *
- * \param[in]      gif     The GIF object we're decoding.
- * \param[in,out]  pos     The current buffer position, updated on success.
- * \return NSGIF_OK on success, appropriate error otherwise.
- */
-static nsgif_error nsgif__parse_logical_screen_descriptor(
-		struct nsgif *gif,
-		const uint8_t **pos)
+/* exported function documented in nsgif.h */
+bool nsgif_frame_damage(
+		const nsgif_t *gif,
+		nsgif_rect_t *damage)
 {
-	const uint8_t *data = *pos;
-	size_t len = gif->buf + gif->buf_len - data;
-
-	if (len < 7) {
-		return NSGIF_ERR_END_OF_DATA;
+	if (!gif->damage_tracking) {
+		return false;
 	}
 
-	gif->info.width = data[0] | (data[1] << 8);
-	gif->info.height = data[2] | (data[3] << 8);
-	gif->info.global_palette = data[4] & NSGIF_COLOUR_TABLE_MASK;
-	gif->colour_table_size = 2 << (data[4] & NSGIF_COLOUR_TABLE_SIZE_MASK);
-	gif->bg_index = data[5];
-	gif->aspect_ratio = data[6];
-	gif->info.loop_max = 1;
-
-	*pos += 7;
-	return NSGIF_OK;
+	*damage = gif->damage;
+	return true;
 }
 
 /* exported function documented in nsgif.h */
-nsgif_error nsgif_data_scan(
-		nsgif_t *gif,
-		size_t size,
-		const uint8_t *data)
+bool nsgif_frame_damage_span(
+		const nsgif_t *gif,
+		uint32_t row,
+		uint32_t *x0,
+		uint32_t *x1)
 {
-	const uint8_t *nsgif_data;
-	nsgif_error ret;
-	uint32_t frames;
+	const nsgif_rect_t *damage = &gif->damage;
 
-	if (gif->data_complete) {
-		return NSGIF_ERR_DATA_COMPLETE;
+	if (!gif->damage_tracking || row >= gif->info.height) {
+		return false;
 	}
 
-	/* Initialize values */
-	gif->buf_len = size;
-	gif->buf = data;
+	if (gif->damage_rows != NULL) {
+		*x0 = gif->damage_rows[row].x0;
+		*x1 = gif->damage_rows[row].x1;
+	} else if (row >= damage->y0 && row < damage->y1) {
+		*x0 = damage->x0;
+		*x1 = damage->x1;
+	} else {
+		*x0 = *x1 = 0;
+	}
 
-	/* Get our current processing position */
-	nsgif_data = gif->buf + gif->buf_pos;
+	return true;
+}
 
-	/* See if we should initialise the GIF */
-	if (gif->buf_pos == 0) {
-		/* We want everything to be NULL before we start so we've no
-		 * chance of freeing bad pointers (paranoia)
-		 */
-		gif->frame_image = NULL;
-		gif->frames = NULL;
-		gif->frame_holders = 0;
+/* exported function documented in nsgif.h */
+const nsgif_extension_info_t *nsgif_get_extension_info(
+		const nsgif_t *gif,
+		uint32_t ext)
+{
+	if (ext >= gif->info.extension_count) {
+		return NULL;
+	}
 
-		/* The caller may have been lazy and not reset any values */
-		gif->info.frame_count = 0;
-		gif->frame_count_partial = 0;
-		gif->decoded_frame = NSGIF_FRAME_INVALID;
-		gif->frame = NSGIF_FRAME_INVALID;
+	return &gif->extensions[ext];
+}
 
-		ret = nsgif__parse_header(gif, &nsgif_data, false);
-		if (ret != NSGIF_OK) {
-			return ret;
-		}
+/* exported function documented in nsgif.h */
+size_t nsgif_extension_data(
+		const nsgif_t *gif,
+		uint32_t ext,
+		nsgif_span_t *spans,
+		size_t count)
+{
+	const nsgif_extension_info_t *info;
+	const uint8_t *pos;
 
-		ret = nsgif__parse_logical_screen_descriptor(gif, &nsgif_data);
-		if (ret != NSGIF_OK) {
-			return ret;
-		}
+	if (ext >= gif->info.extension_count) {
+		return 0;
+	}
 
-		/* Remember we've done this now */
-		gif->buf_pos = nsgif_data - gif->buf;
+	info = &gif->extensions[ext];
+	pos = gif->buf + info->header_offset + info->header_len;
 
-		/* Some broken GIFs report the size as the screen size they
-		 * were created in. As such, we detect for the common cases and
-		 * set the sizes as 0 if they are found which results in the
-		 * GIF being the maximum size of the frames.
-		 */
-		if (((gif->info.width == 640) && (gif->info.height == 480)) ||
-		    ((gif->info.width == 640) && (gif->info.height == 512)) ||
-		    ((gif->info.width == 800) && (gif->info.height == 600)) ||
-		    ((gif->info.width == 1024) && (gif->info.height == 768)) ||
-		    ((gif->info.width == 1280) && (gif->info.height == 1024)) ||
-		    ((gif->info.width == 1600) && (gif->info.height == 1200)) ||
-		    ((gif->info.width == 0) || (gif->info.height == 0)) ||
-		    ((gif->info.width > 2048) || (gif->info.height > 2048))) {
-			gif->info.width = 1;
-			gif->info.height = 1;
-		}
+	for (uint32_t i = 0; i < info->sub_blocks && i < count; i++) {
+		spans[i].data = pos + 1;
+		spans[i].len = pos[0];
+		pos += pos[0] + 1;
+	}
 
-		/* Set the first colour to a value that will never occur in
-		 * reality so we know if we've processed it
-		*/
-		gif->global_colour_table[0] = NSGIF_PROCESS_COLOURS;
+	return info->sub_blocks;
+}
 
-		/* Check if the GIF has no frame data (13-byte header + 1-byte
-		 * termination block) Although generally useless, the GIF
-		 * specification does not expressly prohibit this
-		 */
-		if (gif->buf_len == gif->buf_pos + 1) {
-			if (nsgif_data[0] == NSGIF_TRAILER) {
-				return NSGIF_OK;
-			}
-		}
+/* exported function documented in nsgif.h */
+size_t nsgif_icc_profile(
+		const nsgif_t *gif,
+		uint8_t *buffer,
+		size_t len)
+{
+	const uint8_t *end = gif->buf + gif->buf_len;
+	const uint8_t *pos;
+	size_t size = 0;
+
+	if (gif->info.icc_profile == false) {
+		return 0;
 	}
 
-	/*  Do the colour map if we haven't already. As the top byte is always
-	 *  0xff or 0x00 depending on the transparency we know if it's been
-	 *  filled in.
-	 */
-	if (gif->global_colour_table[0] == NSGIF_PROCESS_COLOURS) {
-		/* Check for a global colour map signified by bit 7 */
-		if (gif->info.global_palette) {
-			size_t remaining = gif->buf + gif->buf_len - nsgif_data;
-			size_t used;
+	/* Find the profile size, ensuring we have all of it. */
+	pos = gif->buf + gif->icc_offset;
+	while (pos < end && pos[0] != NSGIF_BLOCK_TERMINATOR) {
+		size += pos[0];
+		pos += pos[0] + 1;
+	}
+	if (pos >= end) {
+		return 0;
+	}
 
-			ret = nsgif__colour_table_extract(
-					gif->global_colour_table,
-					&gif->colour_layout,
-					gif->colour_table_size,
-					nsgif_data, remaining, &used, true);
-			if (ret != NSGIF_OK) {
-				return ret;
-			}
+	if (buffer != NULL && len >= size) {
+		pos = gif->buf + gif->icc_offset;
+		while (pos[0] != NSGIF_BLOCK_TERMINATOR) {
+			memcpy(buffer, pos + 1, pos[0]);
+			buffer += pos[0];
+			pos += pos[0] + 1;
+		}
+	}
 
-			nsgif_data += used;
-			gif->buf_pos = (nsgif_data - gif->buf);
-		} else {
-			/* Create a default colour table with the first two
-			 * colours as black and white. */
-			uint8_t *entry = (uint8_t *)gif->global_colour_table;
+	return size;
+}
 
-			/* Black */
-			entry[gif->colour_layout.r] = 0x00;
-			entry[gif->colour_layout.g] = 0x00;
-			entry[gif->colour_layout.b] = 0x00;
-			entry[gif->colour_layout.a] = 0xFF;
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_placeholder(
+		nsgif_t *gif,
+		uint32_t *buffer,
+		uint32_t width,
+		uint32_t height)
+{
+	uint32_t local_colour_table[NSGIF_MAX_COLOURS];
+	const uint32_t *colours = gif->global_colour_table;
+	struct nsgif_frame *frame;
+	const uint8_t *pos;
+	const uint8_t *end;
+	nsgif_error ret;
 
-			entry += sizeof(uint32_t);
+	if (gif->info.frame_count == 0) {
+		return NSGIF_ERR_BAD_FRAME;
+	}
 
-			/* White */
-			entry[gif->colour_layout.r] = 0xFF;
-			entry[gif->colour_layout.g] = 0xFF;
-			entry[gif->colour_layout.b] = 0xFF;
-			entry[gif->colour_layout.a] = 0xFF;
+	for (size_t i = 0; i < (size_t)width * height; i++) {
+		buffer[i] = NSGIF_TRANSPARENT_COLOUR;
+	}
 
-			gif->colour_table_size = 2;
-		}
+	frame = nsgif__frame(gif, 0);
+	if (frame->info.display == false ||
+	    gif->info.width == 0 || gif->info.height == 0) {
+		return NSGIF_OK;
+	}
 
-		if (gif->info.global_palette &&
-		    gif->bg_index < gif->colour_table_size) {
-			size_t bg_idx = gif->bg_index;
-			gif->info.background = gif->global_colour_table[bg_idx];
-		} else {
-			gif->info.background = gif->global_colour_table[0];
-		}
+	pos = gif->buf + frame->frame_offset;
+	end = gif->buf + nsgif__frame_data_len(gif, frame);
+
+	ret = nsgif__parse_frame_extensions(gif, frame, 0, &pos, false);
+	if (ret != NSGIF_OK) {
+		return ret;
 	}
 
-	if (gif->lzw_ctx == NULL) {
-		lzw_result res = lzw_context_create(
-				(struct lzw_ctx **)&gif->lzw_ctx);
-		if (res != LZW_OK) {
-			return nsgif__error_from_lzw(res);
+	ret = nsgif__parse_image_descriptor(gif, frame, &pos, false);
+	if (ret != NSGIF_OK) {
+		return ret;
+	}
+
+	if (frame->flags & NSGIF_COLOUR_TABLE_MASK) {
+		/* Decoded here, so the state the next frame decode starts
+		 * from isn't changed. */
+		size_t used;
+
+		ret = nsgif__colour_table_extract(gif, local_colour_table,
+				2 << (frame->flags &
+					NSGIF_COLOUR_TABLE_SIZE_MASK),
+				pos, end - pos, &used, true);
+		if (ret != NSGIF_OK) {
+			return ret;
 		}
+		pos += used;
+		colours = local_colour_table;
 	}
 
-	/* Try to initialise all frames. */
-	do {
-		frames = gif->info.frame_count;
-		ret = nsgif__process_frame(gif, frames, false);
-	} while (gif->info.frame_count > frames);
+	if (pos >= end || pos[0] >= LZW_CODE_MAX) {
+		/* No image data, or invalid code size. */
+		return NSGIF_OK;
+	}
 
-	if (ret == NSGIF_ERR_END_OF_DATA && gif->info.frame_count > 0) {
+	ret = nsgif__decode_sampled(gif, frame, colours, pos,
+			buffer, width, height);
+	if (gif->data_complete && ret == NSGIF_ERR_END_OF_DATA) {
+		/* This is all the data there is, so make do. */
 		ret = NSGIF_OK;
 	}
 
 	return ret;
 }
 
-/* exported function documented in nsgif.h */
-void nsgif_data_complete(
-		nsgif_t *gif)
+/**
+ * Get the area of a bitmap that isn't transparent.
+ *
+ * \param[in]  gif     The gif object.
+ * \param[in]  bitmap  The bitmap to check.
+ * \param[out] rect    Returns bounding box of non-transparent pixels.
+ */
+static void nsgif__visible_rect(
+		const struct nsgif *gif,
+		const uint32_t *bitmap,
+		nsgif_rect_t *rect)
 {
-	if (gif->data_complete == false) {
-		uint32_t start = gif->info.frame_count;
-		uint32_t end = gif->frame_count_partial;
-
-		for (uint32_t f = start; f < end; f++) {
-			nsgif_frame *frame = &gif->frames[f];
+	*rect = (nsgif_rect_t) {
+		.x0 = gif->info.width,
+		.y0 = gif->info.height,
+	};
 
-			if (frame->lzw_data_length > 0) {
-				frame->info.display = true;
-				gif->info.frame_count = f + 1;
+	for (uint32_t y = 0; y < gif->info.height; y++) {
+		const uint32_t *row = bitmap + y * gif->rowspan;
 
-				if (f == 0) {
-					frame->info.transparency = true;
-				}
-				break;
+		for (uint32_t x = 0; x < gif->info.width; x++) {
+			if (row[x] == NSGIF_TRANSPARENT_COLOUR) {
+				continue;
 			}
+			if (rect->x0 > x)     rect->x0 = x;
+			if (rect->x1 < x + 1) rect->x1 = x + 1;
+			if (rect->y0 > y)     rect->y0 = y;
+			rect->y1 = y + 1;
 		}
 	}
 
-	gif->data_complete = true;
+	if (rect->x0 >= rect->x1) {
+		*rect = (nsgif_rect_t) { 0 };
+	}
 }
 
-static void nsgif__redraw_rect_extend(
-		const nsgif_rect_t *frame,
-		nsgif_rect_t *redraw)
+/**
+ * Decode a frame for a texture atlas.
+ *
+ * Frames with truncated or corrupt image data are kept as far as they were
+ * decoded, as they would be shown by a client.
+ *
+ * \param[in]  gif     The gif object.
+ * \param[in]  frame   The frame to decode.
+ * \param[out] bitmap  Returns the bitmap holding the decoded frame.
+ * \return NSGIF_OK on success, or NSGIF_ERR_OOM.
+ */
+static nsgif_error nsgif__atlas_decode(
+		struct nsgif *gif,
+		uint32_t frame,
+		const uint32_t **bitmap)
 {
-	if (redraw->x1 == 0 || redraw->y1 == 0) {
-		*redraw = *frame;
-	} else {
-		if (redraw->x0 > frame->x0) {
-			redraw->x0 = frame->x0;
-		}
-		if (redraw->x1 < frame->x1) {
-			redraw->x1 = frame->x1;
-		}
-		if (redraw->y0 > frame->y0) {
-			redraw->y0 = frame->y0;
-		}
-		if (redraw->y1 < frame->y1) {
-			redraw->y1 = frame->y1;
-		}
+	nsgif_bitmap_t *image;
+	nsgif_error ret;
+
+	ret = nsgif_frame_decode(gif, frame, &image);
+	if (ret == NSGIF_ERR_OOM) {
+		return ret;
 	}
+
+	*bitmap = nsgif__bitmap_get(gif);
+	if (*bitmap == NULL) {
+		return NSGIF_ERR_OOM;
+	}
+
+	return NSGIF_OK;
 }
 
-static uint32_t nsgif__frame_next(
-		const nsgif_t *gif,
-		bool partial,
-		uint32_t frame)
+/**
+ * Add the decoded frame's trimmed image, reusing a matching image.
+ *
+ * Images are matched by their area and the hash of their pixels, so no
+ * copy of the pixels is kept. Matches are only candidates, which are
+ * checked against the pixels when the images are copied into the atlas.
+ *
+ * \param[in]     gif        The gif object.
+ * \param[in]     params     The atlas parameters.
+ * \param[in]     bitmap     The bitmap holding the decoded frame.
+ * \param[in]     frame_idx  The decoded frame.
+ * \param[in,out] images     The images so far, updated on exit.
+ * \param[in,out] count      The number of images, updated on exit.
+ * \param[out]    index      Returns the index of the frame's image.
+ */
+static void nsgif__atlas_image_add(
+		const struct nsgif *gif,
+		const nsgif_atlas_params_t *params,
+		const uint32_t *bitmap,
+		uint32_t frame_idx,
+		struct nsgif_atlas_image *images,
+		uint32_t *count,
+		uint32_t *index)
 {
-	uint32_t frames = partial ?
-			gif->frame_count_partial :
-			gif->info.frame_count;
+	struct nsgif_atlas_image *image = &images[*count];
+	size_t row_bytes;
 
-	if (frames == 0) {
-		return NSGIF_FRAME_INVALID;
+	if (params->trim) {
+		nsgif__visible_rect(gif, bitmap, &image->rect);
+	} else {
+		image->rect = (nsgif_rect_t) {
+			.x1 = gif->info.width,
+			.y1 = gif->info.height,
+		};
 	}
 
-	frame++;
-	return (frame >= frames) ? 0 : frame;
-}
+	row_bytes = (image->rect.x1 - image->rect.x0) * sizeof(*bitmap);
 
-static nsgif_error nsgif__next_displayable_frame(
-		const nsgif_t *gif,
-		uint32_t *frame,
-		uint32_t *delay)
-{
-	uint32_t next = *frame;
+	image->hash = NSGIF_HASH_INIT;
+	for (uint32_t y = image->rect.y0; y < image->rect.y1; y++) {
+		image->hash = nsgif__hash(image->hash, (const uint8_t *)
+				(bitmap + image->rect.x0 + y * gif->rowspan),
+				row_bytes);
+	}
 
-	do {
-		next = nsgif__frame_next(gif, false, next);
-		if (next <= *frame && *frame != NSGIF_FRAME_INVALID &&
-				gif->data_complete == false) {
-			return NSGIF_ERR_END_OF_DATA;
+	for (uint32_t i = 0; params->dedupe && i < *count; i++) {
+		const struct nsgif_atlas_image *prev = &images[i];
 
-		} else if (next == *frame || next == NSGIF_FRAME_INVALID) {
-			return NSGIF_ERR_FRAME_DISPLAY;
+		if (prev->hash == image->hash &&
+		    memcmp(&prev->rect, &image->rect,
+				sizeof(image->rect)) == 0) {
+			*index = i;
+			return;
 		}
+	}
 
-		if (delay != NULL) {
-			*delay += gif->frames[next].info.delay;
+	image->frame = frame_idx;
+	*index = (*count)++;
+}
+
+/**
+ * Place atlas images in rows, left to right.
+ *
+ * \param[in]     params  The atlas parameters.
+ * \param[in,out] images  The images to place, updated with positions.
+ * \param[in]     count   The number of images.
+ * \param[out]    width   Returns the atlas width.
+ * \param[out]    height  Returns the atlas height.
+ */
+static void nsgif__atlas_layout(
+		const nsgif_atlas_params_t *params,
+		struct nsgif_atlas_image *images,
+		uint32_t count,
+		uint32_t *width,
+		uint32_t *height)
+{
+	uint32_t pad = params->padding;
+	uint32_t max_width = params->max_width;
+	uint32_t row_height = 0;
+	uint32_t x = pad;
+	uint32_t y = pad;
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t w = images[i].rect.x1 - images[i].rect.x0;
+		if (max_width < pad + w + pad) {
+			max_width = pad + w + pad;
 		}
+	}
 
-	} while (gif->frames[next].info.display == false);
+	*width = pad;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t w = images[i].rect.x1 - images[i].rect.x0;
+		uint32_t h = images[i].rect.y1 - images[i].rect.y0;
 
-	*frame = next;
-	return NSGIF_OK;
-}
+		if (x + w + pad > max_width) {
+			/* Start a new row. */
+			y += row_height + pad;
+			row_height = 0;
+			x = pad;
+		}
 
-static inline bool nsgif__animation_complete(int count, int max)
-{
-	if (max == 0) {
-		return false;
+		images[i].x = x;
+		images[i].y = y;
+
+		x += w + pad;
+		if (*width < x) {
+			*width = x;
+		}
+		if (row_height < h) {
+			row_height = h;
+		}
 	}
+	*height = y + row_height + pad;
 
-	return (count >= max);
+	/* Every image may be trimmed to nothing. */
+	if (*width == 0) {
+		*width = 1;
+	}
+	if (*height == 0) {
+		*height = 1;
+	}
 }
 
-nsgif_error nsgif_reset(
-		nsgif_t *gif)
+/**
+ * Give a frame its own image, rather than sharing a matched one.
+ *
+ * \param[in]     images       The images.
+ * \param[in,out] count        The number of images, updated on exit.
+ * \param[in,out] image_index  Each frame's image index, updated on exit.
+ * \param[in]     frame_idx    The frame that doesn't match its image.
+ */
+static void nsgif__atlas_image_split(
+		struct nsgif_atlas_image *images,
+		uint32_t *count,
+		uint32_t *image_index,
+		uint32_t frame_idx)
 {
-	gif->loop_count = 0;
-	gif->frame = NSGIF_FRAME_INVALID;
-
-	return NSGIF_OK;
+	images[*count] = images[image_index[frame_idx]];
+	images[*count].frame = frame_idx;
+	image_index[frame_idx] = (*count)++;
 }
 
-/* exported function documented in nsgif.h */
-nsgif_error nsgif_frame_prepare(
-		nsgif_t *gif,
-		nsgif_rect_t *area,
-		uint32_t *delay_cs,
-		uint32_t *frame_new)
+/**
+ * Lay out and create the atlas, and copy the frame images into it.
+ *
+ * The frames are decoded again, in the same order so they come out the
+ * same as when the images were found. Each frame that was matched to an
+ * earlier frame's image is compared with the image in the atlas. If the
+ * pixels differ, the frame is given its own image, and the atlas must be
+ * made again.
+ *
+ * \param[in]     gif          The gif object.
+ * \param[in]     params       The atlas parameters.
+ * \param[in,out] images       The images, updated on exit.
+ * \param[in,out] count        The number of images, updated on exit.
+ * \param[in,out] image_index  Each frame's image index, updated on exit.
+ * \param[out]    atlas        Returns the atlas bitmap.
+ * \param[out]    split        Returns whether any frame was given its own
+ *                             image.
+ * 
+eturn NSGIF_OK on success, or NSGIF_ERR_OOM.
+ */
+static nsgif_error nsgif__atlas_fill(
+		struct nsgif *gif,
+		const nsgif_atlas_params_t *params,
+		struct nsgif_atlas_image *images,
+		uint32_t *count,
+		uint32_t *image_index,
+		nsgif_bitmap_t **atlas,
+		bool *split)
 {
+	uint32_t frame_count = gif->info.frame_count;
+	uint32_t width, height;
+	uint32_t *pixels;
+	uint32_t rowspan;
 	nsgif_error ret;
-	nsgif_rect_t rect = {
-		.x1 = 0,
-		.y1 = 0,
-	};
-	uint32_t delay = 0;
-	uint32_t frame = gif->frame;
 
-	if (gif->frame != NSGIF_FRAME_INVALID &&
-	    gif->frame < gif->info.frame_count &&
-	    gif->frames[gif->frame].info.display) {
-		rect = gif->frames[gif->frame].info.rect;
-	}
+	*split = false;
+	nsgif__atlas_layout(params, images, *count, &width, &height);
 
-	if (nsgif__animation_complete(
-			gif->loop_count,
-			gif->info.loop_max)) {
-		return NSGIF_ERR_ANIMATION_END;
+	*atlas = gif->bitmap.create(width, height);
+	if (*atlas == NULL) {
+		return NSGIF_ERR_OOM;
 	}
 
-	ret = nsgif__next_displayable_frame(gif, &frame, &delay);
-	if (ret != NSGIF_OK) {
-		return ret;
+	rowspan = width;
+	if (gif->bitmap.get_rowspan) {
+		rowspan = gif->bitmap.get_rowspan(*atlas);
 	}
 
-	if (gif->frame != NSGIF_FRAME_INVALID && frame < gif->frame) {
-		gif->loop_count++;
+	pixels = (void *)gif->bitmap.get_buffer(*atlas);
+	if (pixels == NULL) {
+		return NSGIF_ERR_OOM;
 	}
+	memset(pixels, NSGIF_TRANSPARENT_COLOUR,
+			(size_t)rowspan * height * sizeof(*pixels));
 
-	if (gif->data_complete) {
-		/* Check for last frame, which has infinite delay. */
-
-		if (gif->info.frame_count == 1) {
-			delay = NSGIF_INFINITE;
-		} else if (gif->info.loop_max != 0) {
-			uint32_t frame_next = frame;
+	for (uint32_t f = 0; f < frame_count; f++) {
+		const struct nsgif_atlas_image *image = &images[image_index[f]];
+		size_t row_bytes = (image->rect.x1 - image->rect.x0) *
+				sizeof(*pixels);
+		bool copy = (image->frame == f);
+		const uint32_t *bitmap;
 
-			ret = nsgif__next_displayable_frame(gif,
-					&frame_next, NULL);
-			if (ret != NSGIF_OK) {
-				return ret;
-			}
+		ret = nsgif__atlas_decode(gif, f, &bitmap);
+		if (ret != NSGIF_OK) {
+			return ret;
+		}
 
-			if (gif->data_complete && frame_next < frame) {
-				if (nsgif__animation_complete(
-						gif->loop_count + 1,
-						gif->info.loop_max)) {
-					delay = NSGIF_INFINITE;
-				}
+		for (uint32_t y = image->rect.y0; y < image->rect.y1; y++) {
+			uint32_t *dst = pixels + image->x +
+					(image->y + y - image->rect.y0) *
+					rowspan;
+			const uint32_t *src = bitmap + image->rect.x0 +
+					y * gif->rowspan;
+
+			if (copy) {
+				memcpy(dst, src, row_bytes);
+
+			} else if (memcmp(dst, src, row_bytes) != 0) {
+				/* Only the hash matched. */
+				nsgif__atlas_image_split(images, count,
+						image_index, f);
+				*split = true;
+				break;
 			}
 		}
 	}
 
-	gif->frame = frame;
-	nsgif__redraw_rect_extend(&gif->frames[frame].info.rect, &rect);
-
-	if (delay < gif->delay_min) {
-		delay = gif->delay_default;
+	if (gif->bitmap.modified) {
+		gif->bitmap.modified(*atlas);
 	}
 
-	*frame_new = gif->frame;
-	*delay_cs = delay;
-	*area = rect;
-
 	return NSGIF_OK;
 }
 
 /* exported function documented in nsgif.h */
-nsgif_error nsgif_frame_decode(
+nsgif_error nsgif_atlas_create(
 		nsgif_t *gif,
-		uint32_t frame,
-		nsgif_bitmap_t **bitmap)
+		const nsgif_atlas_params_t *params,
+		nsgif_atlas_frame_t *table,
+		nsgif_bitmap_t **atlas)
 {
-	uint32_t start_frame;
-	nsgif_error ret = NSGIF_OK;
+	struct nsgif_atlas_image *images;
+	uint32_t frame_count = gif->info.frame_count;
+	uint32_t *image_index;
+	uint32_t image_count = 0;
+	nsgif_error ret;
 
-	if (frame >= gif->info.frame_count) {
+	if (frame_count == 0) {
 		return NSGIF_ERR_BAD_FRAME;
 	}
 
-	if (gif->decoded_frame == frame) {
-		*bitmap = gif->frame_image;
-		return NSGIF_OK;
-
-	} else if (gif->decoded_frame >= frame ||
-	           gif->decoded_frame == NSGIF_FRAME_INVALID) {
-		/* Can skip to first frame or restart. */
-		start_frame = 0;
-	} else {
-		start_frame = nsgif__frame_next(
-				gif, false, gif->decoded_frame);
+	*atlas = NULL;
+	images = calloc(frame_count, sizeof(*images));
+	image_index = calloc(frame_count, sizeof(*image_index));
+	if (images == NULL || image_index == NULL) {
+		ret = NSGIF_ERR_OOM;
+		goto cleanup;
 	}
 
-	for (uint32_t f = start_frame; f <= frame; f++) {
-		ret = nsgif__process_frame(gif, f, true);
+	/* Find each frame's image, to lay out the atlas. */
+	for (uint32_t f = 0; f < frame_count; f++) {
+		const uint32_t *bitmap;
+
+		ret = nsgif__atlas_decode(gif, f, &bitmap);
 		if (ret != NSGIF_OK) {
-			return ret;
+			goto cleanup;
 		}
+
+		nsgif__atlas_image_add(gif, params, bitmap, f,
+				images, &image_count, &image_index[f]);
 	}
 
-	*bitmap = gif->frame_image;
-	return ret;
-}
+	/* Each split adds an image, so this ends with every frame that
+	 * shares an image matching it. */
+	for (;;) {
+		bool split;
 
-/* exported function documented in nsgif.h */
-const nsgif_info_t *nsgif_get_info(const nsgif_t *gif)
-{
-	return &gif->info;
+		ret = nsgif__atlas_fill(gif, params, images, &image_count,
+				image_index, atlas, &split);
+		if (ret != NSGIF_OK || !split) {
+			break;
+		}
+
+		gif->bitmap.destroy(*atlas);
+		*atlas = NULL;
+	}
+	if (ret != NSGIF_OK) {
+		goto cleanup;
+	}
+
+	for (uint32_t f = 0; f < frame_count; f++) {
+		const struct nsgif_atlas_image *image = &images[image_index[f]];
+		uint32_t delay = nsgif__frame(gif, f)->info.delay;
+
+		table[f].rect = image->rect;
+		table[f].atlas = (nsgif_rect_t) {
+			.x0 = image->x,
+			.y0 = image->y,
+			.x1 = image->x + image->rect.x1 - image->rect.x0,
+			.y1 = image->y + image->rect.y1 - image->rect.y0,
+		};
+		table[f].image = image_index[f];
+		table[f].delay = (delay < gif->delay_min) ?
+				gif->delay_default : delay;
+	}
+
+	ret = NSGIF_OK;
+
+cleanup:
+	if (ret != NSGIF_OK && *atlas != NULL) {
+		gif->bitmap.destroy(*atlas);
+		*atlas = NULL;
+	}
+	free(images);
+	free(image_index);
+
+	return ret;
 }
 
 /* exported function documented in nsgif.h */
-const nsgif_frame_info_t *nsgif_get_frame_info(
+const nsgif_colour_stats_t *nsgif_get_frame_colour_stats(
 		const nsgif_t *gif,
 		uint32_t frame)
 {
@@ -1995,7 +6268,7 @@ const nsgif_frame_info_t *nsgif_get_frame_info(
 		return NULL;
 	}
 
-	return &gif->frames[frame].info;
+	return nsgif__frame(gif, frame)->colour_stats;
 }
 
 /* exported function documented in nsgif.h */
@@ -2023,13 +6296,13 @@ bool nsgif_local_palette(
 		return false;
 	}
 
-	f = &gif->frames[frame];
+	f = nsgif__frame(gif, frame);
 	if (f->info.local_palette == false) {
 		return false;
 	}
 
 	*entries = 2 << (f->flags & NSGIF_COLOUR_TABLE_SIZE_MASK);
-	nsgif__colour_table_decode(table, &gif->colour_layout,
+	nsgif__colour_table_decode(gif, table,
 			*entries, gif->buf + f->colour_table_offset);
 
 	return true;
@@ -2048,6 +6321,7 @@ const char *nsgif_strerror(nsgif_error err)
 		[NSGIF_ERR_DATA_COMPLETE] = "Can't add data to completed GIF",
 		[NSGIF_ERR_FRAME_DISPLAY] = "Frame can't be displayed",
 		[NSGIF_ERR_ANIMATION_END] = "Animation complete",
+		[NSGIF_ERR_FORMAT]        = "Unsupported output format",
 	};
 
 	if (err >= NSGIF_ARRAY_LEN(str) || str[err] == NULL) {
@@ -519,6 +519,19 @@ lzw_result lzw_decode(struct lzw_ctx *ctx,
 	return LZW_OK;
 }
 
+/* Exported function, documented in lzw.h */
+size_t lzw_decode_position(const struct lzw_ctx *ctx)
+{
+	const struct lzw_read_ctx *input = &ctx->input;
+
+	if (input->sb_bit < input->sb_bit_count) {
+		return (size_t)(input->sb_data - input->data) +
+				(input->sb_bit >> 3);
+	}
+
+	return input->data_sb_next;
+}
+
 /**
  * Write colour mapped values for this code to the output.
  *
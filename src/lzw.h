@@ -87,6 +87,15 @@ lzw_result lzw_decode(struct lzw_ctx *ctx,
 		const uint8_t *restrict *const restrict output_data,
 		uint32_t *restrict                      output_written);
 
+/**
+ * Get the position that decoding has reached in the input data.
+ *
+ * \param[in]  ctx  LZW reading context.
+ * \return Offset in the input data of the byte holding the next code to read,
+ *         or of the next sub-block size byte.
+ */
+size_t lzw_decode_position(const struct lzw_ctx *ctx);
+
 /**
  * Initialise an LZW decompression context for decoding to colour map values.
  *
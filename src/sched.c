@@ -0,0 +1,437 @@
+/*
+ * Copyright 2026 Michael Drake <tlsa@netsurf-browser.org>
+ *
+ * This file is part of NetSurf's libnsgif, http://www.netsurf-browser.org/
+ * Licenced under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "nsgif.h"
+
+/**
+ * \file
+ * \brief Animation scheduler (implementation)
+ *
+ * Drives many animations through the public API, within a decode budget.
+ */
+
+/** Longest wait before retrying a frame that missed the budget, in cs. */
+#define NSGIF_SCHED_RETRY 10
+
+/** An animation registered with a scheduler. */
+struct nsgif_sched_anim {
+	/** The animation. */
+	nsgif_t *gif;
+	/** Client callback for new frames. */
+	nsgif_sched_frame_cb frame_cb;
+	/** Client private word for `frame_cb`. */
+	void *pw;
+	/** The animation's priority. */
+	nsgif_priority priority;
+
+	/** Whether the animation's first frame has been prepared. */
+	bool started;
+	/** Whether the animation has no more frames to prepare. */
+	bool done;
+	/** Whether the animation is waiting for more source data. */
+	bool stalled;
+	/** Whether a prepared frame is waiting to be decoded. */
+	bool pending;
+
+	/** Frame waiting to be decoded. */
+	uint32_t frame;
+	/** Area to redraw when the waiting frame is shown. */
+	nsgif_rect_t area;
+	/** Time the waiting frame fell due. */
+	uint64_t pending_since;
+	/** Time the next frame falls due. */
+	uint64_t due;
+	/** Time left until the next frame falls due, while hidden. */
+	uint64_t remaining;
+};
+
+/** Scheduler for many animations. */
+struct nsgif_sched {
+	/** Registered animations. */
+	struct nsgif_sched_anim *anims;
+	/** Animations with a frame to decode, in priority order. */
+	struct nsgif_sched_anim **order;
+	/** Number of registered animations. */
+	size_t count;
+	/** Number of entries allocated in `anims` and `order`. */
+	size_t alloc;
+
+	/** Pixels to decode, clear or restore per tick. */
+	size_t budget;
+	/** Tick grid interval for wakeups in centiseconds, or zero. */
+	uint32_t quantum;
+	/** Time of the most recent tick. */
+	uint64_t now;
+};
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_sched_create(
+		size_t budget,
+		nsgif_sched_t **sched_out)
+{
+	nsgif_sched_t *sched;
+
+	sched = calloc(1, sizeof(*sched));
+	if (sched == NULL) {
+		return NSGIF_ERR_OOM;
+	}
+
+	sched->budget = budget;
+
+	*sched_out = sched;
+	return NSGIF_OK;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_sched_destroy(
+		nsgif_sched_t *sched)
+{
+	if (sched == NULL) {
+		return;
+	}
+
+	free(sched->anims);
+	free(sched->order);
+	free(sched);
+}
+
+/**
+ * Find an animation registered with a scheduler.
+ *
+ * \param[in] sched  The scheduler.
+ * \param[in] gif    The animation to find.
+ * \return the registered animation, or NULL if not registered.
+ */
+static struct nsgif_sched_anim *nsgif__sched_find(
+		nsgif_sched_t *sched,
+		const nsgif_t *gif)
+{
+	for (size_t i = 0; i < sched->count; i++) {
+		if (sched->anims[i].gif == gif) {
+			return &sched->anims[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* exported function documented in nsgif.h */
+nsgif_error nsgif_sched_add(
+		nsgif_sched_t *sched,
+		nsgif_t *gif,
+		nsgif_priority priority,
+		nsgif_sched_frame_cb frame,
+		void *pw)
+{
+	struct nsgif_sched_anim *anim;
+
+	anim = nsgif__sched_find(sched, gif);
+	if (anim != NULL) {
+		anim->frame_cb = frame;
+		anim->pw = pw;
+		nsgif_sched_set_priority(sched, gif, priority);
+		return NSGIF_OK;
+	}
+
+	if (sched->count == sched->alloc) {
+		size_t alloc = sched->alloc ? sched->alloc * 2 : 8;
+		struct nsgif_sched_anim **order;
+		struct nsgif_sched_anim *anims;
+
+		/* Both arrays are allocated before either is replaced, so
+		 * they stay the same size if either allocation fails. */
+		anims = malloc(alloc * sizeof(*anims));
+		order = malloc(alloc * sizeof(*order));
+		if (anims == NULL || order == NULL) {
+			free(anims);
+			free(order);
+			return NSGIF_ERR_OOM;
+		}
+
+		if (sched->count > 0) {
+			memcpy(anims, sched->anims,
+					sched->count * sizeof(*anims));
+		}
+		free(sched->anims);
+		free(sched->order);
+
+		sched->anims = anims;
+		sched->order = order;
+		sched->alloc = alloc;
+	}
+
+	sched->anims[sched->count++] = (struct nsgif_sched_anim) {
+		.gif = gif,
+		.frame_cb = frame,
+		.pw = pw,
+		.priority = priority,
+	};
+
+	return NSGIF_OK;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_sched_remove(
+		nsgif_sched_t *sched,
+		nsgif_t *gif)
+{
+	struct nsgif_sched_anim *anim = nsgif__sched_find(sched, gif);
+
+	if (anim != NULL) {
+		*anim = sched->anims[--sched->count];
+	}
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_sched_set_priority(
+		nsgif_sched_t *sched,
+		nsgif_t *gif,
+		nsgif_priority priority)
+{
+	struct nsgif_sched_anim *anim = nsgif__sched_find(sched, gif);
+	bool was_hidden;
+
+	if (anim == NULL || anim->priority == priority) {
+		return;
+	}
+
+	was_hidden = (anim->priority == NSGIF_PRIORITY_HIDDEN);
+	anim->priority = priority;
+
+	if (anim->started == false) {
+		return;
+	}
+
+	if (priority == NSGIF_PRIORITY_HIDDEN) {
+		/* Pause. */
+		anim->remaining = anim->due > sched->now ?
+				anim->due - sched->now : 0;
+	} else if (was_hidden) {
+		/* Resume. */
+		anim->due = sched->now + anim->remaining;
+		if (anim->pending) {
+			anim->pending_since = sched->now;
+		}
+	}
+}
+
+/**
+ * Add an area to an animation's area to redraw.
+ *
+ * \param[in] anim  The animation.
+ * \param[in] area  The area to add.
+ */
+static void nsgif__sched_area_add(
+		struct nsgif_sched_anim *anim,
+		const nsgif_rect_t *area)
+{
+	if (anim->pending == false) {
+		anim->area = *area;
+		return;
+	}
+
+	if (anim->area.x0 > area->x0) anim->area.x0 = area->x0;
+	if (anim->area.y0 > area->y0) anim->area.y0 = area->y0;
+	if (anim->area.x1 < area->x1) anim->area.x1 = area->x1;
+	if (anim->area.y1 < area->y1) anim->area.y1 = area->y1;
+}
+
+/**
+ * Prepare an animation's frames that have fallen due.
+ *
+ * If more than one frame has fallen due, the animation skips ahead to the
+ * latest, which is left waiting to be decoded. An animation that has fallen
+ * more than a whole loop behind drops the lost time, rather than preparing
+ * every frame it missed.
+ *
+ * \param[in] sched  The scheduler.
+ * \param[in] anim   The animation to advance.
+ */
+static void nsgif__sched_advance(
+		const nsgif_sched_t *sched,
+		struct nsgif_sched_anim *anim)
+{
+	uint32_t frames = nsgif_get_info(anim->gif)->frame_count;
+
+	if (anim->started == false) {
+		anim->due = sched->now;
+	}
+
+	anim->stalled = false;
+	while (anim->done == false && anim->due <= sched->now) {
+		nsgif_rect_t area;
+		uint32_t delay;
+		uint32_t frame;
+		nsgif_error ret;
+
+		ret = nsgif_frame_prepare(anim->gif, &area, &delay, &frame);
+		if (ret == NSGIF_ERR_END_OF_DATA) {
+			/* Wait for more data. */
+			anim->stalled = true;
+			return;
+		} else if (ret != NSGIF_OK) {
+			anim->done = true;
+			return;
+		}
+
+		nsgif__sched_area_add(anim, &area);
+		if (anim->pending == false) {
+			anim->pending = true;
+			anim->pending_since = anim->due;
+		}
+		anim->frame = frame;
+		anim->started = true;
+
+		if (delay == NSGIF_INFINITE) {
+			anim->done = true;
+		} else if (frames-- == 0) {
+			/* Behind by more than a loop. */
+			anim->due = sched->now + delay;
+		} else {
+			anim->due += delay;
+		}
+	}
+}
+
+/**
+ * Compare the decode order of two animations.
+ *
+ * Higher priority animations come first, then those waiting the longest.
+ *
+ * \param[in] a  Pointer to the first animation pointer.
+ * \param[in] b  Pointer to the second animation pointer.
+ * \return negative, zero or positive, as for qsort.
+ */
+static int nsgif__sched_cmp(const void *a, const void *b)
+{
+	const struct nsgif_sched_anim *anim_a = *(const void * const *)a;
+	const struct nsgif_sched_anim *anim_b = *(const void * const *)b;
+
+	if (anim_a->priority != anim_b->priority) {
+		return anim_a->priority < anim_b->priority ? -1 : 1;
+	}
+
+	if (anim_a->pending_since != anim_b->pending_since) {
+		return anim_a->pending_since < anim_b->pending_since ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/* exported function documented in nsgif.h */
+void nsgif_sched_set_quantum(
+		nsgif_sched_t *sched,
+		uint32_t quantum)
+{
+	sched->quantum = quantum;
+}
+
+/* exported function documented in nsgif.h */
+uint64_t nsgif_sched_wakeup(
+		const nsgif_sched_t *sched)
+{
+	uint64_t wakeup = UINT64_MAX;
+	uint64_t retry = sched->now + (sched->quantum > NSGIF_SCHED_RETRY ?
+			sched->quantum : NSGIF_SCHED_RETRY);
+
+	for (size_t i = 0; i < sched->count; i++) {
+		const struct nsgif_sched_anim *anim = &sched->anims[i];
+		uint64_t due;
+
+		if (anim->priority == NSGIF_PRIORITY_HIDDEN) {
+			continue;
+		}
+
+		if (anim->pending) {
+			/* Missed out on the budget. Retrying on every tick
+			 * would poll while the scheduler is overloaded, so
+			 * wait for the next frame, which it would skip ahead
+			 * to anyway, or the retry time, if sooner. */
+			due = (anim->done || anim->due > retry) ?
+					retry : anim->due;
+		} else if (anim->stalled || anim->done) {
+			continue;
+		} else if (anim->started == false) {
+			due = sched->now;
+		} else {
+			due = anim->due;
+		}
+
+		if (due < wakeup) {
+			wakeup = due;
+		}
+	}
+
+	if (wakeup != UINT64_MAX && sched->quantum > 1) {
+		uint64_t rem = wakeup % sched->quantum;
+
+		if (rem != 0) {
+			wakeup += sched->quantum - rem;
+		}
+	}
+
+	return wakeup;
+}
+
+/* exported function documented in nsgif.h */
+uint64_t nsgif_sched_tick(
+		nsgif_sched_t *sched,
+		uint64_t now)
+{
+	size_t budget = sched->budget;
+	size_t count = 0;
+
+	sched->now = now;
+
+	for (size_t i = 0; i < sched->count; i++) {
+		struct nsgif_sched_anim *anim = &sched->anims[i];
+
+		if (anim->priority == NSGIF_PRIORITY_HIDDEN) {
+			continue;
+		}
+
+		nsgif__sched_advance(sched, anim);
+		if (anim->pending) {
+			sched->order[count++] = anim;
+		}
+	}
+
+	qsort(sched->order, count, sizeof(*sched->order), nsgif__sched_cmp);
+
+	for (size_t i = 0; i < count; i++) {
+		struct nsgif_sched_anim *anim = sched->order[i];
+		nsgif_frame_cost_t cost;
+		nsgif_bitmap_t *bitmap;
+		size_t pixels = 0;
+		nsgif_error ret;
+
+		if (nsgif_frame_cost(anim->gif, anim->frame, &cost) == NSGIF_OK) {
+			pixels = cost.pixels + cost.disposal;
+		}
+
+		if (pixels > budget && i > 0) {
+			/* Over budget; cheaper frames may still fit. */
+			continue;
+		}
+		budget -= pixels < budget ? pixels : budget;
+
+		anim->pending = false;
+		ret = nsgif_frame_decode(anim->gif, anim->frame, &bitmap);
+		if (ret == NSGIF_OK && anim->frame_cb != NULL) {
+			anim->frame_cb(anim->pw, anim->gif,
+					bitmap, &anim->area);
+		}
+	}
+
+	return nsgif_sched_wakeup(sched);
+}
@@ -10,6 +10,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -31,12 +32,33 @@ static struct nsgif_options {
 	const char *ppm;
 	uint64_t loops;
 	bool palette;
+	bool compare;
+	bool atlas;
+	bool sched;
+	bool threads;
 	bool version;
 	bool info;
 	bool help;
 } nsgif_options;
 
 static const struct cli_table_entry cli_entries[] = {
+	{
+		.s = 'a',
+		.l = "atlas",
+		.t = CLI_BOOL,
+		.v.b = &nsgif_options.atlas,
+		.d = "Compare the frames in a texture atlas with frames "
+		     "decoded in order. Exits with failure on mismatch."
+	},
+	{
+		.s = 'c',
+		.l = "compare",
+		.t = CLI_BOOL,
+		.v.b = &nsgif_options.compare,
+		.d = "Compare frames decoded in each playback mode, and with "
+		     "optional features, with frames decoded in order. "
+		     "Exits with failure on mismatch."
+	},
 	{
 		.s = 'h',
 		.l = "help",
@@ -74,6 +96,24 @@ static const struct cli_table_entry cli_entries[] = {
 		.v.b = &nsgif_options.palette,
 		.d = "Save palette images."
 	},
+	{
+		.s = 's',
+		.l = "sched",
+		.t = CLI_BOOL,
+		.v.b = &nsgif_options.sched,
+		.d = "Play copies of the GIF with an animation scheduler, "
+		     "checking frames come in priority order and hidden "
+		     "animations are paused. Exits with failure on error."
+	},
+	{
+		.s = 't',
+		.l = "threads",
+		.t = CLI_BOOL,
+		.v.b = &nsgif_options.threads,
+		.d = "Decode frames on another thread as scanning finds them, "
+		     "comparing them with frames decoded in order. "
+		     "Exits with failure on mismatch."
+	},
 	{
 		.s = 'V',
 		.l = "version",
@@ -172,6 +212,7 @@ static void print_gif_info(const nsgif_info_t *info)
 	fprintf(stdout, "  max-loops: %"PRIu32"\n", info->loop_max);
 	fprintf(stdout, "  frame-count: %"PRIu32"\n", info->frame_count);
 	fprintf(stdout, "  global palette: %s\n", info->global_palette ? "yes" : "no");
+	fprintf(stdout, "  icc profile: %s\n", info->icc_profile ? "yes" : "no");
 	fprintf(stdout, "  background:\n");
 	fprintf(stdout, "    red: 0x%"PRIx8"\n", bg[0]);
 	fprintf(stdout, "    green: 0x%"PRIx8"\n", bg[1]);
@@ -190,6 +231,12 @@ static void print_gif_frame_info(const nsgif_frame_info_t *info, uint32_t i)
 	fprintf(stdout, "    interlaced: %s\n", info->interlaced ? "yes" : "no");
 	fprintf(stdout, "    display: %s\n", info->display ? "yes" : "no");
 	fprintf(stdout, "    delay: %"PRIu32"\n", info->delay);
+	fprintf(stdout, "    hash: 0x%016"PRIx64"\n", info->hash);
+	fprintf(stdout, "    duplicate: %s\n", info->duplicate ? "yes" : "no");
+	fprintf(stdout, "    data length: %"PRIu32"\n", info->data_length);
+	fprintf(stdout, "    area: %"PRIu32"\n", info->area);
+	fprintf(stdout, "    clipped area: %"PRIu32"\n", info->clipped_area);
+	fprintf(stdout, "    full restore: %s\n", info->full_restore ? "yes" : "no");
 	fprintf(stdout, "    rect:\n");
 	fprintf(stdout, "      x: %"PRIu32"\n", info->rect.x0);
 	fprintf(stdout, "      y: %"PRIu32"\n", info->rect.y0);
@@ -197,6 +244,113 @@ static void print_gif_frame_info(const nsgif_frame_info_t *info, uint32_t i)
 	fprintf(stdout, "      h: %"PRIu32"\n", info->rect.y1 - info->rect.y0);
 }
 
+static void print_gif_frame_cost(const nsgif_t *gif, uint32_t i)
+{
+	nsgif_frame_cost_t cost;
+
+	if (nsgif_frame_cost(gif, i, &cost) != NSGIF_OK) {
+		return;
+	}
+
+	fprintf(stdout, "    cost:\n");
+	fprintf(stdout, "      frames: %"PRIu32"\n", cost.frames);
+	fprintf(stdout, "      data length: %zu\n", cost.data_length);
+	fprintf(stdout, "      pixels: %zu\n", cost.pixels);
+	fprintf(stdout, "      disposal: %zu\n", cost.disposal);
+}
+
+static void print_gif_frame_damage(const nsgif_t *gif)
+{
+	nsgif_rect_t damage;
+
+	if (!nsgif_frame_damage(gif, &damage)) {
+		return;
+	}
+
+	fprintf(stdout, "    damage:\n");
+	fprintf(stdout, "      x: %"PRIu32"\n", damage.x0);
+	fprintf(stdout, "      y: %"PRIu32"\n", damage.y0);
+	fprintf(stdout, "      w: %"PRIu32"\n", damage.x1 - damage.x0);
+	fprintf(stdout, "      h: %"PRIu32"\n", damage.y1 - damage.y0);
+}
+
+static void print_gif_colour(const char *name, uint32_t colour)
+{
+	const uint8_t *c = (uint8_t *) &colour;
+
+	fprintf(stdout, "      %s:\n", name);
+	fprintf(stdout, "        red: 0x%"PRIx8"\n", c[0]);
+	fprintf(stdout, "        green: 0x%"PRIx8"\n", c[1]);
+	fprintf(stdout, "        blue: 0x%"PRIx8"\n", c[2]);
+}
+
+static void print_gif_frame_colours(const nsgif_t *gif, uint32_t frame)
+{
+	const nsgif_colour_stats_t *stats;
+
+	stats = nsgif_get_frame_colour_stats(gif, frame);
+	if (stats == NULL) {
+		return;
+	}
+
+	fprintf(stdout, "    colours:\n");
+	fprintf(stdout, "      pixels: %"PRIu32"\n", stats->pixels);
+	print_gif_colour("dominant", stats->dominant);
+	print_gif_colour("average", stats->average);
+}
+
+static void print_gif_extensions(const nsgif_t *gif)
+{
+	const nsgif_info_t *info = nsgif_get_info(gif);
+
+	if (info->extension_count == 0) {
+		return;
+	}
+
+	fprintf(stdout, "  extensions:\n");
+	for (uint32_t i = 0; i < info->extension_count; i++) {
+		const nsgif_extension_info_t *ext;
+
+		ext = nsgif_get_extension_info(gif, i);
+		fprintf(stdout, "  - extension: %"PRIu32"\n", i);
+		fprintf(stdout, "    label: 0x%"PRIx8"\n", ext->label);
+		fprintf(stdout, "    frame: %"PRIu32"\n", ext->frame);
+		fprintf(stdout, "    offset: %zu\n", ext->offset);
+		fprintf(stdout, "    sub-blocks: %"PRIu32"\n", ext->sub_blocks);
+		fprintf(stdout, "    data-length: %zu\n", ext->data_len);
+	}
+}
+
+static void print_gif_checks(nsgif_t *gif)
+{
+	const nsgif_info_t *info = nsgif_get_info(gif);
+	nsgif_frame_check_t *checks;
+
+	if (info->frame_count == 0) {
+		return;
+	}
+
+	checks = malloc(info->frame_count * sizeof(*checks));
+	if (checks == NULL) {
+		return;
+	}
+
+	nsgif_data_check(gif, checks);
+
+	fprintf(stdout, "  checks:\n");
+	for (uint32_t i = 0; i < info->frame_count; i++) {
+		fprintf(stdout, "  - frame: %"PRIu32"\n", i);
+		fprintf(stdout, "    status: %s\n",
+				nsgif_strerror(checks[i].status));
+		fprintf(stdout, "    pixels: %"PRIu32"\n", checks[i].pixels);
+		fprintf(stdout, "    expected: %"PRIu32"\n", checks[i].expected);
+		fprintf(stdout, "    start: %zu\n", checks[i].start);
+		fprintf(stdout, "    end: %zu\n", checks[i].end);
+	}
+
+	free(checks);
+}
+
 static bool save_palette(
 		const char *img_filename,
 		const char *palette_filename,
@@ -326,6 +480,7 @@ static void decode(FILE* ppm, const char *name, nsgif_t *gif, bool first)
 			f_info = nsgif_get_frame_info(gif, frame_new);
 			if (f_info != NULL) {
 				print_gif_frame_info(f_info, frame_new);
+				print_gif_frame_cost(gif, frame_new);
 			}
 		}
 		if (first && nsgif_options.palette) {
@@ -339,7 +494,12 @@ static void decode(FILE* ppm, const char *name, nsgif_t *gif, bool first)
 					frame_new, nsgif_strerror(err));
 			/* Continue decoding the rest of the frames. */
 
-		} else if (first && ppm != NULL) {
+		} else if (first && nsgif_options.info) {
+			print_gif_frame_damage(gif);
+			print_gif_frame_colours(gif, frame_new);
+		}
+
+		if (err == NSGIF_OK && first && ppm != NULL) {
 			fprintf(ppm, "# frame %u:\n", frame_new);
 			image = (const uint8_t *) bitmap;
 			for (uint32_t y = 0; y != info->height; y++) {
@@ -361,6 +521,1116 @@ static void decode(FILE* ppm, const char *name, nsgif_t *gif, bool first)
 	}
 }
 
+/** Frames decoded in order, for comparison with other decode modes. */
+struct reference {
+	const uint8_t *data;  /**< The GIF source data. */
+	size_t size;          /**< Size of the GIF source data in bytes. */
+	uint32_t width;       /**< Frame width in pixels. */
+	uint32_t height;      /**< Frame height in pixels. */
+	size_t frame_size;    /**< Bytes per frame bitmap. */
+	uint32_t frame_count; /**< Number of frames. */
+	uint8_t *frames;      /**< Frame bitmaps, in frame order. */
+	bool *ok;             /**< Whether each frame decoded successfully. */
+	unsigned mismatches;  /**< Number of mismatched frames found. */
+};
+
+static nsgif_t *compare_gif_new(void)
+{
+	const nsgif_bitmap_cb_vt bitmap_callbacks = {
+		.create     = bitmap_create,
+		.destroy    = bitmap_destroy,
+		.get_buffer = bitmap_get_buffer,
+	};
+	nsgif_t *gif;
+	nsgif_error err;
+
+	err = nsgif_create(&bitmap_callbacks, NSGIF_BITMAP_FMT_R8G8B8A8, &gif);
+	if (err != NSGIF_OK) {
+		warning("nsgif_create", err);
+		exit(EXIT_FAILURE);
+	}
+
+	return gif;
+}
+
+static nsgif_t *compare_gif_create(const struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_new();
+
+	nsgif_data_scan(gif, ref->size, ref->data);
+	nsgif_data_complete(gif);
+
+	return gif;
+}
+
+static void compare_frame(
+		struct reference *ref,
+		const char *mode,
+		uint32_t frame,
+		nsgif_error err,
+		const nsgif_bitmap_t *bitmap)
+{
+	if (err != NSGIF_OK || !ref->ok[frame]) {
+		/* Nothing to compare. */
+		return;
+	}
+
+	if (memcmp(bitmap, ref->frames + ref->frame_size * frame,
+			ref->frame_size) != 0) {
+		fprintf(stderr, "%s: frame %"PRIu32" differs\n", mode, frame);
+		ref->mismatches++;
+	}
+}
+
+static void compare_playback(
+		struct reference *ref,
+		const char *mode,
+		nsgif_t *gif)
+{
+	uint32_t steps = ref->frame_count * 2 + 2;
+
+	while (steps-- > 0) {
+		nsgif_bitmap_t *bitmap = NULL;
+		uint32_t delay_cs;
+		uint32_t frame;
+		nsgif_rect_t area;
+		nsgif_error err;
+
+		err = nsgif_frame_prepare(gif, &area, &delay_cs, &frame);
+		if (err != NSGIF_OK) {
+			break;
+		}
+
+		err = nsgif_frame_decode(gif, frame, &bitmap);
+		compare_frame(ref, mode, frame, err, bitmap);
+
+		if (delay_cs == NSGIF_INFINITE) {
+			break;
+		}
+	}
+}
+
+static void compare_decimation(struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_create(ref);
+
+	nsgif_set_frame_decimation(gif, 15);
+	compare_playback(ref, "decimation", gif);
+
+	nsgif_destroy(gif);
+}
+
+static void compare_placeholder(struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_create(ref);
+	uint32_t buffer[16 * 16];
+
+	/* Placeholders must leave the next frame decode unaffected. */
+	for (uint32_t i = 0; i < ref->frame_count; i++) {
+		nsgif_bitmap_t *bitmap = NULL;
+		nsgif_error err;
+
+		nsgif_placeholder(gif, buffer, 16, 16);
+		err = nsgif_frame_decode(gif, i, &bitmap);
+		compare_frame(ref, "placeholder", i, err, bitmap);
+	}
+
+	nsgif_destroy(gif);
+}
+
+static void compare_packed(struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_create(ref);
+	uint32_t palette[NSGIF_MAX_COLOURS];
+	uint8_t *packed;
+	size_t entries;
+
+	packed = malloc((size_t)ref->width * ref->height + 1);
+	if (packed == NULL) {
+		fprintf(stderr, "Unable to allocate packed frame\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (uint32_t i = 0; i < ref->frame_count; i++) {
+		const uint32_t *image = (const uint32_t *)
+				(ref->frames + ref->frame_size * i);
+		nsgif_error err;
+
+		err = nsgif_frame_decode_packed(gif, i, 8, packed, ref->width);
+		if (err == NSGIF_ERR_FORMAT) {
+			/* Not a single palette GIF. */
+			break;
+		} else if (err != NSGIF_OK || !ref->ok[i]) {
+			continue;
+		}
+
+		/* Transparent pixels may be given any index. */
+		nsgif_global_palette(gif, palette, &entries);
+		for (size_t p = 0; p < (size_t)ref->width * ref->height; p++) {
+			if (image[p] != 0 && (packed[p] >= entries ||
+					palette[packed[p]] != image[p])) {
+				fprintf(stderr, "packed: frame %"PRIu32
+						" differs\n", i);
+				ref->mismatches++;
+				break;
+			}
+		}
+	}
+
+	free(packed);
+	nsgif_destroy(gif);
+}
+
+static bool compare_extension(
+		const struct reference *ref,
+		const nsgif_t *gif,
+		uint32_t i,
+		size_t *end)
+{
+	const nsgif_extension_info_t *ext = nsgif_get_extension_info(gif, i);
+	const uint8_t *data = ref->data;
+	nsgif_span_t *spans;
+	size_t data_len = 0;
+	size_t pos;
+	bool ok = true;
+
+	/* Introducer, label and header block size. */
+	if (ext == NULL || ext->offset < *end ||
+	    ext->offset + 2 >= ref->size ||
+	    data[ext->offset] != 0x21 ||
+	    data[ext->offset + 1] != ext->label) {
+		return false;
+	}
+	if (ext->label == NSGIF_EXT_COMMENT) {
+		ok = ext->header_offset == ext->offset + 2 &&
+				ext->header_len == 0;
+	} else {
+		ok = ext->header_offset == ext->offset + 3 &&
+				ext->header_len == data[ext->offset + 2];
+	}
+	if (!ok) {
+		return false;
+	}
+
+	/* Each span must be a sub-block in the source data, in order. */
+	spans = malloc((ext->sub_blocks + 1) * sizeof(*spans));
+	if (spans == NULL) {
+		fprintf(stderr, "Unable to allocate extension spans\n");
+		exit(EXIT_FAILURE);
+	}
+	if (nsgif_extension_data(gif, i, spans, ext->sub_blocks) !=
+			ext->sub_blocks) {
+		ok = false;
+	}
+	pos = ext->header_offset + ext->header_len;
+	for (uint32_t s = 0; ok && s < ext->sub_blocks; s++) {
+		ok = pos + 1 + spans[s].len < ref->size &&
+				spans[s].data == data + pos + 1 &&
+				spans[s].len == data[pos] &&
+				spans[s].len != 0;
+		data_len += spans[s].len;
+		pos += spans[s].len + 1;
+	}
+	free(spans);
+
+	/* Ends with a block terminator. */
+	*end = pos + 1;
+	return ok && data_len == ext->data_len &&
+			pos < ref->size && data[pos] == 0;
+}
+
+static void compare_extensions(struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_new();
+	nsgif_t *chunked = compare_gif_new();
+	const nsgif_info_t *info;
+	size_t end = 0;
+
+	nsgif_set_extension_index(gif, true);
+	nsgif_data_scan(gif, ref->size, ref->data);
+	nsgif_data_complete(gif);
+	info = nsgif_get_info(gif);
+
+	for (uint32_t i = 0; i < info->extension_count; i++) {
+		if (!compare_extension(ref, gif, i, &end)) {
+			fprintf(stderr, "extensions: extension %"PRIu32
+					" doesn't match the data\n", i);
+			ref->mismatches++;
+			break;
+		}
+	}
+
+	/* Frames scanned again as data arrives mustn't be indexed twice. */
+	nsgif_set_extension_index(chunked, true);
+	for (size_t len = 1; len < ref->size; len += 1 + ref->size / 8) {
+		nsgif_data_scan(chunked, len, ref->data);
+	}
+	nsgif_data_scan(chunked, ref->size, ref->data);
+	nsgif_data_complete(chunked);
+
+	if (nsgif_get_info(chunked)->extension_count !=
+			info->extension_count) {
+		fprintf(stderr, "extensions: chunked scan found "
+				"%"PRIu32", not %"PRIu32"\n",
+				nsgif_get_info(chunked)->extension_count,
+				info->extension_count);
+		ref->mismatches++;
+	}
+
+	nsgif_destroy(chunked);
+	nsgif_destroy(gif);
+}
+
+static void colour_transform_identity(
+		void *pw,
+		uint32_t *table,
+		size_t entries)
+{
+	unsigned *calls = pw;
+
+	(void)table;
+	(void)entries;
+
+	(*calls)++;
+}
+
+static void compare_colour_transform(struct reference *ref)
+{
+	const char *modes[] = { "colour transform", "late colour transform" };
+	unsigned calls = 0;
+
+	for (unsigned m = 0; m < 2; m++) {
+		nsgif_t *gif = compare_gif_new();
+		nsgif_bitmap_t *bitmap;
+
+		if (m == 0) {
+			nsgif_set_colour_transform(gif,
+					colour_transform_identity, &calls);
+		}
+		nsgif_data_scan(gif, ref->size, ref->data);
+		nsgif_data_complete(gif);
+		if (m == 1) {
+			/* Set after frames are decoded, so they're redone. */
+			nsgif_frame_decode(gif, ref->frame_count - 1, &bitmap);
+			nsgif_set_colour_transform(gif,
+					colour_transform_identity, &calls);
+		}
+
+		for (uint32_t i = 0; i < ref->frame_count; i++) {
+			nsgif_error err = nsgif_frame_decode(gif, i, &bitmap);
+			compare_frame(ref, modes[m], i, err, bitmap);
+		}
+
+		/* The global palette is decoded once frames are found. */
+		if (calls == 0 && ref->frame_count > 0 &&
+				nsgif_get_info(gif)->global_palette) {
+			fprintf(stderr, "%s: never called\n", modes[m]);
+			ref->mismatches++;
+		}
+		calls = 0;
+
+		nsgif_destroy(gif);
+	}
+}
+
+static bool compare_colour_stats_frame(
+		const struct reference *ref,
+		const nsgif_t *gif,
+		uint32_t frame)
+{
+	const nsgif_colour_stats_t *stats;
+	const nsgif_frame_info_t *info;
+	const uint32_t *image = (const uint32_t *)
+			(ref->frames + ref->frame_size * frame);
+	uint64_t sum[4] = { 0 };
+	uint32_t histogram = 0;
+	uint32_t dominant = 0;
+	uint32_t max = 0;
+	uint8_t average[4];
+
+	info = nsgif_get_frame_info(gif, frame);
+	stats = nsgif_get_frame_colour_stats(gif, frame);
+	if (stats == NULL) {
+		return !info->display;
+	}
+
+	for (uint32_t i = 0; i < NSGIF_MAX_COLOURS; i++) {
+		histogram += stats->histogram[i];
+		if (stats->histogram[i] > max) {
+			max = stats->histogram[i];
+		}
+	}
+	if (histogram > info->clipped_area || stats->pixels > histogram) {
+		return false;
+	}
+
+	if (histogram == 0 || info->transparency ||
+	    histogram != info->clipped_area) {
+		/* The bitmap doesn't show just the frame's own pixels. */
+		return true;
+	}
+
+	for (uint32_t y = info->rect.y0; y < info->rect.y1 &&
+			y < ref->height; y++) {
+		for (uint32_t x = info->rect.x0; x < info->rect.x1 &&
+				x < ref->width; x++) {
+			const uint32_t pixel = image[y * ref->width + x];
+			const uint8_t *c = (const uint8_t *)&pixel;
+
+			for (uint32_t i = 0; i < 4; i++) {
+				sum[i] += c[i];
+			}
+			dominant += (pixel == stats->dominant);
+		}
+	}
+
+	for (uint32_t i = 0; i < 4; i++) {
+		average[i] = sum[i] / histogram;
+	}
+
+	/* Palette entries may share the dominant colour. */
+	return stats->pixels == histogram && dominant >= max &&
+			memcmp(average, &stats->average, 4) == 0;
+}
+
+static void compare_colour_stats(struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_create(ref);
+
+	nsgif_set_colour_stats(gif, true);
+
+	for (uint32_t i = 0; i < ref->frame_count; i++) {
+		nsgif_bitmap_t *bitmap;
+
+		if (nsgif_frame_decode(gif, i, &bitmap) != NSGIF_OK ||
+		    !ref->ok[i]) {
+			continue;
+		}
+
+		if (!compare_colour_stats_frame(ref, gif, i)) {
+			fprintf(stderr, "colour stats: frame %"PRIu32
+					" doesn't match\n", i);
+			ref->mismatches++;
+		}
+	}
+
+	nsgif_destroy(gif);
+}
+
+#define PARALLEL_BANDS 4
+
+struct parallel_band {
+	nsgif_job_cb job;
+	void *ctx;
+	uint32_t start;
+	uint32_t end;
+};
+
+static void *parallel_band_run(void *arg)
+{
+	struct parallel_band *band = arg;
+
+	band->job(band->ctx, band->start, band->end);
+	return NULL;
+}
+
+static void parallel_for(
+		void *pw,
+		uint32_t count,
+		nsgif_job_cb job,
+		void *ctx)
+{
+	struct parallel_band bands[PARALLEL_BANDS];
+	pthread_t threads[PARALLEL_BANDS];
+	bool started[PARALLEL_BANDS];
+
+	(void)pw;
+
+	for (unsigned i = 0; i < PARALLEL_BANDS; i++) {
+		bands[i] = (struct parallel_band) {
+			.job = job,
+			.ctx = ctx,
+			.start = (uint64_t)count * i / PARALLEL_BANDS,
+			.end = (uint64_t)count * (i + 1) / PARALLEL_BANDS,
+		};
+		started[i] = pthread_create(&threads[i], NULL,
+				parallel_band_run, &bands[i]) == 0;
+		if (!started[i]) {
+			parallel_band_run(&bands[i]);
+		}
+	}
+
+	for (unsigned i = 0; i < PARALLEL_BANDS; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+}
+
+static void compare_parallel(struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_create(ref);
+
+	/* Split every canvas operation, however small. */
+	nsgif_set_parallel(gif, parallel_for, NULL, 0);
+
+	for (uint32_t i = 0; i < ref->frame_count; i++) {
+		nsgif_bitmap_t *bitmap = NULL;
+		nsgif_error err;
+
+		err = nsgif_frame_decode(gif, i, &bitmap);
+		compare_frame(ref, "parallel", i, err, bitmap);
+	}
+
+	nsgif_set_playback(gif, NSGIF_PLAYBACK_REVERSE);
+	nsgif_set_checkpoint_budget(gif, ref->frame_size * 4);
+	compare_playback(ref, "parallel reverse", gif);
+
+	nsgif_destroy(gif);
+}
+
+static nsgif_frame_check_t *data_check(
+		nsgif_t *gif,
+		nsgif_error *ret)
+{
+	const nsgif_info_t *info = nsgif_get_info(gif);
+	nsgif_frame_check_t *checks;
+
+	checks = malloc((info->frame_count + 1) * sizeof(*checks));
+	if (checks == NULL) {
+		fprintf(stderr, "Unable to allocate frame checks\n");
+		exit(EXIT_FAILURE);
+	}
+
+	*ret = nsgif_data_check(gif, checks);
+	return checks;
+}
+
+static nsgif_error data_check_expected(
+		const nsgif_frame_check_t *checks,
+		uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		if (checks[i].status == NSGIF_ERR_FRAME_DISPLAY) {
+			continue;
+		}
+		if (checks[i].status != NSGIF_OK ||
+		    checks[i].pixels != checks[i].expected) {
+			return NSGIF_ERR_DATA_FRAME;
+		}
+	}
+
+	return NSGIF_OK;
+}
+
+static void compare_data_check_truncated(
+		struct reference *ref,
+		const nsgif_frame_check_t *full,
+		uint32_t frame)
+{
+	size_t cut = full[frame].start + (full[frame].end -
+			full[frame].start) / 2;
+	nsgif_frame_check_t *checks;
+	nsgif_t *gif = compare_gif_new();
+	nsgif_bitmap_t *bitmap;
+	nsgif_error decoded = NSGIF_OK;
+	nsgif_error ret;
+
+	/* Frames before the cut are checked the same as before. */
+	nsgif_data_scan(gif, cut, ref->data);
+	if (nsgif_get_info(gif)->frame_count != frame) {
+		fprintf(stderr, "data check: truncated scan found "
+				"%"PRIu32" frames, not %"PRIu32"\n",
+				nsgif_get_info(gif)->frame_count, frame);
+		ref->mismatches++;
+		nsgif_destroy(gif);
+		return;
+	}
+
+	checks = data_check(gif, &ret);
+	for (uint32_t i = 0; i < frame; i++) {
+		if (checks[i].status != full[i].status ||
+		    checks[i].pixels != full[i].pixels ||
+		    checks[i].end != full[i].end) {
+			fprintf(stderr, "data check: frame %"PRIu32
+					" differs when truncated\n", i);
+			ref->mismatches++;
+		}
+	}
+	if (ret != data_check_expected(checks, frame)) {
+		fprintf(stderr, "data check: truncated gave %s\n",
+				nsgif_strerror(ret));
+		ref->mismatches++;
+	}
+	free(checks);
+
+	/* With no more data, the cut frame is shown as far as it goes. */
+	nsgif_data_complete(gif);
+	if (nsgif_get_info(gif)->frame_count != frame + 1) {
+		nsgif_destroy(gif);
+		return;
+	}
+
+	/* Decoded in order, like the reference. */
+	for (uint32_t i = 0; i <= frame; i++) {
+		decoded = nsgif_frame_decode(gif, i, &bitmap);
+	}
+
+	checks = data_check(gif, &ret);
+	if (ret != data_check_expected(checks, frame + 1) ||
+	    checks[frame].status != NSGIF_OK ||
+	    checks[frame].end > cut ||
+	    (ref->ok[frame] && decoded != NSGIF_OK)) {
+		fprintf(stderr, "data check: truncated frame %"PRIu32
+				" is %s with %"PRIu32" of %"PRIu32
+				" pixels\n", frame,
+				nsgif_strerror(checks[frame].status),
+				checks[frame].pixels,
+				checks[frame].expected);
+		ref->mismatches++;
+	}
+	free(checks);
+
+	nsgif_destroy(gif);
+}
+
+static void compare_data_check(struct reference *ref)
+{
+	nsgif_t *gif = compare_gif_create(ref);
+	nsgif_frame_check_t *checks;
+	uint32_t last = UINT32_MAX;
+	nsgif_error ret;
+
+	checks = data_check(gif, &ret);
+
+	for (uint32_t i = 0; i < ref->frame_count; i++) {
+		const nsgif_frame_info_t *info = nsgif_get_frame_info(gif, i);
+
+		if (checks[i].status == NSGIF_ERR_FRAME_DISPLAY) {
+			if (info->display) {
+				fprintf(stderr, "data check: frame %"PRIu32
+						" not checked\n", i);
+				ref->mismatches++;
+			}
+			continue;
+		}
+
+		if (checks[i].pixels > checks[i].expected ||
+		    checks[i].start > checks[i].end ||
+		    checks[i].end > ref->size) {
+			fprintf(stderr, "data check: frame %"PRIu32
+					" is out of range\n", i);
+			ref->mismatches++;
+		}
+
+		/* Frames that fail the check must fail to decode. */
+		if (checks[i].status != NSGIF_OK && ref->ok[i]) {
+			fprintf(stderr, "data check: frame %"PRIu32
+					" is %s, but decodes\n", i,
+					nsgif_strerror(checks[i].status));
+			ref->mismatches++;
+		}
+
+		if (checks[i].end > checks[i].start + 2) {
+			last = i;
+		}
+	}
+
+	if (ret != data_check_expected(checks, ref->frame_count)) {
+		fprintf(stderr, "data check: gave %s\n",
+				nsgif_strerror(ret));
+		ref->mismatches++;
+	}
+
+	if (last != UINT32_MAX && last == ref->frame_count - 1) {
+		compare_data_check_truncated(ref, checks, last);
+	}
+
+	free(checks);
+	nsgif_destroy(gif);
+}
+
+static void compare_order(
+		struct reference *ref,
+		const char *mode,
+		nsgif_playback playback,
+		size_t checkpoint_frames)
+{
+	nsgif_t *gif = compare_gif_create(ref);
+
+	nsgif_set_playback(gif, playback);
+	nsgif_set_checkpoint_budget(gif, ref->frame_size * checkpoint_frames);
+	compare_playback(ref, mode, gif);
+
+	nsgif_destroy(gif);
+}
+
+static void compare_atlas_frame(
+		struct reference *ref,
+		uint32_t frame,
+		const nsgif_atlas_frame_t *entry,
+		const uint32_t *atlas,
+		uint32_t atlas_width)
+{
+	const uint32_t *image = (const uint32_t *)
+			(ref->frames + ref->frame_size * frame);
+	for (uint32_t y = 0; y < ref->height; y++) {
+		for (uint32_t x = 0; x < ref->width; x++) {
+			uint32_t expected = image[y * ref->width + x];
+			uint32_t pixel = 0;
+
+			if (x >= entry->rect.x0 && x < entry->rect.x1 &&
+			    y >= entry->rect.y0 && y < entry->rect.y1) {
+				pixel = atlas[(entry->atlas.y0 +
+						y - entry->rect.y0) *
+						atlas_width +
+						entry->atlas.x0 +
+						x - entry->rect.x0];
+			}
+
+			if (pixel != expected) {
+				fprintf(stderr, "atlas: frame %"PRIu32" "
+						"differs\n", frame);
+				ref->mismatches++;
+				return;
+			}
+		}
+	}
+}
+
+static void compare_atlas(struct reference *ref)
+{
+	const nsgif_atlas_params_t params = {
+		.max_width = 1024,
+		.padding = 1,
+		.trim = true,
+		.dedupe = true,
+	};
+	nsgif_t *gif = compare_gif_create(ref);
+	nsgif_atlas_frame_t *table;
+	nsgif_bitmap_t *atlas;
+	nsgif_error err;
+
+	table = malloc((ref->frame_count + 1) * sizeof(*table));
+	if (table == NULL) {
+		fprintf(stderr, "Unable to allocate atlas table\n");
+		exit(EXIT_FAILURE);
+	}
+
+	err = nsgif_atlas_create(gif, &params, table, &atlas);
+	if (err == NSGIF_OK) {
+		uint32_t atlas_width = 0;
+
+		/* The atlas is as wide as its widest row of images. */
+		for (uint32_t i = 0; i < ref->frame_count; i++) {
+			if (atlas_width < table[i].atlas.x1 + params.padding) {
+				atlas_width = table[i].atlas.x1 +
+						params.padding;
+			}
+		}
+
+		for (uint32_t i = 0; i < ref->frame_count; i++) {
+			if (ref->ok[i]) {
+				compare_atlas_frame(ref, i, &table[i],
+						atlas, atlas_width);
+			}
+		}
+		bitmap_destroy(atlas);
+
+	} else if (err != NSGIF_ERR_OOM && err != NSGIF_ERR_BAD_FRAME) {
+		/* Too big for the test bitmaps, or no frames, is fine. */
+		warning("nsgif_atlas_create", err);
+		ref->mismatches++;
+	}
+
+	free(table);
+	nsgif_destroy(gif);
+}
+
+/** Number of animations played by the scheduler check. */
+#define SCHED_ANIMS 5
+
+/** Number of ticks in each phase of the scheduler check. */
+#define SCHED_TICKS 64
+
+/** An animation played by the scheduler check. */
+struct sched_anim {
+	nsgif_t *gif;              /**< The animation. */
+	nsgif_priority priority;   /**< Its priority in the scheduler. */
+	bool registered;           /**< Whether it's in the scheduler. */
+	unsigned frames;           /**< Number of frames delivered. */
+	struct sched_check *check; /**< The check it's part of. */
+};
+
+/** State of the scheduler check. */
+struct sched_check {
+	struct reference *ref;     /**< Reference, for error counts. */
+	nsgif_sched_t *sched;      /**< The scheduler. */
+	nsgif_priority last;       /**< Priority of the last frame this tick. */
+	uint64_t now;              /**< Time of the current tick. */
+	struct sched_anim anims[SCHED_ANIMS];
+};
+
+static void sched_frame(
+		void *pw,
+		nsgif_t *gif,
+		nsgif_bitmap_t *bitmap,
+		const nsgif_rect_t *area)
+{
+	struct sched_anim *anim = pw;
+	struct sched_check *check = anim->check;
+
+	(void) bitmap;
+	(void) area;
+
+	if (gif != anim->gif || !anim->registered) {
+		fprintf(stderr, "sched: frame for unregistered animation\n");
+		check->ref->mismatches++;
+	}
+
+	if (anim->priority == NSGIF_PRIORITY_HIDDEN) {
+		fprintf(stderr, "sched: frame for hidden animation\n");
+		check->ref->mismatches++;
+	}
+
+	if (anim->priority < check->last) {
+		fprintf(stderr, "sched: frame out of priority order\n");
+		check->ref->mismatches++;
+	}
+
+	check->last = anim->priority;
+	anim->frames++;
+}
+
+static void sched_set_priority(
+		struct sched_check *check,
+		unsigned index,
+		nsgif_priority priority)
+{
+	struct sched_anim *anim = &check->anims[index];
+
+	nsgif_sched_set_priority(check->sched, anim->gif, priority);
+	anim->priority = priority;
+}
+
+static unsigned sched_frames(const struct sched_check *check)
+{
+	unsigned frames = 0;
+
+	for (unsigned i = 0; i < SCHED_ANIMS; i++) {
+		frames += check->anims[i].frames;
+	}
+
+	return frames;
+}
+
+/**
+ * Tick the scheduler as a client's timer would.
+ *
+ * \return the number of frames delivered.
+ */
+static unsigned sched_run(struct sched_check *check)
+{
+	unsigned frames = sched_frames(check);
+
+	for (unsigned t = 0; t < SCHED_TICKS; t++) {
+		uint64_t wakeup;
+
+		check->last = NSGIF_PRIORITY_VISIBLE;
+		wakeup = nsgif_sched_tick(check->sched, check->now);
+		if (wakeup == UINT64_MAX) {
+			break;
+		} else if (wakeup <= check->now) {
+			fprintf(stderr, "sched: wakeup not after tick\n");
+			check->ref->mismatches++;
+			break;
+		}
+		check->now = wakeup;
+	}
+
+	return sched_frames(check) - frames;
+}
+
+static void compare_sched(struct reference *ref)
+{
+	static const nsgif_priority priority[SCHED_ANIMS] = {
+		NSGIF_PRIORITY_NEAR,
+		NSGIF_PRIORITY_VISIBLE,
+		NSGIF_PRIORITY_HIDDEN,
+		NSGIF_PRIORITY_NEAR,
+		NSGIF_PRIORITY_VISIBLE,
+	};
+	struct sched_check check = {
+		.ref = ref,
+	};
+	size_t budget = (size_t)ref->width * ref->height / 2 + 1;
+	unsigned hidden_frames;
+	bool all_ok = true;
+	nsgif_error err;
+
+	/* Frames that fail to decode aren't given to the client, and an
+	 * animation may skip ahead to them. */
+	for (uint32_t i = 0; i < ref->frame_count; i++) {
+		all_ok = all_ok && ref->ok[i];
+	}
+
+	err = nsgif_sched_create(budget, &check.sched);
+	if (err != NSGIF_OK) {
+		warning("nsgif_sched_create", err);
+		exit(EXIT_FAILURE);
+	}
+
+	for (unsigned i = 0; i < SCHED_ANIMS; i++) {
+		struct sched_anim *anim = &check.anims[i];
+
+		anim->gif = compare_gif_create(ref);
+		anim->priority = priority[i];
+		anim->check = &check;
+
+		err = nsgif_sched_add(check.sched, anim->gif,
+				anim->priority, sched_frame, anim);
+		if (err != NSGIF_OK) {
+			warning("nsgif_sched_add", err);
+			exit(EXIT_FAILURE);
+		}
+		anim->registered = true;
+	}
+
+	/* Animations with mixed priorities, on a budget. */
+	sched_run(&check);
+
+	/* Pause one, and show the one that started hidden. */
+	sched_set_priority(&check, 0, NSGIF_PRIORITY_HIDDEN);
+	sched_set_priority(&check, 2, NSGIF_PRIORITY_VISIBLE);
+	hidden_frames = check.anims[2].frames;
+	sched_run(&check);
+	if (all_ok && ref->frame_count > 0 &&
+	    check.anims[2].frames == hidden_frames) {
+		fprintf(stderr, "sched: shown animation not resumed\n");
+		ref->mismatches++;
+	}
+
+	/* Remove one, and resume the paused one. */
+	nsgif_sched_remove(check.sched, check.anims[4].gif);
+	check.anims[4].registered = false;
+	sched_set_priority(&check, 0, NSGIF_PRIORITY_NEAR);
+	sched_run(&check);
+
+	/* With every animation hidden, nothing happens. */
+	for (unsigned i = 0; i < SCHED_ANIMS; i++) {
+		sched_set_priority(&check, i, NSGIF_PRIORITY_HIDDEN);
+	}
+	if (nsgif_sched_wakeup(check.sched) != UINT64_MAX) {
+		fprintf(stderr, "sched: wakeup with all animations hidden\n");
+		ref->mismatches++;
+	}
+	if (sched_run(&check) != 0) {
+		fprintf(stderr, "sched: frames with all animations hidden\n");
+		ref->mismatches++;
+	}
+
+	nsgif_sched_destroy(check.sched);
+	for (unsigned i = 0; i < SCHED_ANIMS; i++) {
+		nsgif_destroy(check.anims[i].gif);
+	}
+}
+
+/** Number of steps to give the source data to the threads check in. */
+#define THREADS_STEPS 50
+
+/** Frames passed from the scanning thread to the decoding thread. */
+struct threads_check {
+	struct reference *ref;     /**< Frames to compare with. */
+	nsgif_t *gif;              /**< The GIF being scanned and decoded. */
+	pthread_mutex_t lock;      /**< Lock for the members below. */
+	pthread_cond_t cond;       /**< Signalled on change to the below. */
+	uint32_t *frames;          /**< Frames ready to decode. */
+	uint32_t head;             /**< Next frame to decode. */
+	uint32_t tail;             /**< Number of frames made ready. */
+	bool done;                 /**< Whether scanning has finished. */
+};
+
+static void threads_frame_ready(void *pw, uint32_t frame)
+{
+	struct threads_check *check = pw;
+
+	pthread_mutex_lock(&check->lock);
+	if (check->tail < check->ref->frame_count) {
+		check->frames[check->tail++] = frame;
+		pthread_cond_signal(&check->cond);
+	} else {
+		fprintf(stderr, "threads: frame %"PRIu32" unexpected\n",
+				frame);
+		check->ref->mismatches++;
+	}
+	pthread_mutex_unlock(&check->lock);
+}
+
+static void *threads_decode(void *pw)
+{
+	struct threads_check *check = pw;
+
+	for (;;) {
+		nsgif_bitmap_t *bitmap = NULL;
+		uint32_t frame;
+		nsgif_error err;
+
+		pthread_mutex_lock(&check->lock);
+		while (check->head == check->tail && !check->done) {
+			pthread_cond_wait(&check->cond, &check->lock);
+		}
+		if (check->head == check->tail) {
+			pthread_mutex_unlock(&check->lock);
+			return NULL;
+		}
+		frame = check->frames[check->head++];
+		pthread_mutex_unlock(&check->lock);
+
+		/* A truncated frame may fail to decode until the data is
+		 * complete; compare_frame ignores failed decodes. */
+		err = nsgif_frame_decode(check->gif, frame, &bitmap);
+		compare_frame(check->ref, "threads", frame, err, bitmap);
+	}
+}
+
+/**
+ * Decode frames on another thread while the source data is scanned.
+ *
+ * This is most useful built with ThreadSanitizer.
+ */
+static void compare_threads(struct reference *ref)
+{
+	const nsgif_bitmap_cb_vt bitmap_callbacks = {
+		.create     = bitmap_create,
+		.destroy    = bitmap_destroy,
+		.get_buffer = bitmap_get_buffer,
+	};
+	struct threads_check check = {
+		.ref = ref,
+	};
+	size_t step = ref->size / THREADS_STEPS + 1;
+	pthread_t decoder;
+	nsgif_error err;
+
+	err = nsgif_create(&bitmap_callbacks, NSGIF_BITMAP_FMT_R8G8B8A8,
+			&check.gif);
+	if (err != NSGIF_OK) {
+		warning("nsgif_create", err);
+		exit(EXIT_FAILURE);
+	}
+
+	check.frames = malloc((ref->frame_count + 1) * sizeof(*check.frames));
+	if (check.frames == NULL ||
+	    pthread_mutex_init(&check.lock, NULL) != 0 ||
+	    pthread_cond_init(&check.cond, NULL) != 0) {
+		fprintf(stderr, "Unable to set up threads check\n");
+		exit(EXIT_FAILURE);
+	}
+
+	nsgif_set_frame_ready(check.gif, threads_frame_ready, &check);
+	if (pthread_create(&decoder, NULL, threads_decode, &check) != 0) {
+		fprintf(stderr, "Unable to create decoder thread\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t len = step; ; len += step) {
+		if (len >= ref->size) {
+			nsgif_data_scan(check.gif, ref->size, ref->data);
+			break;
+		}
+		nsgif_data_scan(check.gif, len, ref->data);
+	}
+	nsgif_data_complete(check.gif);
+
+	pthread_mutex_lock(&check.lock);
+	check.done = true;
+	pthread_cond_signal(&check.cond);
+	pthread_mutex_unlock(&check.lock);
+	pthread_join(decoder, NULL);
+
+	if (check.tail != ref->frame_count) {
+		fprintf(stderr, "threads: %"PRIu32" of %"PRIu32" frames "
+				"made ready\n", check.tail, ref->frame_count);
+		ref->mismatches++;
+	}
+
+	pthread_cond_destroy(&check.cond);
+	pthread_mutex_destroy(&check.lock);
+	free(check.frames);
+	nsgif_destroy(check.gif);
+}
+
+static bool compare(const uint8_t *data, size_t size)
+{
+	struct reference ref = {
+		.data = data,
+		.size = size,
+	};
+	const nsgif_info_t *info;
+	nsgif_t *gif;
+
+	gif = compare_gif_create(&ref);
+	info = nsgif_get_info(gif);
+
+	ref.frame_count = info->frame_count;
+	ref.width = info->width;
+	ref.height = info->height;
+	ref.frame_size = (size_t)info->width * info->height * BYTES_PER_PIXEL;
+	ref.frames = malloc(ref.frame_size * ref.frame_count + 1);
+	ref.ok = calloc(ref.frame_count + 1, sizeof(*ref.ok));
+	if (ref.frames == NULL || ref.ok == NULL) {
+		fprintf(stderr, "Unable to allocate reference frames\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (uint32_t i = 0; i < ref.frame_count; i++) {
+		nsgif_bitmap_t *bitmap;
+
+		if (nsgif_frame_decode(gif, i, &bitmap) == NSGIF_OK) {
+			memcpy(ref.frames + ref.frame_size * i,
+					bitmap, ref.frame_size);
+			ref.ok[i] = true;
+		}
+	}
+	nsgif_destroy(gif);
+
+	if (nsgif_options.compare) {
+		compare_decimation(&ref);
+		compare_placeholder(&ref);
+		compare_packed(&ref);
+		compare_extensions(&ref);
+		compare_colour_transform(&ref);
+		compare_colour_stats(&ref);
+		compare_parallel(&ref);
+		compare_data_check(&ref);
+		compare_order(&ref, "reverse",
+				NSGIF_PLAYBACK_REVERSE, 0);
+		compare_order(&ref, "reverse checkpoints",
+				NSGIF_PLAYBACK_REVERSE, 4);
+		compare_order(&ref, "ping-pong",
+				NSGIF_PLAYBACK_PING_PONG, 0);
+		compare_order(&ref, "ping-pong checkpoints",
+				NSGIF_PLAYBACK_PING_PONG, 4);
+	}
+
+	if (nsgif_options.atlas) {
+		compare_atlas(&ref);
+	}
+
+	if (nsgif_options.sched) {
+		compare_sched(&ref);
+	}
+
+	if (nsgif_options.threads) {
+		compare_threads(&ref);
+	}
+
+	free(ref.frames);
+	free(ref.ok);
+
+	return ref.mismatches == 0;
+}
+
 int main(int argc, char *argv[])
 {
 	const nsgif_bitmap_cb_vt bitmap_callbacks = {
@@ -406,6 +1676,13 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (nsgif_options.info) {
+		nsgif_set_extension_index(gif, true);
+		nsgif_set_frame_hashing(gif, true);
+		nsgif_set_damage_tracking(gif, true);
+		nsgif_set_colour_stats(gif, true);
+	}
+
 	/* load file into memory */
 	data = load_file(nsgif_options.file, &size);
 
@@ -419,6 +1696,14 @@ int main(int argc, char *argv[])
 
 	nsgif_data_complete(gif);
 
+	if ((nsgif_options.compare || nsgif_options.atlas ||
+	     nsgif_options.sched || nsgif_options.threads) &&
+	    !compare(data, size)) {
+		nsgif_destroy(gif);
+		free(data);
+		return EXIT_FAILURE;
+	}
+
 	if (nsgif_options.loops == 0) {
 		nsgif_options.loops = 1;
 	}
@@ -426,6 +1711,11 @@ int main(int argc, char *argv[])
 	for (uint64_t i = 0; i < nsgif_options.loops; i++) {
 		decode(ppm, nsgif_options.file, gif, i == 0);
 
+		if (i == 0 && nsgif_options.info) {
+			print_gif_extensions(gif);
+			print_gif_checks(gif);
+		}
+
 		/* We want to ignore any loop limit in the GIF. */
 		nsgif_reset(gif);
 	}
@@ -31,6 +31,11 @@ gifdecode()
 		return ${ECODE}
 	fi
 
+	${TEST_PATH}/test_nsgif ${1} --compare --atlas --sched --threads 2>> ${TEST_LOG}
+	if [ "$?" -ne 0 ]; then
+		return 128
+	fi
+
 	if [ -f "${CMPF}" ]; then
 		cmp ${CMPF} ${TEST_OUT}/${OUTF}.ppm >> ${TEST_LOG} 2>> ${TEST_LOG}
 		if [ "$?" -ne 0 ]; then